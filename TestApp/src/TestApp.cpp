@@ -7,10 +7,1004 @@
 // THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include "swapcodec.h"
+#include <condition_variable>
 #include <inttypes.h>
+#include <math.h>
+#include <mutex>
+#include <string.h>
 
 using namespace swapcodec;
 
+// Lossy frames have to decode above this PSNR against the frames that were encoded.
+static const double MinPsnr = 30.0;
+
+// Lossy high bit depth frames have to decode above this PSNR relative to their largest sample, which the precision of 8 bit streams wouldn't reach.
+static const double MinHighBitDepthPsnr = 48.0;
+
+static const size_t CheckResX = 336;
+static const size_t CheckResY = 208;
+static const size_t CheckFrameCount = 20;
+
+// Neither a multiple of the tile size nor even, so the chroma planes are rounded up.
+static const size_t CheckOddResX = 333;
+static const size_t CheckOddResY = 205;
+
+// A stream `testCheckStream` round trips: `CheckFrameCount` frames of `format` encoded with `options` and decoded to `outputFormat`.
+struct testStreamCase
+{
+  const char *name;
+  swapEncoderOptions options;
+  size_t resX;
+  size_t resY;
+  swapPixelFormat format;
+  swapPixelFormat outputFormat;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+// Relative to the largest sample of `bitDepth` bits. Samples of more than 8 bits take 16 bits; `size` is in bytes.
+static double testPsnr(IN const uint8_t *pA, IN const uint8_t *pB, const size_t size, const uint32_t bitDepth = 8)
+{
+  const double peak = (double)((1u << bitDepth) - 1);
+  const size_t sampleCount = bitDepth > 8 ? size / sizeof(uint16_t) : size;
+  double squaredError = 0;
+
+  for (size_t i = 0; i < sampleCount; i++)
+  {
+    const double a = bitDepth > 8 ? reinterpret_cast<const uint16_t *>(pA)[i] : pA[i];
+    const double b = bitDepth > 8 ? reinterpret_cast<const uint16_t *>(pB)[i] : pB[i];
+
+    squaredError += (a - b) * (a - b);
+  }
+
+  if (squaredError == 0)
+    return INFINITY;
+
+  return 10.0 * log10(peak * peak * sampleCount / squaredError);
+}
+
+// The planes of a planar frame in the order `swapGetImageSize` counts them. Chroma planes are subsampled by `1 << shiftX` and `1 << shiftY`, rounded up for odd sizes.
+struct testPlaneLayout
+{
+  swapChromaFormat chromaFormat;
+  bool alpha;
+  size_t bytesPerSample;
+  size_t planeCount;
+  size_t shiftX[4];
+  size_t shiftY[4];
+};
+
+// Returns `false` if `format` isn't planar.
+static bool testGetPlaneLayout(const swapPixelFormat format, OUT testPlaneLayout *pLayout)
+{
+  static const struct
+  {
+    swapPixelFormat format;
+    swapChromaFormat chromaFormat;
+    bool alpha;
+    size_t bytesPerSample;
+  } planarFormats[] =
+  {
+    { sPF_YUV420, sCF_420, false, 1 },
+    { sPF_YUV422, sCF_422, false, 1 },
+    { sPF_YUV444, sCF_444, false, 1 },
+    { sPF_YUV420_16, sCF_420, false, 2 },
+    { sPF_YUV422_16, sCF_422, false, 2 },
+    { sPF_YUV444_16, sCF_444, false, 2 },
+    { sPF_YUVA420, sCF_420, true, 1 },
+    { sPF_YUVA422, sCF_422, true, 1 },
+    { sPF_YUVA444, sCF_444, true, 1 },
+    { sPF_YUVA420_16, sCF_420, true, 2 },
+    { sPF_YUVA422_16, sCF_422, true, 2 },
+    { sPF_YUVA444_16, sCF_444, true, 2 },
+  };
+
+  for (const auto &planarFormat : planarFormats)
+  {
+    if (planarFormat.format != format)
+      continue;
+
+    pLayout->chromaFormat = planarFormat.chromaFormat;
+    pLayout->alpha = planarFormat.alpha;
+    pLayout->bytesPerSample = planarFormat.bytesPerSample;
+    pLayout->planeCount = planarFormat.alpha ? 4 : 3;
+
+    for (size_t plane = 0; plane < pLayout->planeCount; plane++)
+    {
+      const bool chroma = plane == 1 || plane == 2;
+
+      pLayout->shiftX[plane] = chroma && planarFormat.chromaFormat != sCF_444 ? 1 : 0;
+      pLayout->shiftY[plane] = chroma && planarFormat.chromaFormat == sCF_420 ? 1 : 0;
+    }
+
+    return true;
+  }
+
+  return false;
+}
+
+static size_t testGetPlaneSize(const size_t size, const size_t shift)
+{
+  return (size + ((size_t)1 << shift) - 1) >> shift;
+}
+
+static void testSetSample(OUT uint8_t *pPlane, const size_t index, const uint32_t value, const size_t bytesPerSample)
+{
+  if (bytesPerSample == 2)
+    reinterpret_cast<uint16_t *>(pPlane)[index] = (uint16_t)value;
+  else
+    pPlane[index] = (uint8_t)value;
+}
+
+// Smooth gradients with a moving block, so the checks cover intra and predicted frames. The alpha plane fades in and out diagonally.
+static uint32_t testGetSample(const size_t plane, const size_t x, const size_t y, const size_t frameIndex)
+{
+  switch (plane)
+  {
+  case 0:
+    return (y >= 32 && y < 64 && x >= frameIndex * 8 && x < frameIndex * 8 + 32) ? 230 : (uint32_t)(128 + 90 * sin((x + frameIndex * 3) * 0.05) * cos(y * 0.07));
+
+  case 1:
+    return (uint32_t)(128 + 50 * sin(x * 0.1 + frameIndex));
+
+  case 2:
+    return (uint32_t)(100 + y % 50);
+
+  default:
+    return (uint32_t)(160 + 90 * cos((x + y + frameIndex * 4) * 0.03));
+  }
+}
+
+// Writes the red, green and blue channels of a `sPF_BGRA`, `sPF_RGBA` or `sPF_RGB24` pixel. Four byte pixels are opaque.
+static void testSetPixel(OUT uint8_t *pPixel, const swapPixelFormat format, const uint8_t r, const uint8_t g, const uint8_t b)
+{
+  pPixel[0] = format == sPF_BGRA ? b : r;
+  pPixel[1] = g;
+  pPixel[2] = format == sPF_BGRA ? r : b;
+
+  if (format != sPF_RGB24)
+    pPixel[3] = 0xFF;
+}
+
+// Samples of more than 8 bits get a fine ramp in the bits below the top 8, which only high bit depth streams keep.
+// `sPF_NV12` frames interleave the chroma planes and packed frames take their red, green and blue channels from the first three planes. The streams of packed frames have no alpha plane, so these are opaque.
+static void testFillFrame(OUT uint8_t *pFrame, const swapPixelFormat format, const size_t resX, const size_t resY, const uint32_t bitDepth, const size_t frameIndex)
+{
+  testPlaneLayout layout;
+
+  if (format == sPF_NV12)
+  {
+    const size_t chromaWidth = testGetPlaneSize(resX, 1);
+    uint8_t *pUV = pFrame + resX * resY;
+
+    for (size_t y = 0; y < resY; y++)
+      for (size_t x = 0; x < resX; x++)
+        pFrame[y * resX + x] = (uint8_t)testGetSample(0, x, y, frameIndex);
+
+    for (size_t y = 0; y < testGetPlaneSize(resY, 1); y++)
+    {
+      for (size_t x = 0; x < chromaWidth; x++)
+      {
+        pUV[(y * chromaWidth + x) * 2 + 0] = (uint8_t)testGetSample(1, x, y, frameIndex);
+        pUV[(y * chromaWidth + x) * 2 + 1] = (uint8_t)testGetSample(2, x, y, frameIndex);
+      }
+    }
+
+    return;
+  }
+
+  if (!testGetPlaneLayout(format, &layout))
+  {
+    const size_t bytesPerPixel = swapGetImageSize(format, 1, 1);
+
+    for (size_t y = 0; y < resY; y++)
+      for (size_t x = 0; x < resX; x++)
+        testSetPixel(pFrame + (y * resX + x) * bytesPerPixel, format, (uint8_t)testGetSample(0, x, y, frameIndex), (uint8_t)testGetSample(1, x, y, frameIndex), (uint8_t)testGetSample(2, x, y, frameIndex));
+
+    return;
+  }
+
+  uint8_t *pPlane = pFrame;
+
+  for (size_t plane = 0; plane < layout.planeCount; plane++)
+  {
+    const size_t width = testGetPlaneSize(resX, layout.shiftX[plane]);
+    const size_t height = testGetPlaneSize(resY, layout.shiftY[plane]);
+
+    for (size_t y = 0; y < height; y++)
+    {
+      for (size_t x = 0; x < width; x++)
+      {
+        uint32_t value = testGetSample(plane, x, y, frameIndex);
+
+        if (bitDepth > 8)
+          value = (value << (bitDepth - 8)) | (uint32_t)((x * 3 + y + frameIndex) & ((1u << (bitDepth - 8)) - 1));
+
+        testSetSample(pPlane, y * width + x, value, layout.bytesPerSample);
+      }
+    }
+
+    pPlane += width * height * layout.bytesPerSample;
+  }
+}
+
+// Converts a frame filled by `testFillFrame` to the `outputFormat` the decoder is expected to reproduce it in: `sPF_NV12` frames to `sPF_YUV420` and packed frames to other packed formats.
+static void testConvertFrame(IN const uint8_t *pFrame, const swapPixelFormat format, const size_t resX, const size_t resY, const swapPixelFormat outputFormat, OUT uint8_t *pConverted)
+{
+  if (format == outputFormat)
+  {
+    memcpy(pConverted, pFrame, swapGetImageSize(format, resX, resY));
+    return;
+  }
+
+  if (format == sPF_NV12)
+  {
+    const size_t chromaSize = testGetPlaneSize(resX, 1) * testGetPlaneSize(resY, 1);
+    const uint8_t *pUV = pFrame + resX * resY;
+    uint8_t *pU = pConverted + resX * resY;
+
+    memcpy(pConverted, pFrame, resX * resY);
+
+    for (size_t i = 0; i < chromaSize; i++)
+    {
+      pU[i] = pUV[i * 2 + 0];
+      pU[chromaSize + i] = pUV[i * 2 + 1];
+    }
+
+    return;
+  }
+
+  const size_t bytesPerPixel = swapGetImageSize(format, 1, 1);
+  const size_t outputBytesPerPixel = swapGetImageSize(outputFormat, 1, 1);
+
+  for (size_t i = 0; i < resX * resY; i++)
+  {
+    const uint8_t *pPixel = pFrame + i * bytesPerPixel;
+
+    testSetPixel(pConverted + i * outputBytesPerPixel, outputFormat, pPixel[format == sPF_BGRA ? 2 : 0], pPixel[1], pPixel[format == sPF_BGRA ? 0 : 2]);
+  }
+}
+
+// Copies the `width` x `height` pixel region at `x`, `y` of a planar or packed frame into the tightly packed planes or lines `DecodeFrameRegion` and `Push` deliver.
+// `x` and `y` have to be even, as do `width` and `height` unless the region ends at the right or bottom edge of an odd sized frame.
+static void testCropFrame(IN const uint8_t *pFrame, const swapPixelFormat format, const size_t resX, const size_t resY, const size_t x, const size_t y, const size_t width, const size_t height, OUT uint8_t *pRegion)
+{
+  testPlaneLayout layout;
+
+  if (!testGetPlaneLayout(format, &layout))
+  {
+    const size_t bytesPerPixel = swapGetImageSize(format, 1, 1);
+
+    for (size_t line = 0; line < height; line++)
+      memcpy(pRegion + line * width * bytesPerPixel, pFrame + ((y + line) * resX + x) * bytesPerPixel, width * bytesPerPixel);
+
+    return;
+  }
+
+  for (size_t plane = 0; plane < layout.planeCount; plane++)
+  {
+    const size_t planeWidth = testGetPlaneSize(resX, layout.shiftX[plane]) * layout.bytesPerSample;
+    const size_t regionWidth = testGetPlaneSize(width, layout.shiftX[plane]) * layout.bytesPerSample;
+    const size_t regionHeight = testGetPlaneSize(height, layout.shiftY[plane]);
+    const uint8_t *pLine = pFrame + (y >> layout.shiftY[plane]) * planeWidth + (x >> layout.shiftX[plane]) * layout.bytesPerSample;
+
+    for (size_t line = 0; line < regionHeight; line++)
+      memcpy(pRegion + line * regionWidth, pLine + line * planeWidth, regionWidth);
+
+    pFrame += planeWidth * testGetPlaneSize(resY, layout.shiftY[plane]);
+    pRegion += regionWidth * regionHeight;
+  }
+}
+
+struct testCheckContext
+{
+  const testStreamCase *pCase;
+  const uint8_t *pFrames; // decoded with `DecodeNext`.
+  size_t frameSize;
+  uint8_t *pScratch;
+  size_t nextFrameIndex;
+  size_t mismatchCount;
+};
+
+static void testOnBatchFrameDecoded(void *pUserData, const size_t frameIndex, IN const uint8_t *pFrame)
+{
+  testCheckContext *pContext = (testCheckContext *)pUserData;
+
+  if (frameIndex != pContext->nextFrameIndex++ || memcmp(pFrame, pContext->pFrames + frameIndex * pContext->frameSize, pContext->frameSize) != 0)
+    pContext->mismatchCount++;
+}
+
+static void testOnLinesDecoded(void *pUserData, const size_t frameIndex, const size_t y, const size_t height, IN const uint8_t *pLines)
+{
+  testCheckContext *pContext = (testCheckContext *)pUserData;
+  const testStreamCase &streamCase = *pContext->pCase;
+  const size_t linesSize = swapGetImageSize(streamCase.outputFormat, streamCase.resX, height);
+
+  testCropFrame(pContext->pFrames + frameIndex * pContext->frameSize, streamCase.outputFormat, streamCase.resX, streamCase.resY, 0, y, streamCase.resX, height, pContext->pScratch);
+
+  if (frameIndex != pContext->nextFrameIndex || memcmp(pLines, pContext->pScratch, linesSize) != 0)
+    pContext->mismatchCount++;
+}
+
+static void testOnPushFrameDecoded(void *pUserData, const size_t frameIndex)
+{
+  testCheckContext *pContext = (testCheckContext *)pUserData;
+
+  if (frameIndex != pContext->nextFrameIndex++)
+    pContext->mismatchCount++;
+}
+
+// Returns `nullptr` if the decoder couldn't be created or `filename` couldn't be opened. Packed output formats stay set when the stream is opened.
+static swapDecoder * testOpenDecoder(const char *filename, const swapPixelFormat outputFormat)
+{
+  swapDecoder *pDecoder = swapDecoder::Create();
+
+  if (pDecoder == nullptr)
+    return nullptr;
+
+  if (pDecoder->SetOutputFormat(outputFormat) || pDecoder->Open(filename))
+  {
+    delete pDecoder;
+    return nullptr;
+  }
+
+  return pDecoder;
+}
+
+// Acquires frames from the read-ahead in order, then seeks backwards and forwards outside of its window. Every frame has to match the frame `DecodeNext` returned. Returns the number of failed checks.
+static size_t testCheckReadAhead(const char *name, swapDecoder *pDecoder, IN const uint8_t *pDecoded, const size_t frameSize)
+{
+  const size_t readAheadFrameCount = 3;
+  const size_t frameOrder[] = { 0, 1, 2, 3, 4, 5, 6, 16, 17, 2, 3, 11, 12, 13, 19, 0 };
+
+  size_t failureCount = 0;
+
+  if (pDecoder->EnableReadAhead(readAheadFrameCount))
+  {
+    printf("%s: Failed to enable the read-ahead.\n", name);
+    return 1;
+  }
+
+  for (const size_t frameIndex : frameOrder)
+  {
+    const uint8_t *pFrame = nullptr;
+
+    if (pDecoder->AcquireFrame(frameIndex, &pFrame))
+    {
+      printf("%s: Failed to acquire frame %" PRIu64 " from the read-ahead.\n", name, frameIndex);
+      failureCount++;
+      continue;
+    }
+
+    if (memcmp(pFrame, pDecoded + frameIndex * frameSize, frameSize) != 0)
+    {
+      printf("%s: Frame %" PRIu64 " from the read-ahead differs from the decoded frame.\n", name, frameIndex);
+      failureCount++;
+    }
+
+    if (pDecoder->ReleaseFrame(frameIndex))
+    {
+      printf("%s: Failed to release frame %" PRIu64 ".\n", name, frameIndex);
+      failureCount++;
+    }
+  }
+
+  pDecoder->DisableReadAhead();
+
+  return failureCount;
+}
+
+// Scrubs back and forth through the stream with the frame cache enabled, once with a budget of a few frames that keeps evicting and once with room for all of them.
+// Every frame has to match the frame `DecodeNext` returned without the cache. Returns the number of failed checks.
+static size_t testCheckFrameCache(const char *name, swapDecoder *pDecoder, IN const uint8_t *pDecoded, const size_t frameSize, OUT uint8_t *pScratch)
+{
+  const size_t memoryBudgets[] = { frameSize * 4, frameSize * CheckFrameCount * 4 };
+  const size_t frameOrder[] = { 10, 9, 8, 9, 10, 11, 12, 7, 0, 19, 18, 10, 10, 3, 4, 5, 15, 14, 13, 2, 1, 0, 8, 16 };
+
+  size_t failureCount = 0;
+
+  for (const size_t memoryBudget : memoryBudgets)
+  {
+    if (pDecoder->EnableFrameCache(memoryBudget))
+    {
+      printf("%s: Failed to enable the frame cache.\n", name);
+      failureCount++;
+      continue;
+    }
+
+    // The second pass finds most frames in the cache.
+    for (size_t pass = 0; pass < 2; pass++)
+    {
+      for (const size_t frameIndex : frameOrder)
+      {
+        if (pDecoder->DecodeFrame(frameIndex, pScratch))
+        {
+          printf("%s: Failed to decode frame %" PRIu64 " with the frame cache.\n", name, frameIndex);
+          failureCount++;
+          continue;
+        }
+
+        if (memcmp(pScratch, pDecoded + frameIndex * frameSize, frameSize) != 0)
+        {
+          printf("%s: Frame %" PRIu64 " decoded with a frame cache of %" PRIu64 " bytes differs from the uncached frame.\n", name, frameIndex, memoryBudget);
+          failureCount++;
+        }
+      }
+    }
+
+    pDecoder->DisableFrameCache();
+  }
+
+  return failureCount;
+}
+
+#define TEST_MAX_ASYNC_FRAMES 16
+
+// Frames queued with `DecodeFrameAsync` and `DecodeNextAsync` are notified about in the order they were queued, so every notification belongs to the next buffer in `pFrames`.
+// Notifications can queue more frames, `Open` the stream again or destroy the decoder, which only the notifications do, so the decoder isn't used by two threads at once.
+struct testAsyncContext
+{
+  swapDecoder *pDecoder;
+  const char *filename;
+  uint8_t *pFrames; // `TEST_MAX_ASYNC_FRAMES` frames.
+  size_t frameSize;
+  size_t queuedFrameCount;
+  size_t notificationCount;
+  size_t frameIndices[TEST_MAX_ASYNC_FRAMES];
+  swapResult results[TEST_MAX_ASYNC_FRAMES];
+  size_t failureCount;
+
+  // Notifications after which frames are queued, the stream is opened again or the decoder is destroyed; `(size_t)-1` for none.
+  size_t queueAt;
+  size_t queueCount;
+  size_t openAt;
+  size_t destroyAt;
+
+  bool destroyed;
+  std::mutex mutex;
+  std::condition_variable condition;
+};
+
+static void testOnAsyncDecoded(void *pUserData, const size_t frameIndex, const swapResult result);
+
+// Queues `frameIndex` or, for `(size_t)-1`, the next frame into the next buffer. The buffer is taken before the frame is queued, as its notification may already queue the next frame.
+static bool testQueueAsync(testAsyncContext *pContext, const size_t frameIndex)
+{
+  if (pContext->queuedFrameCount == TEST_MAX_ASYNC_FRAMES)
+  {
+    pContext->failureCount++;
+    return false;
+  }
+
+  uint8_t *pFrame = pContext->pFrames + pContext->queuedFrameCount++ * pContext->frameSize;
+
+  if (frameIndex == (size_t)-1 ? pContext->pDecoder->DecodeNextAsync(pFrame, testOnAsyncDecoded, pContext) : pContext->pDecoder->DecodeFrameAsync(frameIndex, pFrame, testOnAsyncDecoded, pContext))
+  {
+    pContext->failureCount++;
+    return false;
+  }
+
+  return true;
+}
+
+static void testOnAsyncDecoded(void *pUserData, const size_t frameIndex, const swapResult result)
+{
+  testAsyncContext *pContext = (testAsyncContext *)pUserData;
+  const size_t notification = pContext->notificationCount++;
+
+  if (notification >= TEST_MAX_ASYNC_FRAMES)
+  {
+    pContext->failureCount++;
+    return;
+  }
+
+  pContext->frameIndices[notification] = frameIndex;
+  pContext->results[notification] = result;
+
+  if (notification == pContext->queueAt)
+    for (size_t i = 0; i < pContext->queueCount; i++)
+      testQueueAsync(pContext, (size_t)-1);
+
+  // Decodes the frames still queued before the stream is closed, which are notified about before this returns.
+  if (notification == pContext->openAt)
+  {
+    if (pContext->pDecoder->Open(pContext->filename))
+      pContext->failureCount++;
+
+    testQueueAsync(pContext, (size_t)-1);
+  }
+
+  if (notification == pContext->destroyAt)
+  {
+    delete pContext->pDecoder;
+
+    std::lock_guard<std::mutex> lock(pContext->mutex);
+    pContext->pDecoder = nullptr;
+    pContext->destroyed = true;
+    pContext->condition.notify_all();
+  }
+}
+
+#ifdef SWAP_COROUTINES
+// Starts right away and is never awaited itself; the caller waits for the decoder instead.
+struct testCoroutine
+{
+  struct promise_type
+  {
+    testCoroutine get_return_object() { return testCoroutine(); }
+    std::suspend_never initial_suspend() noexcept { return std::suspend_never(); }
+    std::suspend_never final_suspend() noexcept { return std::suspend_never(); }
+    void return_void() { }
+    void unhandled_exception() { }
+  };
+};
+
+// Awaits the frames of the stream one after the other until `sR_EndOfStream` and compares them with the frames `DecodeNext` returned.
+static testCoroutine testAwaitFrames(swapDecoder *pDecoder, OUT uint8_t *pFrame, IN const uint8_t *pDecoded, const size_t frameSize, OUT size_t *pFrameCount, OUT size_t *pFailureCount)
+{
+  while (true)
+  {
+    swapDecodeAwaitable nextFrame = pDecoder->NextFrame(pFrame);
+    const swapResult result = co_await nextFrame;
+
+    if (result == sR_EndOfStream)
+      break;
+
+    if (result != sR_Success || nextFrame.frameIndex != *pFrameCount || memcmp(pFrame, pDecoded + nextFrame.frameIndex * frameSize, frameSize) != 0)
+      (*pFailureCount)++;
+
+    (*pFrameCount)++;
+  }
+}
+#endif
+
+// Checks notifications `0` to `expectedCount - 1` against the expected frames, which have to match the frames `DecodeNext` returned. All but the last expected frame have to succeed.
+static size_t testCheckAsyncNotifications(const char *name, const char *description, const testAsyncContext &context, IN const uint8_t *pDecoded, IN const size_t *pExpectedFrames, const size_t expectedCount, const swapResult lastResult)
+{
+  bool matches = context.failureCount == 0 && context.notificationCount == expectedCount && context.queuedFrameCount == expectedCount;
+
+  for (size_t i = 0; i < expectedCount && matches; i++)
+  {
+    const swapResult expectedResult = i + 1 == expectedCount ? lastResult : sR_Success;
+
+    matches = context.frameIndices[i] == pExpectedFrames[i] && context.results[i] == expectedResult;
+
+    if (matches && expectedResult == sR_Success)
+      matches = memcmp(context.pFrames + i * context.frameSize, pDecoded + pExpectedFrames[i] * context.frameSize, context.frameSize) == 0;
+  }
+
+  if (matches)
+    return 0;
+
+  printf("%s: Frames decoded asynchronously %s differ from the decoded frames.\n", name, description);
+
+  return 1;
+}
+
+// Decodes frames with `DecodeFrameAsync` and `DecodeNextAsync`, opens the stream again and destroys the decoder from within notifications and awaits the whole stream in a coroutine.
+// Every frame has to match the frame `DecodeNext` returned. Returns the number of failed checks.
+static size_t testCheckAsync(const char *name, const char *filename, const swapPixelFormat outputFormat, IN const uint8_t *pDecoded, const size_t frameSize)
+{
+  const size_t queuedFrames[] = { 5, 0, CheckFrameCount - 1, 7, 7, 12, (size_t)-1, (size_t)-1, CheckFrameCount - 1, (size_t)-1 };
+  const size_t expectedFrames[] = { 5, 0, CheckFrameCount - 1, 7, 7, 12, 13, 14, CheckFrameCount - 1, CheckFrameCount };
+  const size_t expectedReopenedFrames[] = { 0, 1, 2, 3, 4, 0 };
+  const size_t expectedDestroyedFrames[] = { 0, 1, 2, 3 };
+
+  size_t failureCount = 0;
+  testAsyncContext context;
+  uint8_t *pFrames = (uint8_t *)malloc(frameSize * TEST_MAX_ASYNC_FRAMES);
+
+  if (pFrames == nullptr)
+  {
+    printf("%s: Memory allocation failure.\n", name);
+    failureCount++;
+    goto epilogue;
+  }
+
+  context.filename = filename;
+  context.pFrames = pFrames;
+  context.frameSize = frameSize;
+
+  // Frames in any order; the last one queued runs past the end of the stream.
+  {
+    context.pDecoder = testOpenDecoder(filename, outputFormat);
+    context.queuedFrameCount = context.notificationCount = context.failureCount = 0;
+    context.queueAt = context.openAt = context.destroyAt = (size_t)-1;
+
+    if (context.pDecoder == nullptr)
+    {
+      printf("%s: Failed to open '%s'.\n", name, filename);
+      failureCount++;
+    }
+    else
+    {
+      for (const size_t frameIndex : queuedFrames)
+        testQueueAsync(&context, frameIndex);
+    }
+
+    // Waits for the queued frames.
+    if (context.pDecoder)
+      delete context.pDecoder;
+
+    failureCount += testCheckAsyncNotifications(name, "in any order", context, pDecoded, expectedFrames, sizeof(expectedFrames) / sizeof(expectedFrames[0]), sR_EndOfStream);
+  }
+
+  // The second notification opens the stream again, which first decodes the three frames queued by the first one.
+  {
+    context.pDecoder = testOpenDecoder(filename, outputFormat);
+    context.queuedFrameCount = context.notificationCount = context.failureCount = 0;
+    context.queueAt = 0;
+    context.queueCount = 4;
+    context.openAt = 1;
+    context.destroyAt = (size_t)-1;
+
+    if (context.pDecoder == nullptr)
+    {
+      printf("%s: Failed to open '%s'.\n", name, filename);
+      failureCount++;
+    }
+    else
+    {
+      testQueueAsync(&context, (size_t)-1);
+    }
+
+    if (context.pDecoder)
+      delete context.pDecoder;
+
+    failureCount += testCheckAsyncNotifications(name, "around opening the stream from a notification", context, pDecoded, expectedReopenedFrames, sizeof(expectedReopenedFrames) / sizeof(expectedReopenedFrames[0]), sR_Success);
+  }
+
+  // The first notification destroys the decoder, which first decodes the three frames queued by the same notification.
+  {
+    context.pDecoder = testOpenDecoder(filename, outputFormat);
+    context.queuedFrameCount = context.notificationCount = context.failureCount = 0;
+    context.queueAt = 0;
+    context.queueCount = 3;
+    context.openAt = (size_t)-1;
+    context.destroyAt = 0;
+    context.destroyed = false;
+
+    if (context.pDecoder == nullptr || !testQueueAsync(&context, (size_t)-1))
+    {
+      printf("%s: Failed to queue a frame of '%s'.\n", name, filename);
+      failureCount++;
+
+      if (context.pDecoder)
+        delete context.pDecoder;
+    }
+    else
+    {
+      std::unique_lock<std::mutex> lock(context.mutex);
+
+      while (!context.destroyed)
+        context.condition.wait(lock);
+
+      lock.unlock();
+
+      failureCount += testCheckAsyncNotifications(name, "before destroying the decoder from a notification", context, pDecoded, expectedDestroyedFrames, sizeof(expectedDestroyedFrames) / sizeof(expectedDestroyedFrames[0]), sR_Success);
+    }
+  }
+
+#ifdef SWAP_COROUTINES
+  {
+    swapDecoder *pDecoder = testOpenDecoder(filename, outputFormat);
+    size_t frameCount = 0;
+    size_t awaitFailureCount = 0;
+
+    if (pDecoder == nullptr)
+    {
+      printf("%s: Failed to open '%s'.\n", name, filename);
+      failureCount++;
+    }
+    else
+    {
+      testAwaitFrames(pDecoder, pFrames, pDecoded, frameSize, &frameCount, &awaitFailureCount);
+    }
+
+    // Waits for the coroutine, which keeps a frame queued until it's done.
+    if (pDecoder)
+      delete pDecoder;
+
+    if (frameCount != CheckFrameCount || awaitFailureCount > 0)
+    {
+      printf("%s: %" PRIu64 " of %" PRIu64 " awaited frames differ from the decoded frames.\n", name, awaitFailureCount + CheckFrameCount - frameCount, CheckFrameCount);
+      failureCount++;
+    }
+  }
+#endif
+
+epilogue:
+  if (pFrames)
+    free(pFrames);
+
+  return failureCount;
+}
+
+// Encodes synthetic frames to `filename` and checks the frames `DecodeNext` returns against them: bit exact for lossless streams of YUV frames, above `MinPsnr` otherwise.
+// Regions, batches, the read-ahead, the frame cache, asynchronous decodes and pushed streams then have to match the frames `DecodeNext` returned. Returns the number of failed checks.
+static size_t testCheckStream(const testStreamCase &streamCase, const char *filename)
+{
+  const char *name = streamCase.name;
+  const size_t resX = streamCase.resX;
+  const size_t resY = streamCase.resY;
+  const size_t sourceSize = swapGetImageSize(streamCase.format, resX, resY);
+  const size_t frameSize = swapGetImageSize(streamCase.outputFormat, resX, resY);
+
+  // Packed RGB frames are converted to YUV, which even lossless streams don't invert exactly.
+  const bool bitExact = streamCase.options.lossless && streamCase.format != sPF_BGRA && streamCase.format != sPF_RGBA;
+
+  // The second region ends at the bottom right corner, so it's odd sized in odd sized frames.
+  const size_t cornerX = (resX - 80) & ~(size_t)1;
+  const size_t cornerY = (resY - 48) & ~(size_t)1;
+  const size_t regions[2][4] = { { 48, 32, 128, 96 }, { cornerX, cornerY, resX - cornerX, resY - cornerY } };
+
+  swapEncoderOptions options = streamCase.options;
+  testPlaneLayout layout;
+  size_t failureCount = 0;
+  uint8_t *pSource = (uint8_t *)malloc(sourceSize * CheckFrameCount);
+  uint8_t *pDecoded = (uint8_t *)malloc(frameSize * CheckFrameCount);
+  uint8_t *pScratch = (uint8_t *)malloc(frameSize * 2);
+  uint8_t *pStream = nullptr;
+  size_t streamSize = 0;
+  swapEncoder *pEncoder = nullptr;
+  swapDecoder *pDecoder = nullptr;
+  testCheckContext context;
+  swapBatchCallbacks batchCallbacks;
+  swapPushCallbacks pushCallbacks;
+
+  if (pSource == nullptr || pDecoded == nullptr || pScratch == nullptr)
+  {
+    printf("%s: Memory allocation failure.\n", name);
+    failureCount++;
+    goto epilogue;
+  }
+
+  // Planar frames have to match the chroma format and alpha plane of the stream.
+  if (testGetPlaneLayout(streamCase.format, &layout))
+  {
+    options.chromaFormat = layout.chromaFormat;
+    options.alpha = layout.alpha;
+  }
+
+  pEncoder = swapEncoder::Create(filename, resX, resY, options);
+
+  if (pEncoder == nullptr)
+  {
+    printf("%s: Failed to create encoder.\n", name);
+    failureCount++;
+    goto epilogue;
+  }
+
+  for (size_t i = 0; i < CheckFrameCount; i++)
+  {
+    testFillFrame(pSource + i * sourceSize, streamCase.format, resX, resY, options.bitDepth, i);
+
+    if (pEncoder->AddFrame(swapFrameDescriptor::Packed(streamCase.format, pSource + i * sourceSize, resX, resY)))
+    {
+      printf("%s: Failed to add frame %" PRIu64 ".\n", name, i);
+      failureCount++;
+      goto epilogue;
+    }
+  }
+
+  if (pEncoder->Finalize())
+  {
+    printf("%s: Failed to finalize the stream.\n", name);
+    failureCount++;
+    goto epilogue;
+  }
+
+  pDecoder = testOpenDecoder(filename, streamCase.outputFormat);
+
+  if (pDecoder == nullptr)
+  {
+    printf("%s: Failed to open '%s'.\n", name, filename);
+    failureCount++;
+    goto epilogue;
+  }
+
+  for (size_t i = 0; i < CheckFrameCount; i++)
+  {
+    if (pDecoder->DecodeNext(pDecoded + i * frameSize))
+    {
+      printf("%s: Failed to decode frame %" PRIu64 ".\n", name, i);
+      failureCount++;
+      goto epilogue;
+    }
+
+    testConvertFrame(pSource + i * sourceSize, streamCase.format, resX, resY, streamCase.outputFormat, pScratch);
+
+    const double psnr = testPsnr(pScratch, pDecoded + i * frameSize, frameSize, options.bitDepth);
+
+    if (bitExact ? psnr != INFINITY : psnr < (options.bitDepth > 8 ? MinHighBitDepthPsnr : MinPsnr))
+    if (options.lossless ? psnr != INFINITY : psnr < (options.bitDepth > 8 ? MinHighBitDepthPsnr : MinPsnr))
+    {
+      printf("%s: Frame %" PRIu64 " decodes at %.2f dB.\n", name, i, psnr);
+      failureCount++;
+    }
+  }
+
+  // Backwards, so every region starts from a frame the decoder doesn't hold references for.
+  for (size_t i = CheckFrameCount; i > 0; i--)
+  {
+    for (const size_t *pRegion : regions)
+    {
+      if (pDecoder->DecodeFrameRegion(i - 1, pRegion[0], pRegion[1], pRegion[2], pRegion[3], pScratch))
+      {
+        printf("%s: Failed to decode a region of frame %" PRIu64 ".\n", name, i - 1);
+        failureCount++;
+        continue;
+      }
+
+      testCropFrame(pDecoded + (i - 1) * frameSize, streamCase.outputFormat, resX, resY, pRegion[0], pRegion[1], pRegion[2], pRegion[3], pScratch + frameSize);
+
+      if (memcmp(pScratch, pScratch + frameSize, swapGetImageSize(streamCase.outputFormat, pRegion[2], pRegion[3])) != 0)
+      {
+        printf("%s: Region %" PRIu64 ", %" PRIu64 " of frame %" PRIu64 " differs from the whole frame.\n", name, pRegion[0], pRegion[1], i - 1);
+        failureCount++;
+      }
+    }
+  }
+
+  context.pCase = &streamCase;
+  context.pFrames = pDecoded;
+  context.frameSize = frameSize;
+  context.pScratch = pScratch;
+  context.nextFrameIndex = 0;
+  context.mismatchCount = 0;
+
+  batchCallbacks.pOnFrameDecoded = testOnBatchFrameDecoded;
+  batchCallbacks.pUserData = &context;
+
+  if (pDecoder->DecodeFrames(0, CheckFrameCount, batchCallbacks) || context.nextFrameIndex != CheckFrameCount || context.mismatchCount > 0)
+  {
+    printf("%s: Batch decode differs in %" PRIu64 " of %" PRIu64 " frames.\n", name, context.mismatchCount + CheckFrameCount - context.nextFrameIndex, CheckFrameCount);
+    failureCount++;
+  }
+
+  failureCount += testCheckReadAhead(name, pDecoder, pDecoded, frameSize);
+  failureCount += testCheckFrameCache(name, pDecoder, pDecoded, frameSize, pScratch);
+  failureCount += testCheckAsync(name, filename, streamCase.outputFormat, pDecoded, frameSize);
+
+  {
+    FILE *pFile = fopen(filename, "rb");
+
+    if (pFile == nullptr)
+    {
+      printf("%s: Failed to read '%s'.\n", name, filename);
+      failureCount++;
+      goto epilogue;
+    }
+
+    fseek(pFile, 0, SEEK_END);
+    streamSize = ftell(pFile);
+    fseek(pFile, 0, SEEK_SET);
+
+    pStream = (uint8_t *)malloc(streamSize);
+
+    if (pStream == nullptr || streamSize != fread(pStream, 1, streamSize, pFile))
+    {
+      printf("%s: Failed to read '%s'.\n", name, filename);
+      failureCount++;
+      fclose(pFile);
+      goto epilogue;
+    }
+
+    fclose(pFile);
+  }
+
+  context.nextFrameIndex = 0;
+  context.mismatchCount = 0;
+
+  pushCallbacks.pOnLinesDecoded = testOnLinesDecoded;
+  pushCallbacks.pOnFrameDecoded = testOnPushFrameDecoded;
+  pushCallbacks.pUserData = &context;
+
+  if (pDecoder->BeginPush(pushCallbacks))
+  {
+    printf("%s: Failed to begin pushing.\n", name);
+    failureCount++;
+    goto epilogue;
+  }
+
+  // Pieces that don't line up with frames or rows of tiles.
+  for (size_t offset = 0; offset < streamSize; offset += 1000)
+  {
+    if (pDecoder->Push(pStream + offset, streamSize - offset < 1000 ? streamSize - offset : 1000))
+    {
+      printf("%s: Failed to push the stream at byte %" PRIu64 ".\n", name, offset);
+      failureCount++;
+      goto epilogue;
+    }
+  }
+
+  if (context.nextFrameIndex != CheckFrameCount || context.mismatchCount > 0)
+  {
+    printf("%s: Pushed stream differs in %" PRIu64 " of %" PRIu64 " frames.\n", name, context.mismatchCount + CheckFrameCount - context.nextFrameIndex, CheckFrameCount);
+    failureCount++;
+  }
+
+epilogue:
+  if (pEncoder)
+    delete pEncoder;
+
+  if (pDecoder)
+    delete pDecoder;
+
+  if (pSource)
+    free(pSource);
+
+  if (pDecoded)
+    free(pDecoded);
+
+  if (pScratch)
+    free(pScratch);
+
+  if (pStream)
+    free(pStream);
+
+  printf("%s: %s\n", name, failureCount == 0 ? "passed" : "FAILED");
+
+  return failureCount;
+}
+
+static swapEncoderOptions testWithBitDepth(swapEncoderOptions options, const uint32_t bitDepth)
+{
+  options.bitDepth = bitDepth;
+
+  return options;
+}
+
+// Round trips every stream case through `filename`.
+static int testCheck(const char *filename)
+{
+  size_t failureCount = 0;
+
+  swapEncoderOptions lossy;
+  lossy.iframeStep = 8;
+  lossy.tileWidth = 64;
+  lossy.tileHeight = 64;
+
+  swapEncoderOptions lossless = lossy;
+  lossless.lossless = true;
+
+  swapEncoderOptions lowLatency = lossy;
+  lowLatency.lowLatency = true;
+
+  const testStreamCase streamCases[] =
+  {
+    { "lossy", lossy, CheckResX, CheckResY, sPF_YUV420, sPF_YUV420 },
+    { "lossless", lossless, CheckResX, CheckResY, sPF_YUV420, sPF_YUV420 },
+    { "low latency", lowLatency, CheckResX, CheckResY, sPF_YUV420, sPF_YUV420 },
+    { "4:2:2 lossy", lossy, CheckResX, CheckResY, sPF_YUV422, sPF_YUV422 },
+    { "4:2:2 lossless", lossless, CheckResX, CheckResY, sPF_YUV422, sPF_YUV422 },
+    { "4:4:4 lossy", lossy, CheckResX, CheckResY, sPF_YUV444, sPF_YUV444 },
+    { "4:4:4 lossless", lossless, CheckResX, CheckResY, sPF_YUV444, sPF_YUV444 },
+    { "alpha lossy", lossy, CheckResX, CheckResY, sPF_YUVA420, sPF_YUVA420 },
+    { "alpha lossless", lossless, CheckResX, CheckResY, sPF_YUVA444, sPF_YUVA444 },
+    { "odd size lossy", lossy, CheckOddResX, CheckOddResY, sPF_YUVA422, sPF_YUVA422 },
+    { "odd size lossless", lossless, CheckOddResX, CheckOddResY, sPF_YUV420, sPF_YUV420 },
+    { "10 bit lossy", testWithBitDepth(lossy, 10), CheckResX, CheckResY, sPF_YUV420_16, sPF_YUV420_16 },
+    { "10 bit lossless", testWithBitDepth(lossless, 10), CheckResX, CheckResY, sPF_YUV420_16, sPF_YUV420_16 },
+    { "12 bit lossy", testWithBitDepth(lossy, 12), CheckResX, CheckResY, sPF_YUV422_16, sPF_YUV422_16 },
+    { "12 bit lossless", testWithBitDepth(lossless, 12), CheckResX, CheckResY, sPF_YUVA444_16, sPF_YUVA444_16 },
+    { "16 bit lossy", testWithBitDepth(lossy, 16), CheckResX, CheckResY, sPF_YUV444_16, sPF_YUV444_16 },
+    { "16 bit lossless", testWithBitDepth(lossless, 16), CheckOddResX, CheckOddResY, sPF_YUV420_16, sPF_YUV420_16 },
+    { "BGRA lossy", lossy, CheckResX, CheckResY, sPF_BGRA, sPF_BGRA },
+    { "odd size BGRA lossy", lossy, CheckOddResX, CheckOddResY, sPF_BGRA, sPF_BGRA },
+    { "RGBA lossless to RGB24", lossless, CheckResX, CheckResY, sPF_RGBA, sPF_RGB24 },
+    { "NV12 lossless", lossless, CheckResX, CheckResY, sPF_NV12, sPF_YUV420 },
+    { "odd size NV12 lossy", lossy, CheckOddResX, CheckOddResY, sPF_NV12, sPF_YUV420 },
+  };
+
+  for (const testStreamCase &streamCase : streamCases)
+    failureCount += testCheckStream(streamCase, filename);
+
+  return failureCount == 0 ? 0 : 1;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
 int main(int argc, char **pArgv)
 {
   void *pFileData = nullptr;
@@ -19,7 +1013,12 @@ int main(int argc, char **pArgv)
   char *origFile = nullptr;
   char *slapFile = nullptr;
 
-  if (argc > 2)
+  if (argc == 3 && strcmp(pArgv[1], "-check") == 0)
+  {
+    retval = testCheck(pArgv[2]);
+    goto epilogue;
+  }
+  else if (argc > 2)
   {
     origFile = pArgv[1];
     slapFile = pArgv[2];
@@ -57,7 +1056,7 @@ int main(int argc, char **pArgv)
   }
   else
   {
-    printf("Usage: %s <inputfile> <outputfile>", pArgv[0]);
+    printf("Usage: %s <inputfile> <outputfile>\n       %s <swapfile>\n       %s -check <scratchfile>", pArgv[0], pArgv[0], pArgv[0]);
     goto epilogue;
   }
 
@@ -68,28 +1067,86 @@ int main(int argc, char **pArgv)
     frameCount = 100;
     printf("Adding %" PRIu64 " frames...\n", frameCount);
 
-    pFrame = malloc(7680 * 11520);
+    swapEncoder *pEncoder = swapEncoder::Create(slapFile, 7680, 7680);
+
+    if (pEncoder == nullptr)
+    {
+      printf("Failed to create encoder.");
+      retval = 1;
+      goto epilogue;
+    }
 
-    swapEncoder *pEncoder = swapEncoder::Create("", 7680, 7680);
+    // The encoder reads the planes in place.
+    const swapFrameDescriptor frame = swapFrameDescriptor::Packed(sPF_YUV420, (const uint8_t *)pFileData, 7680, 7680);
 
     for (size_t i = 0; i < frameCount; i++)
     {
-      swapMemcpy(pFrame, pFileData, 7680 * 11520);
+      if (pEncoder->AddFrame(frame))
+        __debugbreak();
+
+      printf("\rFrame %" PRIu64 " / %" PRIu64 " processed.", i + 1, frameCount);
+    }
 
-      if (pEncoder->AddFrameYUV420((uint8_t *)pFrame))
+    if (pEncoder->Finalize())
+      __debugbreak();
+
+    delete pEncoder;
+
+    printf("\n");
+  }
+
+  {
+    swapDecoder *pDecoder = swapDecoder::Create();
+
+    if (pDecoder == nullptr || pDecoder->Open(slapFile))
+    {
+      printf("Failed to open '%s'.", slapFile);
+      retval = 1;
+
+      if (pDecoder)
+        delete pDecoder;
+
+      goto epilogue;
+    }
+
+    frameCount = pDecoder->frameCount;
+    printf("Decoding %" PRIu64 " frames...\n", frameCount);
+
+    // Streams with 16 bit samples, other chroma subsampling or alpha decode to larger frames than 8 bit 4:2:0.
+    pFrame = malloc(swapGetImageSize(pDecoder->outputFormat, pDecoder->resX, pDecoder->resY));
+
+    if (!pFrame)
+    {
+      printf("Memory allocation failure.");
+      retval = 1;
+      delete pDecoder;
+      goto epilogue;
+    }
+
+    for (size_t i = 0; i < frameCount; i++)
+    {
+      if (pDecoder->DecodeNext((uint8_t *)pFrame))
         __debugbreak();
 
-      if (i == 0)
+      // Every frame was encoded from the input file.
+      if (origFile && testPsnr((const uint8_t *)pFileData, (const uint8_t *)pFrame, swapGetImageSize(sPF_YUV420, 7680, 7680)) < MinPsnr)
       {
-        FILE *pTestFile = fopen(slapFile, "wb");
-        fwrite(pFrame, 1, 7680 * 11520, pTestFile);
-        fclose(pTestFile);
+        printf("\nFrame %" PRIu64 " differs from '%s'.\n", i, origFile);
+        retval = 1;
       }
 
-      printf("\rFrame %" PRIu64 " / %" PRIu64 " processed.", i + 1, frameCount);
+      printf("\rFrame %" PRIu64 " / %" PRIu64 " decoded.", i + 1, frameCount);
     }
+
+    delete pDecoder;
   }
 
 epilogue:
+  if (pFileData)
+    free(pFileData);
+
+  if (pFrame)
+    free(pFrame);
+
   return retval;
 }
@@ -10,7 +10,17 @@
 #define swapcodec_h__
 
 #include <stdint.h>
+#include <stdio.h>
 #include <string>
+#include <vector>
+
+// `swapDecoder::NextFrame` and `swapDecoder::Frame` can be awaited in C++20 coroutines.
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#define SWAP_COROUTINES
+#endif
+#endif
 
 #ifndef IN
 #define IN
@@ -33,18 +43,330 @@ namespace swapcodec
     sR_Success,
     sR_Failure,
     sR_InternalError,
-    sR_MemoryAllocationFailure
+    sR_MemoryAllocationFailure,
+    sR_InvalidParameter,
+    sR_IOFailure,
+    sR_InvalidFormat,
+    sR_EndOfStream
+  };
+
+  // Chroma planes relative to the luma plane.
+  enum swapChromaFormat
+  {
+    sCF_420, // half width, half height.
+    sCF_422, // half width, full height.
+    sCF_444, // full width, full height.
+  };
+
+  // Planar formats store their planes one after another. The subsampled chroma planes of odd sized frames are rounded up, e.g. `(resX + 1) / 2` x `(resY + 1) / 2` for 4:2:0.
+  // `_16` formats have 16 bit samples holding the stream's `bitDepth` least significant bits.
+  enum swapPixelFormat
+  {
+    sPF_YUV420, // planar: Y, U, V.
+    sPF_BGRA,
+    sPF_RGBA,
+    sPF_RGB24,
+    sPF_NV12, // planar Y followed by interleaved U, V.
+    sPF_YUV420_16,
+    sPF_YUV422,
+    sPF_YUV444,
+    sPF_YUV422_16,
+    sPF_YUV444_16,
+    sPF_YUVA420, // planar: Y, U, V, A.
+    sPF_YUVA422,
+    sPF_YUVA444,
+    sPF_YUVA420_16,
+    sPF_YUVA422_16,
+    sPF_YUVA444_16,
+  };
+
+  // Limited range YUV as used by BT.601 and BT.709.
+  enum swapColorSpace
+  {
+    sCS_BT601,
+    sCS_BT709,
   };
 
   void swapMemcpy(OUT void *pDestination, IN const void *pSource, const size_t size);
   void swapMemmove(OUT void *pDestination, IN_OUT void *pSource, const size_t size);
 
+  size_t swapGetImageSize(const swapPixelFormat format, const size_t resX, const size_t resY);
+
+  //////////////////////////////////////////////////////////////////////////
+
+  // Stream Format:
+  //   swapStreamHeader
+  //   for every frame: swapFrameHeader, uint32_t tileSize[bandCount][tileCount], the data of every band for all tiles in row major order
+  //   (progressive streams have four bands of zigzag ordered coefficients starting with DC, other streams a single one)
+  //   (frames identical to the previous frame are stored as a `swapFrameHeader` with `sFF_Repeat` and no payload, keyframes never are)
+  //   (low latency streams follow the `swapFrameHeader` of every other frame with a `swapSliceHeader`, uint32_t tileSize[tilesX] and the data of the tiles for every row of tiles)
+  //   swapIndexHeader, swapIndexEntry[frameCount], swapStreamTrailer
+  //
+  // The stream is written strictly front to back, so it can be piped. Readers that can seek find the index through the trailer at the end of the stream.
+
+  constexpr uint32_t swapFourCC(const char a, const char b, const char c, const char d) { return (uint32_t)a | ((uint32_t)b << 8) | ((uint32_t)c << 16) | ((uint32_t)d << 24); }
+
+  constexpr uint32_t swapStreamHeaderMagic = swapFourCC('S', 'W', 'A', 'P');
+  constexpr uint32_t swapFrameHeaderMagic = swapFourCC('S', 'W', 'F', 'R');
+  constexpr uint32_t swapSliceHeaderMagic = swapFourCC('S', 'W', 'S', 'L');
+  constexpr uint32_t swapIndexHeaderMagic = swapFourCC('S', 'W', 'I', 'X');
+  constexpr uint32_t swapStreamTrailerMagic = swapFourCC('S', 'W', 'N', 'D');
+  constexpr uint16_t swapStreamVersion = 7;
+
+  enum swapStreamFlags : uint16_t
+  {
+    sSF_None = 0,
+    sSF_Alpha = 1 << 0, // the planes are followed by an alpha plane at full resolution.
+    sSF_Progressive = 1 << 1, // frames are split into coefficient bands.
+    sSF_Lossless = 1 << 2, // blocks hold prediction residuals instead of quantized coefficients.
+    sSF_LowLatency = 1 << 3, // frames are split into rows of tiles that are written as soon as they're coded. Never progressive.
+  };
+
+  enum swapFrameFlags : uint32_t
+  {
+    sFF_None = 0,
+    sFF_Keyframe = 1 << 0,
+    sFF_Repeat = 1 << 1, // the frame is identical to the previous one and has no payload.
+  };
+
+#pragma pack(push, 1)
+  struct swapStreamHeader
+  {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+    uint32_t resX;
+    uint32_t resY;
+    uint32_t iframeStep;
+    uint32_t quality;
+    uint32_t bitDepth; // of the samples: 8 to 16.
+    uint32_t chromaFormat; // `swapChromaFormat`.
+    uint32_t tileWidth; // in pixels, multiple of 16.
+    uint32_t tileHeight; // in pixels, multiple of 16.
+  };
+
+  struct swapFrameHeader
+  {
+    uint32_t magic;
+    uint32_t frameIndex;
+    uint32_t flags;
+    uint32_t tileCount; // 0 for repeated frames.
+    uint64_t payloadSize; // tile size table and tile data following this header. 0 in low latency streams, as the rows of tiles carry their own size.
+  };
+
+  struct swapSliceHeader
+  {
+    uint32_t magic;
+    uint32_t tileRow;
+    uint32_t payloadSize; // tile size table and tile data of the row following this header.
+  };
+
+  struct swapIndexHeader
+  {
+    uint32_t magic;
+    uint32_t frameCount;
+  };
+
+  struct swapIndexEntry
+  {
+    uint64_t offset; // of the `swapFrameHeader` from the start of the stream.
+    uint64_t size; // including the `swapFrameHeader`.
+    uint32_t flags;
+  };
+
+  struct swapStreamTrailer
+  {
+    uint64_t indexOffset;
+    uint32_t frameCount;
+    uint32_t magic;
+  };
+#pragma pack(pop)
+
+  //////////////////////////////////////////////////////////////////////////
+
+  // Receives the stream produced by a `swapEncoder`.
+  // The data passed to the sink concatenated in call order is a valid stream. Sinks are never asked to seek.
+  // Frames may be written from a thread of the encoder, but the calls never overlap.
+  struct swapSink
+  {
+    virtual ~swapSink() { }
+
+    virtual swapResult WriteHeader(IN const uint8_t *pData, const size_t size) = 0;
+    virtual swapResult WriteFrame(const size_t frameIndex, const bool isKeyframe, IN const uint8_t *pData, const size_t size) = 0;
+    virtual swapResult WriteIndex(IN const uint8_t *pData, const size_t size) = 0;
+
+    // Low latency encoders hand every frame over in parts as soon as they're coded: the frame header first, then every row of tiles. Passes the parts on to `WriteFrame` by default.
+    virtual swapResult WriteFramePart(const size_t frameIndex, const bool isKeyframe, IN const uint8_t *pData, const size_t size) { return WriteFrame(frameIndex, isKeyframe, pData, size); }
+  };
+
+  // Writes to a file, `stdout` or a pipe. On Windows, `Create` switches `pFile` to binary mode.
+  struct swapFileSink : swapSink
+  {
+    static swapFileSink * Create(const std::string &filename);
+    static swapFileSink * Create(IN FILE *pFile, const bool closeFile);
+    ~swapFileSink();
+
+    swapResult WriteHeader(IN const uint8_t *pData, const size_t size) override;
+    swapResult WriteFrame(const size_t frameIndex, const bool isKeyframe, IN const uint8_t *pData, const size_t size) override;
+    swapResult WriteIndex(IN const uint8_t *pData, const size_t size) override;
+
+    // Flushes every part, so it's passed on to a pipe right away.
+    swapResult WriteFramePart(const size_t frameIndex, const bool isKeyframe, IN const uint8_t *pData, const size_t size) override;
+
+    FILE *pFile = nullptr;
+    bool closeFile = false;
+  };
+
+  // Appends the stream to a growing memory buffer.
+  struct swapMemorySink : swapSink
+  {
+    static swapMemorySink * Create();
+    ~swapMemorySink();
+
+    swapResult WriteHeader(IN const uint8_t *pData, const size_t size) override;
+    swapResult WriteFrame(const size_t frameIndex, const bool isKeyframe, IN const uint8_t *pData, const size_t size) override;
+    swapResult WriteIndex(IN const uint8_t *pData, const size_t size) override;
+
+    swapResult Append(IN const uint8_t *pData, const size_t size);
+
+    uint8_t *pData = nullptr;
+    size_t size = 0;
+    size_t capacity = 0;
+  };
+
+  //////////////////////////////////////////////////////////////////////////
+
+  // Caller owned frame memory with one pointer and one line pitch in bytes per plane.
+  // Planar formats use the Y, U, V (and A) planes, `sPF_NV12` the Y and interleaved UV plane and packed formats only the first plane.
+  struct swapFrameDescriptor
+  {
+    swapPixelFormat format = sPF_YUV420;
+    const uint8_t *pPlanes[4] = { nullptr, nullptr, nullptr, nullptr };
+    size_t strides[4] = { 0, 0, 0, 0 };
+
+    // Describes a tightly packed frame of `swapGetImageSize(format, resX, resY)` bytes at `pData`.
+    static swapFrameDescriptor Packed(const swapPixelFormat format, IN const uint8_t *pData, const size_t resX, const size_t resY);
+  };
+
+  //////////////////////////////////////////////////////////////////////////
+
+  // Share of the worker threads an encoder or decoder gets while others compete for them: `sP_High` tasks are taken twice as often as `sP_Normal` tasks and four times as often as `sP_Low` tasks.
+  enum swapPriority
+  {
+    sP_Low,
+    sP_Normal,
+    sP_High,
+  };
+
+  struct swapThreadPoolOptions
+  {
+    // `0` starts one thread per core but one, as the thread of an encoder or decoder works on its own tasks while waiting for them. Pinned workers start one thread per core they may run on.
+    size_t threadCount = 0;
+
+    // Pins worker `i` to the logical cores set in `affinityMasks[i % affinityMasks.size()]`, bit `n` being core `n`. With a `numaNode`, bit `n` is core `n` of the processor group of 64 cores holding the first core
+    // of the node instead, and only its cores may be set. Empty lets the workers run on any core.
+    std::vector<uint64_t> affinityMasks;
+
+    // Pins the workers to the cores of a NUMA node, so the coefficient buffers they first touch are placed in its memory. Workers take turns between the processor groups of nodes spanning several groups on
+    // Windows, where threads can only run in one group. `-1` doesn't bind the workers to a node.
+    int32_t numaNode = -1;
+  };
+
+  // Worker threads that any number of encoders and decoders can share instead of each starting one per core. Every encoder and decoder queues its tasks separately and idle workers take them
+  // round robin, weighted by priority, so a large stream can't starve the others. Has to outlive the encoders and decoders using it.
+  // The threads of encoders and decoders only work on their own tasks while they wait for them if the workers aren't pinned, so pinned pools keep all tile work on their cores.
+  struct swapThreadPool
+  {
+    static swapThreadPool * Create(const size_t threadCount = 0);
+
+    // Returns `nullptr` if the NUMA node doesn't exist or the workers can't be pinned.
+    static swapThreadPool * Create(const swapThreadPoolOptions &options);
+    ~swapThreadPool();
+
+    size_t threadCount = 0;
+    bool pinned = false;
+
+    void *pWorkers = nullptr;
+  };
+
+  //////////////////////////////////////////////////////////////////////////
+
+  struct swapEncoderOptions
+  {
+    size_t iframeStep = 30;
+
+    // Streams with more than 8 bits per sample take `_16` frames and are transformed with 32 bit intermediates.
+    uint32_t bitDepth = 8;
+
+    // Planar frames have to match the chroma format and alpha plane of the stream. Packed and NV12 frames can only be added to 8 bit 4:2:0 streams; the alpha of BGRA and RGBA frames is kept if the stream has an alpha plane.
+    swapChromaFormat chromaFormat = sCF_420;
+    bool alpha = false;
+
+    // Tiles are coded independently, the unit of work of the worker threads and decoded on their own for regions. Multiples of 16; `0` spans the whole width and 16 lines respectively.
+    size_t tileWidth = 0;
+    size_t tileHeight = 0;
+
+    // Stores the coefficients of every frame coarse to fine, so the first bytes of a frame already give a lower quality picture. See `swapDecoder::DecodeFrameProgressive`.
+    bool progressive = false;
+
+    // Replaces the DCT and quantization by a reversible prediction of every sample, so planar and NV12 frames are decoded bit exact. Packed RGB frames are still converted to YUV first.
+    bool lossless = false;
+
+    // Codes every row of tiles on its own and hands it to the sink as soon as it's done, in order, so the first rows are sent while the rest of the frame is still being transformed.
+    // Frames are encoded within `AddFrame` regardless of `pipelineDepth`; the worker threads code rows in parallel and the sink receives them in order. Can't be progressive.
+    bool lowLatency = false;
+
+    // Frames in flight: every frame is coded within `AddFrame` in a single pass over its tiles, while up to `pipelineDepth - 1` coded frames are written to the sink on a thread of the encoder. `0` and `1` write every frame within `AddFrame`.
+    // Every frame in flight holds a buffer for the coded frame; `index` and `streamOffset` only include the frames that have been written.
+    size_t pipelineDepth = 2;
+
+    // Runs the tasks of the encoder on a thread pool shared with other encoders and decoders. `nullptr` uses a thread pool shared by all encoders and decoders created without one.
+    swapThreadPool *pThreadPool = nullptr;
+    swapPriority priority = sP_Normal;
+  };
+
+  // Notifications about a frame added with `swapEncoder::AddFrameAsync`, called from a thread of the encoder. They may queue frames with `AddFrameAsync`, but must not wait for the encoder.
+  struct swapFrameCallbacks
+  {
+    // The frame memory isn't accessed anymore and can be reused.
+    void (*pOnInputReleased)(void *pUserData, const size_t ticket) = nullptr;
+
+    // The frame has been written to the sink or failed with `result`.
+    void (*pOnFrameWritten)(void *pUserData, const size_t ticket, const swapResult result) = nullptr;
+
+    void *pUserData = nullptr;
+  };
+
   struct swapEncoder
   {
-    static swapEncoder * Create(const std::string &filename, const size_t resX, const size_t resY);
+    static swapEncoder * Create(const std::string &filename, const size_t resX, const size_t resY, const size_t iframeStep = 30);
+    static swapEncoder * Create(const std::string &filename, const size_t resX, const size_t resY, const swapEncoderOptions &options);
+
+    // `pSink` is not owned by the encoder and has to outlive it.
+    static swapEncoder * Create(IN swapSink *pSink, const size_t resX, const size_t resY, const size_t iframeStep = 30);
+    static swapEncoder * Create(IN swapSink *pSink, const size_t resX, const size_t resY, const swapEncoderOptions &options);
     ~swapEncoder();
 
-    swapResult AddFrameYUV420(IN_OUT uint8_t *pFrameData);
+    swapResult AddFrameYUV420(IN const uint8_t *pFrameData);
+
+    // Packed frames are converted to YUV420 per slice right before they're transformed.
+    swapResult AddFrameBGRA(IN const uint8_t *pFrameData);
+    swapResult AddFrameRGBA(IN const uint8_t *pFrameData);
+    swapResult AddFrameNV12(IN const uint8_t *pFrameData);
+
+    // Reads the planes in place, so padded or separately allocated planes don't have to be copied into one buffer first.
+    // Frames are hashed first; a frame identical to the previous one is written as a repeat record unless it's due to be a keyframe. Lossless streams confirm a matching hash by comparing the coefficients of the frame
+    // with the ones of the previous frame. Lossy streams trust the 64 bit hash, so a frame colliding with the hash of a different previous frame would be shown as that frame, which is very unlikely but not impossible.
+    swapResult AddFrame(const swapFrameDescriptor &frame);
+
+    // Queues the frame to be hashed and transformed on a thread of the encoder and returns right away; the frame memory has to stay valid until `pOnInputReleased` is called.
+    // `*pTicket` receives the number of the frame among all frames added to the encoder, which is its frame index unless an earlier frame failed.
+    swapResult AddFrameAsync(const swapFrameDescriptor &frame, OUT size_t *pTicket, const swapFrameCallbacks &callbacks = swapFrameCallbacks());
+
+    // Waits until the frame with `ticket` (or all frames added so far) has been written. Returns the first error of any frame.
+    swapResult WaitForFrame(const size_t ticket);
+    swapResult Flush();
+
     swapResult Finalize();
 
     uint8_t *pLowResDataUncompressed = nullptr;
@@ -59,24 +381,139 @@ namespace swapcodec
     size_t resY;
     size_t lowResX;
     size_t lowResY;
-    size_t currentFrameIndex;
+    size_t currentFrameIndex = 0;
     size_t iframeStep;
+    uint32_t quality;
+    uint32_t bitDepth = 8;
+    swapChromaFormat chromaFormat = sCF_420;
+    bool alpha = false;
+    size_t tileWidth;
+    size_t tileHeight;
+    bool progressive = false;
+    bool lossless = false;
+    bool lowLatency = false;
 
-    std::string filename;
-    FILE *pHeaderFile = nullptr;
-    FILE *pMainFile = nullptr;
-    FILE *pFinalFile = nullptr;
+    uint64_t lastFrameHash = 0;
+    bool lastFrameHashValid = false;
 
-    void *pThreadPool = nullptr;
+    swapSink *pSink = nullptr;
+    bool ownsSink = false;
+    bool finalized = false;
+    size_t streamOffset = 0;
+    std::vector<swapIndexEntry> index;
+
+    void *pTaskQueue = nullptr;
+    void *pPipeline = nullptr;
+    void *pSubmitQueue = nullptr;
   };
 
+  // Notifications about a stream decoded with `swapDecoder::Push`, called from within `Push`.
+  struct swapPushCallbacks
+  {
+    // Lines `y` to `y + height - 1` of frame `frameIndex` in `swapGetImageSize(outputFormat, resX, height)` bytes at `pLines`, valid until the callback returns.
+    // Low latency streams deliver every row of tiles as soon as it has been pushed, other streams whole frames.
+    void (*pOnLinesDecoded)(void *pUserData, const size_t frameIndex, const size_t y, const size_t height, IN const uint8_t *pLines) = nullptr;
+
+    // All lines of frame `frameIndex` have been delivered. Repeated frames only call this, as their lines are the ones of the previous frame.
+    void (*pOnFrameDecoded)(void *pUserData, const size_t frameIndex) = nullptr;
+
+    void *pUserData = nullptr;
+  };
+
+  // Notifications about frames decoded with `swapDecoder::DecodeFrames`, called in frame order on the thread calling `DecodeFrames`.
+  struct swapBatchCallbacks
+  {
+    // `pFrame` holds `swapGetImageSize(outputFormat, resX, resY)` bytes and is valid until the callback returns.
+    void (*pOnFrameDecoded)(void *pUserData, const size_t frameIndex, IN const uint8_t *pFrame) = nullptr;
+
+    void *pUserData = nullptr;
+  };
+
+#ifdef SWAP_COROUTINES
+  struct swapDecoder;
+
+  // Suspends the awaiting coroutine while a frame decodes on the thread pool of the decoder, then resumes it on the worker that decoded the last tile of the frame, without blocking a thread in between.
+  // Once resumed, the coroutine may await more frames, `Open` another stream or destroy the decoder, which first decode the frames still queued on that worker. Until it suspends again, frames queued after it wait.
+  // `co_await` returns the result of the decode; `frameIndex` is the decoded frame afterwards.
+  struct swapDecodeAwaitable
+  {
+    swapDecoder *pDecoder;
+    size_t frameIndex; // `(size_t)-1` for the frame following the last decoded frame.
+    uint8_t *pFrame;
+    swapResult result = sR_Success;
+    std::coroutine_handle<> handle;
+
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> awaitingHandle);
+    swapResult await_resume() const noexcept { return result; }
+  };
+#endif
+
   struct swapDecoder
   {
-    static swapDecoder * Create();
+    // `pThreadPool` of `nullptr` uses a thread pool shared by all encoders and decoders created without one.
+    static swapDecoder * Create(IN swapThreadPool *pThreadPool = nullptr, const swapPriority priority = sP_Normal);
     ~swapDecoder();
 
+    // Switches a planar output format to the planar format of the stream.
+    swapResult Open(const std::string &filename);
+
+    // Frames are converted to packed RGB formats while still in cache right after the inverse transform of each slice; BGRA and RGBA take the alpha plane of the stream if it has one.
+    // Once a stream is open, planar formats have to match its chroma format, alpha plane and bit depth; packed formats always have 8 bits per sample.
+    swapResult SetOutputFormat(const swapPixelFormat format, const swapColorSpace colorSpace = sCS_BT601);
+
+    // Decodes into a caller provided buffer of `swapGetImageSize(outputFormat, resX, resY)` bytes.
+    swapResult DecodeFrame(const size_t frameIndex, OUT uint8_t *pFrame);
+
+    // Decodes the `width` x `height` pixel region at `x`, `y` into a caller provided buffer of `swapGetImageSize(outputFormat, width, height)` bytes.
+    // Only the tiles overlapping the region are entropy decoded and only the intersecting blocks are reconstructed.
+    // `x` and `y` have to be even, as do `width` and `height` unless the region ends at the right or bottom edge of an odd sized frame.
+    swapResult DecodeFrameRegion(const size_t frameIndex, const size_t x, const size_t y, const size_t width, const size_t height, OUT uint8_t *pRegion);
+
+    // Decodes a preview of `frameIndex` of a progressive stream reading at most the first `maxFrameBytes` bytes of every frame from the preceding keyframe on.
+    // Coefficient bands that aren't entirely within these bytes are left out. Bypasses the frame cache and doesn't keep any reference coefficients.
+    swapResult DecodeFrameProgressive(const size_t frameIndex, const size_t maxFrameBytes, OUT uint8_t *pFrame);
+
+    // Decodes the frame following the last decoded frame. Returns `sR_EndOfStream` after the last frame.
+    swapResult DecodeNext(OUT uint8_t *pFrame);
+
+    // Decodes `batchFrameCount` frames starting at `firstFrameIndex` with one task per group of pictures on the thread pool, every group decoding from its own file handle and reference coefficients.
+    // Frames decoded ahead of their turn wait in a reorder buffer of `reorderFrameCount` frames, one per group of pictures decoded at once if `0`; groups that find it full wait without holding a worker.
+    // Bypasses the read-ahead and the frame cache.
+    swapResult DecodeFrames(const size_t firstFrameIndex, const size_t batchFrameCount, const swapBatchCallbacks &callbacks, const size_t reorderFrameCount = 0);
+
+    // Queue a decode of `frameIndex` or, like `DecodeNext`, the frame following the frame decoded before it. Every tile is decoded by a task of the thread pool; the task finishing the last tile calls `pOnDecoded`
+    // and goes on with the next queued frame, so frames decode in the order they were queued. Returns `sR_InvalidParameter` while the read-ahead is enabled.
+    // Other decoding functions must not be called until all queued frames have been decoded; `Open` and `BeginPush` wait for them. `pOnDecoded` is called once the decoder is done with the frame, so it may queue frames, `Open` another stream or destroy the decoder, which decode the frames still queued first.
+    swapResult DecodeFrameAsync(const size_t frameIndex, OUT uint8_t *pFrame, void (*pOnDecoded)(void *pUserData, const size_t frameIndex, const swapResult result), void *pUserData);
+    swapResult DecodeNextAsync(OUT uint8_t *pFrame, void (*pOnDecoded)(void *pUserData, const size_t frameIndex, const swapResult result), void *pUserData);
+
+#ifdef SWAP_COROUTINES
+    // `swapResult result = co_await pDecoder->NextFrame(pFrame);` Returns `sR_EndOfStream` after the last frame.
+    swapDecodeAwaitable NextFrame(OUT uint8_t *pFrame) { return swapDecodeAwaitable{ this, (size_t)-1, pFrame, sR_Success, {} }; }
+    swapDecodeAwaitable Frame(const size_t frameIndex, OUT uint8_t *pFrame) { return swapDecodeAwaitable{ this, frameIndex, pFrame, sR_Success, {} }; }
+#endif
+
+    // Decodes a stream handed over in pieces of any size as it arrives, e.g. from a socket, instead of reading it from a file. Closes the current stream.
+    // Rows of tiles of low latency streams are reconstructed as soon as they're complete. Data after the index is ignored.
+    swapResult BeginPush(const swapPushCallbacks &callbacks);
+    swapResult Push(IN const uint8_t *pData, const size_t size);
+
+    // Keeps the `readAheadFrameCount` frames following the last acquired frame decoding in the background into a ring of internal buffers.
+    swapResult EnableReadAhead(const size_t readAheadFrameCount);
+    void DisableReadAhead();
+
+    // Waits for the read-ahead to decode `frameIndex` and returns its buffer, which stays valid until `ReleaseFrame` is called.
+    // Acquiring a frame outside of the read-ahead window cancels the pending frames and restarts the read-ahead at `frameIndex`.
+    swapResult AcquireFrame(const size_t frameIndex, OUT const uint8_t **ppFrame);
+    swapResult ReleaseFrame(const size_t frameIndex);
+
+    // Keeps recently decoded frames and reference coefficients of frames within their group of pictures in a least recently used cache of up to `memoryBudget` bytes.
+    swapResult EnableFrameCache(const size_t memoryBudget);
+    void DisableFrameCache();
+
     std::string filename;
-    FILE *pFile;
+    FILE *pFile = nullptr;
 
     uint8_t *pFrameData = nullptr;
     size_t frameDataCapacity = 0;
@@ -86,11 +523,62 @@ namespace swapcodec
     size_t resY;
     size_t lowResX;
     size_t lowResY;
-    size_t currentFrameIndex;
+    size_t currentFrameIndex = 0;
     size_t iframeStep;
+    uint32_t quality;
+    uint32_t bitDepth = 8;
+    swapChromaFormat chromaFormat = sCF_420;
+    bool alpha = false;
+    size_t tileWidth;
+    size_t tileHeight;
+    bool progressive = false;
+    bool lossless = false;
+    bool lowLatency = false;
+
+    swapPixelFormat outputFormat = sPF_YUV420;
+    swapColorSpace colorSpace = sCS_BT601;
+
+    size_t frameCount = 0;
+    std::vector<swapIndexEntry> index;
 
-    uint8_t *pDecodedFrameYUV420 = nullptr;
+    // Quantized coefficients of the last decoded frame. As regions only decode some tiles, the frame index is tracked per tile.
+    uint8_t *pReferenceData = nullptr;
+    std::vector<size_t> tileReferenceFrameIndex;
+
+    void *pTaskQueue = nullptr;
+    void *pReadAhead = nullptr;
+    void *pFrameCache = nullptr;
+    void *pPush = nullptr;
+    void *pSubmitQueue = nullptr;
+
+    // Low latency frames are gathered into the layout of other frames here after they've been read.
+    uint8_t *pSliceData = nullptr;
+    size_t sliceDataCapacity = 0;
   };
+
+#ifdef SWAP_COROUTINES
+  inline bool swapDecodeAwaitable::await_suspend(std::coroutine_handle<> awaitingHandle)
+  {
+    auto onDecoded = [](void *pUserData, const size_t decodedFrameIndex, const swapResult decodeResult)
+    {
+      swapDecodeAwaitable *pAwaitable = reinterpret_cast<swapDecodeAwaitable *>(pUserData);
+      pAwaitable->frameIndex = decodedFrameIndex;
+      pAwaitable->result = decodeResult;
+      pAwaitable->handle.resume();
+    };
+
+    handle = awaitingHandle;
+
+    // The coroutine may already be resumed on a worker before this returns, so nothing is touched once the frame has been queued.
+    const swapResult queueResult = frameIndex == (size_t)-1 ? pDecoder->DecodeNextAsync(pFrame, onDecoded, this) : pDecoder->DecodeFrameAsync(frameIndex, pFrame, onDecoded, this);
+
+    if (queueResult == sR_Success)
+      return true;
+
+    result = queueResult;
+    return false;
+  }
+#endif
 }
 
 #endif // swapcodec_h__
@@ -0,0 +1,2448 @@
+// Copyright 2018 Christoph Stiller
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+// 
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "swapcodecInternal.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <string.h>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+
+using namespace swapcodec;
+
+//////////////////////////////////////////////////////////////////////////
+
+// Decodes the zigzag ordered coefficients `firstCoefficient` up to `endCoefficient` of a block. Keyframe blocks are cleared by the band starting at 0.
+// `TCoefficient` is `int16_t` or, for high bit depth streams, `int32_t`; only the latter accepts 32 bit values.
+template <typename TCoefficient>
+static bool swapDecodeBlock(IN_OUT const uint8_t **ppData, IN const uint8_t *pDataEnd, IN_OUT TCoefficient *pBlock, const bool isKeyframe, IN_OUT TCoefficient *pLastDC, const size_t firstCoefficient, const size_t endCoefficient)
+{
+  typedef typename std::make_unsigned<TCoefficient>::type TUnsigned;
+
+  const uint8_t *pData = *ppData;
+  TCoefficient values[64] = { 0 };
+  size_t position = firstCoefficient;
+
+  while (true)
+  {
+    if (pData >= pDataEnd)
+      return false;
+
+    const uint8_t token = *pData++;
+
+    if (token == SWAP_TOKEN_END_OF_BLOCK)
+      break;
+
+    position += token >> 2;
+
+    if (position >= endCoefficient)
+      return false;
+
+    switch (token & 3)
+    {
+    case SWAP_TOKEN_INT8:
+      if (pData + 1 > pDataEnd)
+        return false;
+
+      values[position] = (int8_t)pData[0];
+      pData += 1;
+      break;
+
+    case SWAP_TOKEN_INT16:
+      if (pData + 2 > pDataEnd)
+        return false;
+
+      values[position] = (int16_t)(pData[0] | (pData[1] << 8));
+      pData += 2;
+      break;
+
+    case SWAP_TOKEN_INT32:
+      if (sizeof(TCoefficient) < sizeof(int32_t) || pData + 4 > pDataEnd)
+        return false;
+
+      values[position] = (TCoefficient)(int32_t)((uint32_t)pData[0] | ((uint32_t)pData[1] << 8) | ((uint32_t)pData[2] << 16) | ((uint32_t)pData[3] << 24));
+      pData += 4;
+      break;
+
+    default:
+      return false;
+    }
+
+    position++;
+  }
+
+  if (firstCoefficient == 0)
+  {
+    values[0] = (TCoefficient)(TUnsigned)((TUnsigned)values[0] + (TUnsigned)*pLastDC);
+    *pLastDC = values[0];
+  }
+
+  if (isKeyframe)
+  {
+    const size_t lastCoefficient = firstCoefficient == 0 ? 64 : endCoefficient;
+
+    for (size_t i = firstCoefficient; i < lastCoefficient; i++)
+      pBlock[_izigzag_table_standard[i]] = values[i];
+  }
+  else
+  {
+    for (size_t i = firstCoefficient; i < endCoefficient; i++)
+      pBlock[_izigzag_table_standard[i]] = (TCoefficient)(TUnsigned)((TUnsigned)pBlock[_izigzag_table_standard[i]] + (TUnsigned)values[i]);
+  }
+
+  *ppData = pData;
+
+  return true;
+}
+
+// Entropy decodes a band of the blocks of one slice of a tile column from `*ppData`, which is advanced past them.
+template <typename TCoefficient>
+static bool swapDecodeSlice(IN_OUT const uint8_t **ppData, IN const uint8_t *pDataEnd, IN_OUT TCoefficient *pCoefficients, const bool isKeyframe, const swapPlaneLayout &layout, const size_t firstCoefficient, const size_t endCoefficient)
+{
+  // DC values are predicted from the previous block of the same plane.
+  size_t plane = 0;
+  TCoefficient lastDC = 0;
+
+  for (size_t block = 0; block < layout.blocksPerSlice; block++)
+  {
+    if (plane + 1 < layout.planeCount && block == layout.planes[plane + 1].firstBlock)
+    {
+      plane++;
+      lastDC = 0;
+    }
+
+    if (!swapDecodeBlock(ppData, pDataEnd, pCoefficients, isKeyframe, &lastDC, firstCoefficient, endCoefficient))
+      return false;
+
+    pCoefficients += 64;
+  }
+
+  return true;
+}
+
+static inline void swapInverseTransformBlock(OUT uint8_t *pDestination, const size_t stride, IN const int16_t *pCoefficients, IN const uint16_t *pQt, const uint32_t /* bitDepth */)
+{
+  idct_sse2(pDestination, (int)stride, pCoefficients, pQt);
+}
+
+static inline void swapInverseTransformBlock(OUT uint16_t *pDestination, const size_t stride, IN const int32_t *pCoefficients, IN const float *pQt, const uint32_t bitDepth)
+{
+  swapIdctHighBitDepth(pDestination, stride, pCoefficients, pQt, bitDepth);
+}
+
+// Takes the place of the dequantization tables for lossless streams.
+struct swapLosslessQuantization { };
+
+template <typename TSample>
+static inline void swapInverseTransformBlock(OUT TSample *pDestination, const size_t stride, IN const int16_t *pCoefficients, IN const swapLosslessQuantization * /* pQt */, const uint32_t bitDepth)
+{
+  swapReconstructBlockLossless(pDestination, stride, pCoefficients, bitDepth);
+}
+
+// `TSample` is `uint8_t` with 16 bit coefficients and the fixed point dequantization tables of `idct_sse2` or `uint16_t` with 32 bit coefficients and the high bit depth tables. Both reverse the 16 bit prediction residuals of lossless streams with `swapLosslessQuantization`.
+template <typename TSample, typename TCoefficient, typename TQuantization>
+static void swapReconstructBlock(IN const TCoefficient *pCoefficients, OUT TSample *pPlane, const swapRegion &planeRegion, const size_t x, const size_t y, IN const TQuantization *pQt, const uint32_t bitDepth)
+{
+  if (x >= planeRegion.x && y >= planeRegion.y && x + 8 <= planeRegion.x + planeRegion.width && y + 8 <= planeRegion.y + planeRegion.height)
+  {
+    swapInverseTransformBlock(pPlane + (y - planeRegion.y) * planeRegion.width + (x - planeRegion.x), planeRegion.width, pCoefficients, pQt, bitDepth);
+    return;
+  }
+
+  // Blocks on the border of the region are reconstructed into a temporary block and cropped.
+  TSample block[64];
+  swapInverseTransformBlock(block, 8, pCoefficients, pQt, bitDepth);
+
+  const size_t x0 = std::max(x, planeRegion.x);
+  const size_t x1 = std::min(x + 8, planeRegion.x + planeRegion.width);
+  const size_t y0 = std::max(y, planeRegion.y);
+  const size_t y1 = std::min(y + 8, planeRegion.y + planeRegion.height);
+
+  for (size_t line = y0; line < y1; line++)
+    swapMemcpy(pPlane + (line - planeRegion.y) * planeRegion.width + (x0 - planeRegion.x), block + (line - y) * 8 + (x0 - x), (x1 - x0) * sizeof(TSample));
+}
+
+// Reconstructs the blocks of `slice` in the tile column starting at `columnX` intersecting `region` into the planar image of `region.width` x `region.height` pixels at `pImage`, with the planes of `layout` stored consecutively.
+template <typename TSample, typename TCoefficient, typename TQuantization>
+static void swapReconstructSlice(IN const TCoefficient *pCoefficients, OUT TSample *pImage, const size_t slice, const size_t columnX, const swapRegion &region, const swapPlaneLayout &layout, IN const TQuantization *pLdqt, IN const TQuantization *pCdqt, const uint32_t bitDepth)
+{
+  TSample *pPlane = pImage;
+
+  for (size_t p = 0; p < layout.planeCount; p++)
+  {
+    const auto &plane = layout.planes[p];
+    const swapRegion planeRegion = { region.x >> plane.shiftX, region.y >> plane.shiftY, swapGetPlaneSize(region.width, plane.shiftX), swapGetPlaneSize(region.height, plane.shiftY) };
+    const TQuantization *pQt = plane.isChroma ? pCdqt : pLdqt;
+
+    const size_t planeColumnX = columnX >> plane.shiftX;
+    const size_t x0 = std::max(planeRegion.x, planeColumnX);
+    const size_t x1 = std::min(planeRegion.x + planeRegion.width, planeColumnX + (plane.blocksPerRow << 3));
+
+    for (size_t row = 0; row < plane.blockRows; row++)
+    {
+      const size_t y = slice * (SWAP_SLICE_HEIGHT >> plane.shiftY) + (row << 3);
+
+      if (x0 < x1 && y + 8 > planeRegion.y && y < planeRegion.y + planeRegion.height)
+        for (size_t x = (x0 - planeColumnX) >> 3; x <= (x1 - 1 - planeColumnX) >> 3; x++)
+          swapReconstructBlock(pCoefficients + x * 64, pPlane, planeRegion, planeColumnX + (x << 3), y, pQt, bitDepth);
+
+      pCoefficients += plane.blocksPerRow * 64;
+    }
+
+    pPlane += planeRegion.width * planeRegion.height;
+  }
+}
+
+// Reconstructs 8 bit streams from 16 bit coefficients or the lossless prediction.
+static void swapReconstructTileSlice(IN const uint8_t *pCoefficients, OUT uint8_t *pImage, const size_t slice, const size_t columnX, const swapRegion &region, const swapPlaneLayout &layout, IN const uint16_t *pLdqt, IN const uint16_t *pCdqt, const bool lossless, const uint32_t bitDepth)
+{
+  const swapLosslessQuantization losslessQuantization = {};
+
+  if (lossless)
+    swapReconstructSlice(reinterpret_cast<const int16_t *>(pCoefficients), pImage, slice, columnX, region, layout, &losslessQuantization, &losslessQuantization, bitDepth);
+  else
+    swapReconstructSlice(reinterpret_cast<const int16_t *>(pCoefficients), pImage, slice, columnX, region, layout, pLdqt, pCdqt, bitDepth);
+}
+
+// Reconstructs high bit depth streams from 32 bit coefficients or the 16 bit lossless prediction.
+static void swapReconstructTileSlice(IN const uint8_t *pCoefficients, OUT uint16_t *pImage, const size_t slice, const size_t columnX, const swapRegion &region, const swapPlaneLayout &layout, IN const float *pLdqt, IN const float *pCdqt, const bool lossless, const uint32_t bitDepth)
+{
+  const swapLosslessQuantization losslessQuantization = {};
+
+  if (lossless)
+    swapReconstructSlice(reinterpret_cast<const int16_t *>(pCoefficients), pImage, slice, columnX, region, layout, &losslessQuantization, &losslessQuantization, bitDepth);
+  else
+    swapReconstructSlice(reinterpret_cast<const int32_t *>(pCoefficients), pImage, slice, columnX, region, layout, pLdqt, pCdqt, bitDepth);
+}
+
+// A frame being decoded by `swapDecodeFrame`, taken apart so the tiles can be decoded by tasks that don't wait for each other: `swapDecodeFrameBegin` prepares it, `swapDecodeFrameTile` decodes each of
+// the `regionTileCount` tiles overlapping the region and `swapDecodeFrameEnd` returns the result once all of them are done.
+struct swapFrameDecode
+{
+  const uint8_t *pCompressedData;
+  size_t frameIndex;
+  bool isKeyframe;
+  size_t targetFrameIndex;
+  uint8_t *pUncompressedData;
+  size_t *pTileFrameIndex;
+  uint8_t *pImage;
+  swapRegion region;
+  swapPixelFormat format;
+  swapColorSpace colorSpace;
+  swapTileGrid grid;
+  bool lossless;
+  uint32_t bitDepth;
+
+  const size_t *pBands;
+  size_t *pTileOffsets; // `SWAP_PROGRESSIVE_BAND_COUNT * tileCount + 1` entries provided by the caller.
+  size_t availableBandCount;
+  size_t tileCount;
+  bool planar;
+  size_t firstTileY;
+  size_t firstColumn;
+  size_t regionColumnCount;
+  size_t regionTileCount;
+
+  alignas(16) uint16_t Ldqt[64];
+  alignas(16) uint16_t Cdqt[64];
+  float LdqtHighBitDepth[64];
+  float CdqtHighBitDepth[64];
+
+  std::atomic<bool> tileCorrupted;
+  std::atomic<bool> allocationFailed;
+};
+
+// Entropy decodes the tiles of `frameIndex` overlapping `region` into (or for non-keyframes onto) the coefficients in `pUncompressedData` and reconstructs the region into `pImage`.
+// `pTileFrameIndex` tracks the frame the coefficients of each tile belong to; a tile is only decoded if it's on the way from `frameIndex` to `targetFrameIndex`.
+// Only the bands entirely within the first `availableDataLength` of `compressedDataLength` bytes are decoded; missing bands are zero for keyframes and unchanged otherwise.
+// Either `pCompressedData` or `pImage` may be `nullptr` to skip the corresponding stage.
+static swapResult swapDecodeFrameBegin(IN const uint8_t *pCompressedData, const size_t compressedDataLength, const size_t availableDataLength, const bool progressive, const bool lossless, const size_t frameIndex, const bool isKeyframe, const size_t targetFrameIndex, IN_OUT uint8_t *pUncompressedData, IN_OUT size_t *pTileFrameIndex, OUT uint8_t *pImage, const swapRegion &region, const swapPixelFormat format, const swapColorSpace colorSpace, const swapTileGrid &grid, const uint32_t quality, const uint32_t bitDepth, OUT size_t *pTileOffsets, OUT swapFrameDecode *pDecode)
+{
+  swapResult result = sR_Success;
+
+  const size_t tileCount = grid.tilesX * grid.tilesY;
+  const size_t bandCount = progressive ? SWAP_PROGRESSIVE_BAND_COUNT : 1;
+  const size_t tableSize = bandCount * tileCount * sizeof(uint32_t);
+
+  pDecode->pCompressedData = pCompressedData;
+  pDecode->frameIndex = frameIndex;
+  pDecode->isKeyframe = isKeyframe;
+  pDecode->targetFrameIndex = targetFrameIndex;
+  pDecode->pUncompressedData = pUncompressedData;
+  pDecode->pTileFrameIndex = pTileFrameIndex;
+  pDecode->pImage = pImage;
+  pDecode->region = region;
+  pDecode->format = format;
+  pDecode->colorSpace = colorSpace;
+  pDecode->grid = grid;
+  pDecode->lossless = lossless;
+  pDecode->bitDepth = bitDepth;
+  pDecode->pBands = progressive ? swapProgressiveBands : swapSequentialBands;
+  pDecode->pTileOffsets = pTileOffsets;
+  pDecode->availableBandCount = 0;
+  pDecode->tileCount = tileCount;
+  pDecode->planar = format != sPF_BGRA && format != sPF_RGBA && format != sPF_RGB24;
+  pDecode->firstTileY = region.y / grid.tileHeight;
+  pDecode->firstColumn = region.x / grid.tileWidth;
+  pDecode->regionColumnCount = (region.x + region.width - 1) / grid.tileWidth + 1 - pDecode->firstColumn;
+  pDecode->regionTileCount = pDecode->regionColumnCount * ((region.y + region.height - 1) / grid.tileHeight + 1 - pDecode->firstTileY);
+  pDecode->tileCorrupted = false;
+  pDecode->allocationFailed = false;
+
+  if (bitDepth > 8)
+    swapInitHighBitDepthQuantizationTables(quality, pDecode->LdqtHighBitDepth, pDecode->CdqtHighBitDepth);
+  else
+    swapInitDequantizationTables(quality, pDecode->Ldqt, pDecode->Cdqt);
+
+  if (pTileOffsets == nullptr)
+  {
+    result = sR_MemoryAllocationFailure;
+    goto epilogue;
+  }
+
+  if (pCompressedData != nullptr && availableDataLength >= tableSize)
+  {
+    const uint32_t *pTileSizes = reinterpret_cast<const uint32_t *>(pCompressedData);
+    pTileOffsets[0] = tableSize;
+
+    for (size_t i = 0; i < bandCount * tileCount; i++)
+      pTileOffsets[i + 1] = pTileOffsets[i] + pTileSizes[i];
+
+    if (pTileOffsets[bandCount * tileCount] != compressedDataLength)
+    {
+      result = sR_InvalidFormat;
+      goto epilogue;
+    }
+
+    while (pDecode->availableBandCount < bandCount && pTileOffsets[(pDecode->availableBandCount + 1) * tileCount] <= availableDataLength)
+      pDecode->availableBandCount++;
+  }
+  else if (pCompressedData != nullptr && compressedDataLength < tableSize)
+  {
+    result = sR_InvalidFormat;
+    goto epilogue;
+  }
+
+epilogue:
+  return result;
+}
+
+// Every tile is processed by a single call.
+static void swapDecodeFrameTile(swapFrameDecode &decode, const size_t regionTile)
+{
+  const swapTileGrid &grid = decode.grid;
+  const swapRegion &region = decode.region;
+  const size_t tileY = decode.firstTileY + regionTile / decode.regionColumnCount;
+  const size_t column = decode.firstColumn + regionTile % decode.regionColumnCount;
+  const size_t tile = tileY * grid.tilesX + column;
+  const size_t firstSlice = tileY * grid.slicesPerTile;
+  const size_t lastSlice = std::min(firstSlice + grid.slicesPerTile, grid.sliceCount);
+  const swapPlaneLayout &layout = swapGetTileColumnLayout(grid, column);
+  const size_t columnX = column * grid.tileWidth;
+  const size_t columnOffset = swapGetTileColumnOffset(grid, column);
+
+  if (decode.pCompressedData != nullptr)
+  {
+    const size_t tileFrameIndex = decode.pTileFrameIndex[tile];
+    bool decodeTile;
+
+    if (decode.isKeyframe)
+      decodeTile = tileFrameIndex == (size_t)-1 || tileFrameIndex < decode.frameIndex || tileFrameIndex > decode.targetFrameIndex;
+    else
+      decodeTile = tileFrameIndex + 1 == decode.frameIndex;
+
+    if (decodeTile)
+    {
+      // Keyframe coefficients are cleared by the first band, which might not be available.
+      if (decode.isKeyframe && decode.availableBandCount == 0)
+        for (size_t slice = firstSlice; slice < lastSlice; slice++)
+          memset(decode.pUncompressedData + (slice * grid.blocksPerSlice + columnOffset) * grid.blockSize, 0, layout.blocksPerSlice * grid.blockSize);
+
+      for (size_t band = 0; band < decode.availableBandCount; band++)
+      {
+        const uint8_t *pTileData = decode.pCompressedData + decode.pTileOffsets[band * decode.tileCount + tile];
+        const uint8_t *pTileEnd = decode.pCompressedData + decode.pTileOffsets[band * decode.tileCount + tile + 1];
+        bool valid = true;
+
+        for (size_t slice = firstSlice; slice < lastSlice && valid; slice++)
+        {
+          uint8_t *pSliceCoefficients = decode.pUncompressedData + (slice * grid.blocksPerSlice + columnOffset) * grid.blockSize;
+
+          if (grid.coefficientSize == sizeof(int32_t))
+            valid = swapDecodeSlice(&pTileData, pTileEnd, reinterpret_cast<int32_t *>(pSliceCoefficients), decode.isKeyframe, layout, decode.pBands[band], decode.pBands[band + 1]);
+          else
+            valid = swapDecodeSlice(&pTileData, pTileEnd, reinterpret_cast<int16_t *>(pSliceCoefficients), decode.isKeyframe, layout, decode.pBands[band], decode.pBands[band + 1]);
+        }
+
+        if (!valid || pTileData != pTileEnd)
+        {
+          decode.pTileFrameIndex[tile] = (size_t)-1;
+          decode.tileCorrupted = true;
+          return;
+        }
+      }
+
+      decode.pTileFrameIndex[tile] = decode.frameIndex;
+    }
+  }
+
+  if (decode.pImage == nullptr)
+    return;
+
+  const swapPixelFormat format = decode.format;
+  const uint32_t bitDepth = decode.bitDepth;
+  const size_t regionFirstSlice = std::max(firstSlice, region.y / SWAP_SLICE_HEIGHT);
+  const size_t regionLastSlice = std::min(lastSlice - 1, (region.y + region.height - 1) / SWAP_SLICE_HEIGHT);
+
+  for (size_t slice = regionFirstSlice; slice <= regionLastSlice; slice++)
+  {
+    const uint8_t *pCoefficients = decode.pUncompressedData + (slice * grid.blocksPerSlice + columnOffset) * grid.blockSize;
+
+    // Planar output is always in the native format of the stream.
+    if (decode.planar)
+    {
+      if (bitDepth > 8)
+        swapReconstructTileSlice(pCoefficients, reinterpret_cast<uint16_t *>(decode.pImage), slice, columnX, region, layout, decode.LdqtHighBitDepth, decode.CdqtHighBitDepth, decode.lossless, bitDepth);
+      else
+        swapReconstructTileSlice(pCoefficients, decode.pImage, slice, columnX, region, layout, decode.Ldqt, decode.Cdqt, decode.lossless, bitDepth);
+
+      continue;
+    }
+
+    // Reconstruct the part of the region covered by this slice of the tile and convert it while it's still in cache.
+    const size_t x0 = std::max(region.x, columnX);
+    const size_t x1 = std::min(region.x + region.width, columnX + grid.tileWidth);
+    const size_t y0 = std::max(region.y, slice * SWAP_SLICE_HEIGHT);
+    const size_t y1 = std::min(region.y + region.height, (slice + 1) * SWAP_SLICE_HEIGHT);
+    const swapRegion strip = { x0, y0, x1 - x0, y1 - y0 };
+    const size_t chromaShiftX = layout.planes[1].shiftX;
+    const size_t chromaShiftY = layout.planes[1].shiftY;
+    const size_t chromaStride = swapGetPlaneSize(strip.width, chromaShiftX);
+    const size_t lumaSize = strip.width * strip.height;
+    const size_t chromaSize = chromaStride * swapGetPlaneSize(strip.height, chromaShiftY);
+    const size_t stripSize = lumaSize * (layout.planeCount > 3 ? 2 : 1) + chromaSize * 2;
+
+    // High bit depth strips are reconstructed behind the 8 bit strip and rounded to 8 bits.
+    swapArenaScope scope;
+    uint8_t *pStrip = swapArenaAlloc(bitDepth > 8 ? stripSize * (1 + sizeof(uint16_t)) : stripSize);
+
+    if (pStrip == nullptr)
+    {
+      decode.allocationFailed = true;
+      return;
+    }
+
+    if (bitDepth > 8)
+    {
+      uint16_t *pStripHighBitDepth = reinterpret_cast<uint16_t *>(pStrip + stripSize);
+
+      swapReconstructTileSlice(pCoefficients, pStripHighBitDepth, slice, columnX, strip, layout, decode.LdqtHighBitDepth, decode.CdqtHighBitDepth, decode.lossless, bitDepth);
+      swapNarrowSamples(pStripHighBitDepth, pStrip, stripSize, bitDepth);
+    }
+    else
+    {
+      swapReconstructTileSlice(pCoefficients, pStrip, slice, columnX, strip, layout, decode.Ldqt, decode.Cdqt, decode.lossless, bitDepth);
+    }
+
+    const size_t outStride = swapGetImageSize(format, region.width, 1);
+    const uint8_t *pStripA = layout.planeCount > 3 ? pStrip + lumaSize + chromaSize * 2 : nullptr;
+
+    swapConvertYUVToRGB(pStrip, pStrip + lumaSize, pStrip + lumaSize + chromaSize, pStripA, strip.width, strip.height, strip.width, chromaStride, strip.width, chromaShiftX, chromaShiftY, decode.pImage + (y0 - region.y) * outStride + swapGetImageSize(format, x0 - region.x, 1), outStride, format, decode.colorSpace);
+  }
+}
+
+static swapResult swapDecodeFrameEnd(const swapFrameDecode &decode)
+{
+  if (decode.tileCorrupted)
+    return sR_InvalidFormat;
+
+  if (decode.allocationFailed)
+    return sR_MemoryAllocationFailure;
+
+  return sR_Success;
+}
+
+// Every tile is processed by a single worker.
+swapResult swapDecodeFrame(IN const uint8_t *pCompressedData, const size_t compressedDataLength, const size_t availableDataLength, const bool progressive, const bool lossless, const size_t frameIndex, const bool isKeyframe, const size_t targetFrameIndex, IN_OUT uint8_t *pUncompressedData, IN_OUT size_t *pTileFrameIndex, OUT uint8_t *pImage, const swapRegion &region, const swapPixelFormat format, const swapColorSpace colorSpace, const swapTileGrid &grid, const uint32_t quality, const uint32_t bitDepth, swapTaskQueue *pQueue)
+{
+  swapResult result = sR_Success;
+  swapFrameDecode decode;
+  swapArenaScope scope;
+
+  if (sR_Success != (result = swapDecodeFrameBegin(pCompressedData, compressedDataLength, availableDataLength, progressive, lossless, frameIndex, isKeyframe, targetFrameIndex, pUncompressedData, pTileFrameIndex, pImage, region, format, colorSpace, grid, quality, bitDepth, swapArenaAllocArray<size_t>(SWAP_PROGRESSIVE_BAND_COUNT * grid.tilesX * grid.tilesY + 1), &decode)))
+    goto epilogue;
+
+  swapParallelFor(pQueue, decode.regionTileCount, [&](const size_t regionTile) { swapDecodeFrameTile(decode, regionTile); });
+
+  result = swapDecodeFrameEnd(decode);
+
+epilogue:
+  return result;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Gathers the `swapSliceHeader`, tile size table and tile data of every row of tiles of a low latency frame at `pRows` into a single tile size table followed by the data of all tiles, like the payload of other frames.
+static swapResult swapGatherSlices(IN const uint8_t *pRows, const size_t size, const swapTileGrid &grid, OUT uint8_t *pPayload, OUT size_t *pPayloadSize)
+{
+  swapResult result = sR_Success;
+  const size_t rowTableSize = grid.tilesX * sizeof(uint32_t);
+  uint8_t *pTileData = pPayload + grid.tilesY * rowTableSize;
+  size_t offset = 0;
+
+  for (size_t row = 0; row < grid.tilesY; row++)
+  {
+    swapSliceHeader sliceHeader;
+
+    if (offset + sizeof(sliceHeader) > size)
+    {
+      result = sR_InvalidFormat;
+      goto epilogue;
+    }
+
+    memcpy(&sliceHeader, pRows + offset, sizeof(sliceHeader));
+    offset += sizeof(sliceHeader);
+
+    if (sliceHeader.magic != swapSliceHeaderMagic || sliceHeader.tileRow != row || sliceHeader.payloadSize < rowTableSize || offset + sliceHeader.payloadSize > size)
+    {
+      result = sR_InvalidFormat;
+      goto epilogue;
+    }
+
+    memcpy(pPayload + row * rowTableSize, pRows + offset, rowTableSize);
+    memcpy(pTileData, pRows + offset + rowTableSize, sliceHeader.payloadSize - rowTableSize);
+
+    pTileData += sliceHeader.payloadSize - rowTableSize;
+    offset += sliceHeader.payloadSize;
+  }
+
+  if (offset != size)
+  {
+    result = sR_InvalidFormat;
+    goto epilogue;
+  }
+
+  *pPayloadSize = (size_t)(pTileData - pPayload);
+
+epilogue:
+  return result;
+}
+
+// Grows the buffers frames are read into to fit frames of `size` bytes. The gathered payload of low latency frames is smaller than their rows, which carry a slice header each.
+static swapResult swapDecoderReserveFrameData(swapDecoder *pDecoder, const size_t size)
+{
+  swapResult result = sR_Success;
+
+  if (size > pDecoder->frameDataCapacity)
+  {
+    uint8_t *pFrameData = (uint8_t *)realloc(pDecoder->pFrameData, size);
+
+    if (pFrameData == nullptr)
+    {
+      result = sR_MemoryAllocationFailure;
+      goto epilogue;
+    }
+
+    pDecoder->pFrameData = pFrameData;
+    pDecoder->frameDataCapacity = size;
+  }
+
+  if (pDecoder->lowLatency && size > pDecoder->sliceDataCapacity)
+  {
+    uint8_t *pSliceData = (uint8_t *)realloc(pDecoder->pSliceData, size);
+
+    if (pSliceData == nullptr)
+    {
+      result = sR_MemoryAllocationFailure;
+      goto epilogue;
+    }
+
+    pDecoder->pSliceData = pSliceData;
+    pDecoder->sliceDataCapacity = size;
+  }
+
+epilogue:
+  return result;
+}
+
+// Sizes the frame buffers for the largest frame of the index right away, so reading frames doesn't allocate.
+static swapResult swapDecoderReserveLargestFrame(swapDecoder *pDecoder)
+{
+  uint64_t largestFrameSize = 0;
+
+  for (const swapIndexEntry &entry : pDecoder->index)
+    largestFrameSize = std::max(largestFrameSize, (uint64_t)entry.size);
+
+  return swapDecoderReserveFrameData(pDecoder, (size_t)largestFrameSize);
+}
+
+static swapResult swapDecoderReadIndex(swapDecoder *pDecoder)
+{
+  swapResult result = sR_Success;
+  swapStreamTrailer trailer;
+  swapIndexHeader indexHeader;
+  int64_t fileSize;
+
+  pDecoder->index.clear();
+
+  if (0 != _fseeki64(pDecoder->pFile, 0, SEEK_END))
+  {
+    result = sR_IOFailure;
+    goto epilogue;
+  }
+
+  fileSize = _ftelli64(pDecoder->pFile);
+
+  if (fileSize >= (int64_t)(sizeof(swapStreamHeader) + sizeof(swapIndexHeader) + sizeof(trailer)))
+  {
+    if (0 == _fseeki64(pDecoder->pFile, fileSize - (int64_t)sizeof(trailer), SEEK_SET) && 1 == fread(&trailer, sizeof(trailer), 1, pDecoder->pFile) && trailer.magic == swapStreamTrailerMagic && trailer.indexOffset + sizeof(indexHeader) + trailer.frameCount * sizeof(swapIndexEntry) + sizeof(trailer) == (uint64_t)fileSize)
+    {
+      if (0 != _fseeki64(pDecoder->pFile, (int64_t)trailer.indexOffset, SEEK_SET) || 1 != fread(&indexHeader, sizeof(indexHeader), 1, pDecoder->pFile) || indexHeader.magic != swapIndexHeaderMagic || indexHeader.frameCount != trailer.frameCount)
+      {
+        result = sR_InvalidFormat;
+        goto epilogue;
+      }
+
+      pDecoder->index.resize(indexHeader.frameCount);
+
+      if (indexHeader.frameCount > 0 && indexHeader.frameCount != fread(pDecoder->index.data(), sizeof(swapIndexEntry), indexHeader.frameCount, pDecoder->pFile))
+      {
+        result = sR_IOFailure;
+        goto epilogue;
+      }
+
+      goto epilogue;
+    }
+  }
+
+  // The stream has not been finalized (or was captured from a pipe), so rebuild the index from the frame headers.
+  {
+    uint64_t offset = sizeof(swapStreamHeader);
+    swapFrameHeader frameHeader;
+    swapSliceHeader sliceHeader;
+    swapTileGrid grid;
+
+    swapGetTileGrid(pDecoder->resX, pDecoder->resY, pDecoder->tileWidth, pDecoder->tileHeight, pDecoder->chromaFormat, pDecoder->alpha, pDecoder->bitDepth, pDecoder->lossless, &grid);
+
+    while (offset + sizeof(frameHeader) <= (uint64_t)fileSize)
+    {
+      if (0 != _fseeki64(pDecoder->pFile, (int64_t)offset, SEEK_SET) || 1 != fread(&frameHeader, sizeof(frameHeader), 1, pDecoder->pFile))
+        break;
+
+      if (frameHeader.magic != swapFrameHeaderMagic || frameHeader.frameIndex != pDecoder->index.size() || offset + sizeof(frameHeader) + frameHeader.payloadSize > (uint64_t)fileSize)
+        break;
+
+      swapIndexEntry entry;
+      entry.offset = offset;
+      entry.size = sizeof(frameHeader) + frameHeader.payloadSize;
+      entry.flags = frameHeader.flags;
+
+      // Rows of tiles of low latency frames carry their own size, so the last frame may have been cut off after any of them.
+      if (pDecoder->lowLatency && (frameHeader.flags & sFF_Repeat) == 0)
+      {
+        size_t row = 0;
+
+        for (; row < grid.tilesY; row++)
+        {
+          if (offset + entry.size + sizeof(sliceHeader) > (uint64_t)fileSize || 1 != fread(&sliceHeader, sizeof(sliceHeader), 1, pDecoder->pFile))
+            break;
+
+          if (sliceHeader.magic != swapSliceHeaderMagic || sliceHeader.tileRow != row || offset + entry.size + sizeof(sliceHeader) + sliceHeader.payloadSize > (uint64_t)fileSize || 0 != _fseeki64(pDecoder->pFile, (int64_t)sliceHeader.payloadSize, SEEK_CUR))
+            break;
+
+          entry.size += sizeof(sliceHeader) + sliceHeader.payloadSize;
+        }
+
+        if (row < grid.tilesY)
+          break;
+      }
+
+      pDecoder->index.push_back(entry);
+
+      offset += entry.size;
+    }
+  }
+
+epilogue:
+  pDecoder->frameCount = pDecoder->index.size();
+
+  return result;
+}
+
+// Reads at most `maxSize` bytes of the frame, which have to include the frame header. Low latency frames are always read entirely and gathered into the layout of other frames.
+static swapResult swapDecoderReadFrame(swapDecoder *pDecoder, const size_t frameIndex, const size_t maxSize)
+{
+  swapResult result = sR_Success;
+  const swapIndexEntry &entry = pDecoder->index[frameIndex];
+  swapFrameHeader *pFrameHeader;
+  size_t readSize;
+
+  if (entry.size < sizeof(swapFrameHeader) || maxSize < sizeof(swapFrameHeader))
+  {
+    result = sR_InvalidFormat;
+    goto epilogue;
+  }
+
+  readSize = pDecoder->lowLatency ? (size_t)entry.size : (size_t)std::min(entry.size, (uint64_t)maxSize);
+
+  if (sR_Success != (result = swapDecoderReserveFrameData(pDecoder, readSize)))
+    goto epilogue;
+
+  if (0 != _fseeki64(pDecoder->pFile, (int64_t)entry.offset, SEEK_SET) || readSize != fread(pDecoder->pFrameData, 1, readSize, pDecoder->pFile))
+  {
+    result = sR_IOFailure;
+    goto epilogue;
+  }
+
+  pDecoder->frameDataSize = readSize;
+  pFrameHeader = reinterpret_cast<swapFrameHeader *>(pDecoder->pFrameData);
+
+  if (pFrameHeader->magic != swapFrameHeaderMagic || pFrameHeader->frameIndex != frameIndex || pFrameHeader->tileCount != pDecoder->tileReferenceFrameIndex.size() || (pDecoder->lowLatency ? pFrameHeader->payloadSize != 0 : pFrameHeader->payloadSize + sizeof(swapFrameHeader) != entry.size))
+  {
+    result = sR_InvalidFormat;
+    goto epilogue;
+  }
+
+  if (pDecoder->lowLatency)
+  {
+    swapTileGrid grid;
+    size_t payloadSize;
+
+    swapGetTileGrid(pDecoder->resX, pDecoder->resY, pDecoder->tileWidth, pDecoder->tileHeight, pDecoder->chromaFormat, pDecoder->alpha, pDecoder->bitDepth, pDecoder->lossless, &grid);
+
+    if (sR_Success != (result = swapGatherSlices(pDecoder->pFrameData + sizeof(swapFrameHeader), readSize - sizeof(swapFrameHeader), grid, pDecoder->pSliceData, &payloadSize)))
+      goto epilogue;
+
+    swapMemcpy(pDecoder->pFrameData + sizeof(swapFrameHeader), pDecoder->pSliceData, payloadSize);
+
+    pFrameHeader->payloadSize = payloadSize;
+    pDecoder->frameDataSize = sizeof(swapFrameHeader) + payloadSize;
+  }
+
+epilogue:
+  return result;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// While decoding up to a requested frame, the reference coefficients of every n-th frame after the keyframe are cached, so stepping backwards only re-decodes a few frames.
+#define SWAP_FRAME_CACHE_REFERENCE_INTERVAL 4
+
+enum swapFrameCacheEntryType
+{
+  sFCET_Picture,
+  sFCET_Reference,
+};
+
+struct swapFrameCacheEntry
+{
+  size_t frameIndex;
+  swapFrameCacheEntryType type;
+  uint8_t *pData;
+  size_t size;
+};
+
+struct swapFrameCache
+{
+  size_t memoryBudget = 0;
+  size_t memoryUsed = 0;
+
+  // Most recently used entries first.
+  std::list<swapFrameCacheEntry> entries;
+  std::unordered_map<uint64_t, std::list<swapFrameCacheEntry>::iterator> lookup;
+
+  ~swapFrameCache()
+  {
+    for (swapFrameCacheEntry &entry : entries)
+      free(entry.pData);
+  }
+};
+
+static void swapFrameCacheClear(swapFrameCache *pCache)
+{
+  for (swapFrameCacheEntry &entry : pCache->entries)
+    free(entry.pData);
+
+  pCache->entries.clear();
+  pCache->lookup.clear();
+  pCache->memoryUsed = 0;
+}
+
+static uint64_t swapFrameCacheKey(const size_t frameIndex, const swapFrameCacheEntryType type)
+{
+  return ((uint64_t)frameIndex << 1) | (uint64_t)type;
+}
+
+static const swapFrameCacheEntry * swapFrameCacheFind(swapFrameCache *pCache, const size_t frameIndex, const swapFrameCacheEntryType type)
+{
+  auto it = pCache->lookup.find(swapFrameCacheKey(frameIndex, type));
+
+  if (it == pCache->lookup.end())
+    return nullptr;
+
+  pCache->entries.splice(pCache->entries.begin(), pCache->entries, it->second);
+
+  return &*it->second;
+}
+
+static void swapFrameCacheInsert(swapFrameCache *pCache, const size_t frameIndex, const swapFrameCacheEntryType type, IN const uint8_t *pData, const size_t size)
+{
+  if (size > pCache->memoryBudget || pCache->lookup.find(swapFrameCacheKey(frameIndex, type)) != pCache->lookup.end())
+    return;
+
+  uint8_t *pEntryData = nullptr;
+
+  // Evict the least recently used entries, recycling a buffer of matching size if possible.
+  while (pCache->memoryUsed + size > pCache->memoryBudget)
+  {
+    swapFrameCacheEntry &entry = pCache->entries.back();
+
+    if (pEntryData == nullptr && entry.size == size)
+      pEntryData = entry.pData;
+    else
+      free(entry.pData);
+
+    pCache->memoryUsed -= entry.size;
+    pCache->lookup.erase(swapFrameCacheKey(entry.frameIndex, entry.type));
+    pCache->entries.pop_back();
+  }
+
+  if (pEntryData == nullptr)
+    pEntryData = (uint8_t *)malloc(size);
+
+  if (pEntryData == nullptr)
+    return;
+
+  swapMemcpy(pEntryData, pData, size);
+
+  swapFrameCacheEntry entry;
+  entry.frameIndex = frameIndex;
+  entry.type = type;
+  entry.pData = pEntryData;
+  entry.size = size;
+
+  pCache->entries.push_front(entry);
+  pCache->lookup[swapFrameCacheKey(frameIndex, type)] = pCache->entries.begin();
+  pCache->memoryUsed += size;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Copies the coefficients of `tile`, which are spread over the slices it covers.
+static void swapCopyTileCoefficients(OUT uint8_t *pDestination, IN const uint8_t *pSource, const swapTileGrid &grid, const size_t tile)
+{
+  const size_t column = tile % grid.tilesX;
+  const size_t firstSlice = (tile / grid.tilesX) * grid.slicesPerTile;
+  const size_t lastSlice = std::min(firstSlice + grid.slicesPerTile, grid.sliceCount);
+  const size_t size = swapGetTileColumnLayout(grid, column).blocksPerSlice * grid.blockSize;
+
+  for (size_t slice = firstSlice; slice < lastSlice; slice++)
+  {
+    const size_t offset = (slice * grid.blocksPerSlice + swapGetTileColumnOffset(grid, column)) * grid.blockSize;
+    swapMemcpy(pDestination + offset, pSource + offset, size);
+  }
+}
+
+// A decode of a region, taken apart like `swapFrameDecode` so the frames leading up to it can be decoded by tasks that don't wait for each other: `swapRegionDecodeBegin` prepares it,
+// `swapRegionDecodeNextFrame` prepares the next frame to be decoded, whose tiles are decoded with `swapDecodeFrameTile` before `swapRegionDecodeEndFrame`, and `swapRegionDecodeEnd` returns the result.
+struct swapRegionDecode
+{
+  size_t frameIndex;
+  swapRegion region;
+  uint8_t *pImage;
+  size_t maxFrameSize;
+  swapTileGrid grid;
+  bool isFullFrame;
+  bool isPartial;
+  swapFrameCache *pCache;
+  size_t keyframeIndex;
+  size_t nextFrameIndex;
+  bool imageDecoded;
+
+  size_t *pRegionTiles; // `tilesX * tilesY` entries provided by the caller.
+  size_t regionTileCount;
+
+  size_t *pTileOffsets; // see `swapFrameDecode`.
+  swapFrameDecode frame;
+};
+
+// Only the first `maxFrameSize` bytes of every frame are read if it's not `(size_t)-1`. As that leaves out coefficients, these decodes start at the keyframe, don't use the frame cache and don't keep a reference.
+// Repeated frames are resolved to the frame they repeat, which is served from the cache or the current coefficients if it was decoded last.
+static swapResult swapRegionDecodeBegin(swapDecoder *pDecoder, size_t frameIndex, const swapRegion &region, OUT uint8_t *pImage, const size_t maxFrameSize, OUT size_t *pRegionTiles, OUT size_t *pTileOffsets, OUT swapRegionDecode *pDecode)
+{
+  swapResult result = sR_Success;
+  size_t firstFrameIndex;
+
+  const std::vector<swapIndexEntry> &index = pDecoder->index;
+  std::vector<size_t> &tileFrameIndex = pDecoder->tileReferenceFrameIndex;
+  const swapTileGrid &grid = pDecode->grid;
+
+  while (frameIndex > 0 && (index[frameIndex].flags & sFF_Repeat) != 0)
+    frameIndex--;
+
+  swapGetTileGrid(pDecoder->resX, pDecoder->resY, pDecoder->tileWidth, pDecoder->tileHeight, pDecoder->chromaFormat, pDecoder->alpha, pDecoder->bitDepth, pDecoder->lossless, &pDecode->grid);
+
+  pDecode->frameIndex = frameIndex;
+  pDecode->region = region;
+  pDecode->pImage = pImage;
+  pDecode->maxFrameSize = maxFrameSize;
+  pDecode->isFullFrame = region.x == 0 && region.y == 0 && region.width == pDecoder->resX && region.height == pDecoder->resY;
+  pDecode->isPartial = maxFrameSize != (size_t)-1;
+  pDecode->pCache = pDecode->isPartial ? nullptr : (swapFrameCache *)pDecoder->pFrameCache;
+  pDecode->keyframeIndex = frameIndex;
+  pDecode->nextFrameIndex = frameIndex + 1;
+  pDecode->imageDecoded = false;
+  pDecode->pRegionTiles = pRegionTiles;
+  pDecode->regionTileCount = 0;
+  pDecode->pTileOffsets = pTileOffsets;
+
+  firstFrameIndex = frameIndex + 1;
+
+  if (pDecode->pCache != nullptr && pDecode->isFullFrame)
+  {
+    const swapFrameCacheEntry *pPicture = swapFrameCacheFind(pDecode->pCache, frameIndex, sFCET_Picture);
+
+    if (pPicture != nullptr)
+    {
+      swapMemcpy(pImage, pPicture->pData, swapGetImageSize(pDecoder->outputFormat, pDecoder->resX, pDecoder->resY));
+
+      // Nothing is left to decode and the picture isn't cached again.
+      pDecode->imageDecoded = true;
+      pDecode->pCache = nullptr;
+      goto epilogue;
+    }
+  }
+
+  while (pDecode->keyframeIndex > 0 && (index[pDecode->keyframeIndex].flags & sFF_Keyframe) == 0)
+    pDecode->keyframeIndex--;
+
+  if ((index[pDecode->keyframeIndex].flags & sFF_Keyframe) == 0)
+  {
+    result = sR_InvalidFormat;
+    goto epilogue;
+  }
+
+  if (pRegionTiles == nullptr)
+  {
+    result = sR_MemoryAllocationFailure;
+    goto epilogue;
+  }
+
+  for (size_t tileY = region.y / grid.tileHeight; tileY <= (region.y + region.height - 1) / grid.tileHeight; tileY++)
+    for (size_t column = region.x / grid.tileWidth; column <= (region.x + region.width - 1) / grid.tileWidth; column++)
+      pRegionTiles[pDecode->regionTileCount++] = tileY * grid.tilesX + column;
+
+  if (pDecode->isPartial)
+    std::fill(tileFrameIndex.begin(), tileFrameIndex.end(), (size_t)-1);
+
+  // Tiles continue from their current coefficients if they're part of the same group of pictures, otherwise they start at the keyframe.
+  for (size_t r = 0; r < pDecode->regionTileCount; r++)
+  {
+    const size_t tile = pRegionTiles[r];
+
+    if (tileFrameIndex[tile] != (size_t)-1 && tileFrameIndex[tile] >= pDecode->keyframeIndex && tileFrameIndex[tile] <= frameIndex)
+      firstFrameIndex = std::min(firstFrameIndex, tileFrameIndex[tile] + 1);
+    else
+      firstFrameIndex = pDecode->keyframeIndex;
+  }
+
+  // Start from the closest cached reference of this group of pictures if it's closer.
+  if (pDecode->pCache != nullptr)
+  {
+    for (size_t i = frameIndex; i >= firstFrameIndex && i != (size_t)-1; i--)
+    {
+      const swapFrameCacheEntry *pReference = swapFrameCacheFind(pDecode->pCache, i, sFCET_Reference);
+
+      if (pReference != nullptr)
+      {
+        for (size_t r = 0; r < pDecode->regionTileCount; r++)
+        {
+          const size_t tile = pRegionTiles[r];
+
+          if (tileFrameIndex[tile] == (size_t)-1 || tileFrameIndex[tile] < i || tileFrameIndex[tile] > frameIndex)
+          {
+            swapCopyTileCoefficients(pDecoder->pReferenceData, pReference->pData, grid, tile);
+            tileFrameIndex[tile] = i;
+          }
+        }
+
+        firstFrameIndex = i + 1;
+        break;
+      }
+    }
+  }
+
+  pDecode->nextFrameIndex = firstFrameIndex;
+
+epilogue:
+  return result;
+}
+
+// Sets `*pHasFrame` if `pDecode->frame` has been prepared for its tiles to be decoded, otherwise the region is done.
+static swapResult swapRegionDecodeNextFrame(swapDecoder *pDecoder, IN_OUT swapRegionDecode *pDecode, OUT bool *pHasFrame)
+{
+  swapResult result = sR_Success;
+  std::vector<size_t> &tileFrameIndex = pDecoder->tileReferenceFrameIndex;
+
+  *pHasFrame = false;
+
+  while (pDecode->nextFrameIndex <= pDecode->frameIndex)
+  {
+    const size_t i = pDecode->nextFrameIndex++;
+
+    // Repeated frames carry the coefficients of their predecessor over.
+    if ((pDecoder->index[i].flags & sFF_Repeat) != 0)
+    {
+      for (size_t r = 0; r < pDecode->regionTileCount; r++)
+        if (tileFrameIndex[pDecode->pRegionTiles[r]] + 1 == i)
+          tileFrameIndex[pDecode->pRegionTiles[r]] = i;
+
+      continue;
+    }
+
+    if (sR_Success != (result = swapDecoderReadFrame(pDecoder, i, pDecode->maxFrameSize)))
+      goto epilogue;
+
+    const swapFrameHeader *pFrameHeader = reinterpret_cast<const swapFrameHeader *>(pDecoder->pFrameData);
+
+    // Frames leading up to the requested one only need to be entropy decoded.
+    if (sR_Success != (result = swapDecodeFrameBegin(pDecoder->pFrameData + sizeof(swapFrameHeader), (size_t)pFrameHeader->payloadSize, pDecoder->frameDataSize - sizeof(swapFrameHeader), pDecoder->progressive, pDecoder->lossless, i, (pFrameHeader->flags & sFF_Keyframe) != 0, pDecode->frameIndex, pDecoder->pReferenceData, tileFrameIndex.data(), i == pDecode->frameIndex ? pDecode->pImage : nullptr, pDecode->region, pDecoder->outputFormat, pDecoder->colorSpace, pDecode->grid, pDecoder->quality, pDecoder->bitDepth, pDecode->pTileOffsets, &pDecode->frame)))
+      goto epilogue;
+
+    pDecode->imageDecoded = i == pDecode->frameIndex;
+    *pHasFrame = true;
+    goto epilogue;
+  }
+
+  // All tiles were already decoded up to the requested frame.
+  if (!pDecode->imageDecoded)
+  {
+    if (sR_Success != (result = swapDecodeFrameBegin(nullptr, 0, 0, pDecoder->progressive, pDecoder->lossless, pDecode->frameIndex, false, pDecode->frameIndex, pDecoder->pReferenceData, tileFrameIndex.data(), pDecode->pImage, pDecode->region, pDecoder->outputFormat, pDecoder->colorSpace, pDecode->grid, pDecoder->quality, pDecoder->bitDepth, pDecode->pTileOffsets, &pDecode->frame)))
+      goto epilogue;
+
+    pDecode->imageDecoded = true;
+    *pHasFrame = true;
+  }
+
+epilogue:
+  return result;
+}
+
+static swapResult swapRegionDecodeEndFrame(swapDecoder *pDecoder, IN_OUT swapRegionDecode *pDecode)
+{
+  swapResult result = sR_Success;
+  const std::vector<size_t> &tileFrameIndex = pDecoder->tileReferenceFrameIndex;
+  const size_t i = pDecode->frame.frameIndex;
+
+  if (sR_Success != (result = swapDecodeFrameEnd(pDecode->frame)))
+    goto epilogue;
+
+  if (pDecode->pCache != nullptr && pDecode->isFullFrame && i != pDecode->frameIndex && ((i - pDecode->keyframeIndex) % SWAP_FRAME_CACHE_REFERENCE_INTERVAL) == 0 && std::all_of(tileFrameIndex.begin(), tileFrameIndex.end(), [i](const size_t t) { return t == i; }))
+    swapFrameCacheInsert(pDecode->pCache, i, sFCET_Reference, pDecoder->pReferenceData, pDecode->grid.sliceCount * pDecode->grid.blocksPerSlice * pDecode->grid.blockSize);
+
+epilogue:
+  return result;
+}
+
+// Takes the result of the decode so far.
+static swapResult swapRegionDecodeEnd(swapDecoder *pDecoder, IN_OUT swapRegionDecode *pDecode, const swapResult result)
+{
+  if (result == sR_Success && pDecode->pCache != nullptr && pDecode->isFullFrame)
+    swapFrameCacheInsert(pDecode->pCache, pDecode->frameIndex, sFCET_Picture, pDecode->pImage, swapGetImageSize(pDecoder->outputFormat, pDecoder->resX, pDecoder->resY));
+
+  if (pDecode->isPartial)
+    std::fill(pDecoder->tileReferenceFrameIndex.begin(), pDecoder->tileReferenceFrameIndex.end(), (size_t)-1);
+
+  return result;
+}
+
+static swapResult swapDecoderDecodeRegion(swapDecoder *pDecoder, const size_t frameIndex, const swapRegion &region, OUT uint8_t *pImage, const size_t maxFrameSize = (size_t)-1)
+{
+  swapResult result = sR_Success;
+  swapRegionDecode decode;
+  bool hasFrame;
+  swapTileGrid grid;
+  swapArenaScope scope;
+
+  swapGetTileGrid(pDecoder->resX, pDecoder->resY, pDecoder->tileWidth, pDecoder->tileHeight, pDecoder->chromaFormat, pDecoder->alpha, pDecoder->bitDepth, pDecoder->lossless, &grid);
+
+  if (sR_Success != (result = swapRegionDecodeBegin(pDecoder, frameIndex, region, pImage, maxFrameSize, swapArenaAllocArray<size_t>(grid.tilesX * grid.tilesY), swapArenaAllocArray<size_t>(SWAP_PROGRESSIVE_BAND_COUNT * grid.tilesX * grid.tilesY + 1), &decode)))
+    goto epilogue;
+
+  while (true)
+  {
+    if (sR_Success != (result = swapRegionDecodeNextFrame(pDecoder, &decode, &hasFrame)) || !hasFrame)
+      goto epilogue;
+
+    swapParallelFor((swapTaskQueue *)pDecoder->pTaskQueue, decode.frame.regionTileCount, [&](const size_t regionTile) { swapDecodeFrameTile(decode.frame, regionTile); });
+
+    if (sR_Success != (result = swapRegionDecodeEndFrame(pDecoder, &decode)))
+      goto epilogue;
+  }
+
+epilogue:
+  return swapRegionDecodeEnd(pDecoder, &decode, result);
+}
+
+static swapResult swapDecoderDecodeFrame(swapDecoder *pDecoder, const size_t frameIndex, OUT uint8_t *pFrame)
+{
+  const swapRegion frame = { 0, 0, pDecoder->resX, pDecoder->resY };
+
+  return swapDecoderDecodeRegion(pDecoder, frameIndex, frame, pFrame);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+enum swapReadAheadSlotState
+{
+  sRASS_Free,
+  sRASS_Decoding,
+  sRASS_Ready,
+  sRASS_Acquired,
+};
+
+struct swapReadAheadSlot
+{
+  uint8_t *pFrame = nullptr;
+  size_t frameIndex = 0;
+  swapReadAheadSlotState state = sRASS_Free;
+  swapResult result = sR_Success;
+};
+
+struct swapReadAhead
+{
+  std::vector<swapReadAheadSlot> slots;
+  size_t readAheadFrameCount = 0;
+  size_t nextFrameIndex = 0;
+
+  // Incremented whenever the consumer seeks. Frames decoded for an older generation are discarded.
+  size_t generation = 0;
+  bool stop = false;
+
+  std::mutex mutex;
+  std::condition_variable condition;
+
+  // Serializes access to the file and the reference coefficients between the read-ahead thread and `DecodeFrame`.
+  std::mutex decodeMutex;
+
+  std::thread thread;
+};
+
+static void swapReadAheadThread(swapDecoder *pDecoder, swapReadAhead *pReadAhead)
+{
+  std::unique_lock<std::mutex> lock(pReadAhead->mutex);
+
+  while (!pReadAhead->stop)
+  {
+    swapReadAheadSlot *pSlot = nullptr;
+    size_t pendingFrameCount = 0;
+
+    for (swapReadAheadSlot &slot : pReadAhead->slots)
+    {
+      if (slot.state == sRASS_Free)
+        pSlot = &slot;
+      else if (slot.state == sRASS_Decoding || slot.state == sRASS_Ready)
+        pendingFrameCount++;
+    }
+
+    if (pSlot == nullptr || pendingFrameCount >= pReadAhead->readAheadFrameCount || pReadAhead->nextFrameIndex >= pDecoder->frameCount)
+    {
+      pReadAhead->condition.wait(lock);
+      continue;
+    }
+
+    const size_t frameIndex = pReadAhead->nextFrameIndex++;
+    const size_t generation = pReadAhead->generation;
+
+    pSlot->frameIndex = frameIndex;
+    pSlot->state = sRASS_Decoding;
+
+    lock.unlock();
+
+    swapResult result;
+
+    {
+      std::lock_guard<std::mutex> decodeLock(pReadAhead->decodeMutex);
+      result = swapDecoderDecodeFrame(pDecoder, frameIndex, pSlot->pFrame);
+    }
+
+    lock.lock();
+
+    if (generation != pReadAhead->generation)
+    {
+      pSlot->state = sRASS_Free;
+    }
+    else
+    {
+      pSlot->state = sRASS_Ready;
+      pSlot->result = result;
+    }
+
+    pReadAhead->condition.notify_all();
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Frames queued with `DecodeFrameAsync` and `DecodeNextAsync` are decoded one after the other by tasks of the decoder, with one task per tile. The task finishing the last tile of a frame moves on to the next frame
+// of the region decode or, once the decode is done, notifies about it and begins the next queued decode, so no thread waits for the tiles.
+struct swapDecodeSubmitQueue
+{
+  struct swapSubmission
+  {
+    size_t frameIndex; // `(size_t)-1` for the next frame.
+    uint8_t *pFrame;
+    void (*pOnDecoded)(void *pUserData, const size_t frameIndex, const swapResult result);
+    void *pUserData;
+  };
+
+  swapQueue<swapSubmission> submissions;
+
+  // Set from the first queued frame until the queue is empty again.
+  bool processing = false;
+
+  // The decode in progress, only touched by the task running it.
+  swapSubmission submission;
+  size_t frameIndex = 0;
+  bool decodeBegun = false;
+  swapRegionDecode decode;
+  std::vector<size_t> regionTiles;
+  std::vector<size_t> tileOffsets;
+  std::atomic<size_t> tilesLeft;
+
+  // The thread running a notification, which decodes the remaining frames itself rather than waiting for itself.
+  std::thread::id notifyingThread;
+
+  // Set if the decoder was destroyed by a notification, after which the task running it deletes the queue.
+  bool orphaned = false;
+
+  std::mutex mutex;
+  std::condition_variable condition;
+};
+
+// Returns `false` if the decoder was destroyed by the notification.
+static bool swapDecodeSubmitQueueNotify(swapDecodeSubmitQueue *pSubmitQueue, const swapDecodeSubmitQueue::swapSubmission &submission, const size_t frameIndex, const swapResult result)
+{
+  std::thread::id previousThread;
+
+  if (submission.pOnDecoded == nullptr)
+    return true;
+
+  {
+    std::lock_guard<std::mutex> lock(pSubmitQueue->mutex);
+    previousThread = pSubmitQueue->notifyingThread;
+    pSubmitQueue->notifyingThread = std::this_thread::get_id();
+  }
+
+  submission.pOnDecoded(submission.pUserData, frameIndex, result);
+
+  std::lock_guard<std::mutex> lock(pSubmitQueue->mutex);
+  pSubmitQueue->notifyingThread = previousThread;
+
+  return !pSubmitQueue->orphaned;
+}
+
+static void swapDecodeSubmitQueueProceed(swapDecoder *pDecoder, const bool frameDecoded);
+
+static void swapDecodeSubmitQueueTileTask(void *pContext, const size_t regionTile)
+{
+  swapDecoder *pDecoder = reinterpret_cast<swapDecoder *>(pContext);
+  swapDecodeSubmitQueue *pSubmitQueue = (swapDecodeSubmitQueue *)pDecoder->pSubmitQueue;
+
+  swapDecodeFrameTile(pSubmitQueue->decode.frame, regionTile);
+
+  if (--pSubmitQueue->tilesLeft == 0)
+    swapDecodeSubmitQueueProceed(pDecoder, true);
+}
+
+// Runs the queued decodes until the tiles of a frame have been queued or no decodes are left. `frameDecoded` is set if all tiles of the current frame have just been decoded.
+static void swapDecodeSubmitQueueProceed(swapDecoder *pDecoder, const bool frameDecoded)
+{
+  swapDecodeSubmitQueue *pSubmitQueue = (swapDecodeSubmitQueue *)pDecoder->pSubmitQueue;
+  swapResult result = sR_Success;
+  bool hasFrame = false;
+
+  if (frameDecoded)
+    result = swapRegionDecodeEndFrame(pDecoder, &pSubmitQueue->decode);
+
+  while (true)
+  {
+    if (!pSubmitQueue->decodeBegun)
+    {
+      {
+        std::lock_guard<std::mutex> lock(pSubmitQueue->mutex);
+
+        if (pSubmitQueue->submissions.empty())
+        {
+          pSubmitQueue->processing = false;
+          pSubmitQueue->condition.notify_all();
+          return;
+        }
+
+        pSubmitQueue->submission = pSubmitQueue->submissions.front();
+        pSubmitQueue->submissions.pop_front();
+      }
+
+      pSubmitQueue->frameIndex = pSubmitQueue->submission.frameIndex == (size_t)-1 ? pDecoder->currentFrameIndex : pSubmitQueue->submission.frameIndex;
+
+      if (pSubmitQueue->frameIndex >= pDecoder->frameCount)
+      {
+        result = sR_EndOfStream;
+      }
+      else
+      {
+        const swapRegion frame = { 0, 0, pDecoder->resX, pDecoder->resY };
+        const size_t tileCount = pDecoder->tileReferenceFrameIndex.size();
+
+        pSubmitQueue->regionTiles.resize(tileCount);
+        pSubmitQueue->tileOffsets.resize(SWAP_PROGRESSIVE_BAND_COUNT * tileCount + 1);
+        pSubmitQueue->decodeBegun = true;
+
+        result = swapRegionDecodeBegin(pDecoder, pSubmitQueue->frameIndex, frame, pSubmitQueue->submission.pFrame, (size_t)-1, pSubmitQueue->regionTiles.data(), pSubmitQueue->tileOffsets.data(), &pSubmitQueue->decode);
+      }
+    }
+
+    if (result == sR_Success)
+      result = swapRegionDecodeNextFrame(pDecoder, &pSubmitQueue->decode, &hasFrame);
+
+    if (result == sR_Success && hasFrame)
+    {
+      pSubmitQueue->tilesLeft = pSubmitQueue->decode.frame.regionTileCount;
+
+      for (size_t regionTile = 0; regionTile < pSubmitQueue->decode.frame.regionTileCount; regionTile++)
+        swapEnqueueTask((swapTaskQueue *)pDecoder->pTaskQueue, swapDecodeSubmitQueueTileTask, pDecoder, regionTile);
+
+      return;
+    }
+
+    if (pSubmitQueue->decodeBegun)
+      result = swapRegionDecodeEnd(pDecoder, &pSubmitQueue->decode, result);
+
+    if (result == sR_Success)
+      pDecoder->currentFrameIndex = pSubmitQueue->frameIndex + 1;
+
+    pSubmitQueue->decodeBegun = false;
+
+    // The decoder is done with the frame, so the notification may close the stream or destroy the decoder.
+    if (!swapDecodeSubmitQueueNotify(pSubmitQueue, pSubmitQueue->submission, pSubmitQueue->frameIndex, result))
+    {
+      delete pSubmitQueue;
+      return;
+    }
+
+    result = sR_Success;
+  }
+}
+
+// Other threads wait for the last notification. A notification decodes the remaining frames itself on its own thread.
+static void swapDecodeSubmitQueueWait(swapDecoder *pDecoder, swapDecodeSubmitQueue *pSubmitQueue)
+{
+  std::unique_lock<std::mutex> lock(pSubmitQueue->mutex);
+
+  if (pSubmitQueue->notifyingThread == std::this_thread::get_id())
+  {
+    while (!pSubmitQueue->submissions.empty())
+    {
+      const swapDecodeSubmitQueue::swapSubmission submission = pSubmitQueue->submissions.front();
+      pSubmitQueue->submissions.pop_front();
+
+      lock.unlock();
+
+      const size_t frameIndex = submission.frameIndex == (size_t)-1 ? pDecoder->currentFrameIndex : submission.frameIndex;
+      const swapResult result = submission.frameIndex == (size_t)-1 ? pDecoder->DecodeNext(submission.pFrame) : pDecoder->DecodeFrame(submission.frameIndex, submission.pFrame);
+
+      if (!swapDecodeSubmitQueueNotify(pSubmitQueue, submission, frameIndex, result))
+        return;
+
+      lock.lock();
+    }
+
+    return;
+  }
+
+  while (pSubmitQueue->processing)
+    pSubmitQueue->condition.wait(lock);
+}
+
+static swapResult swapDecoderSubmit(swapDecoder *pDecoder, const swapDecodeSubmitQueue::swapSubmission &submission)
+{
+  swapDecodeSubmitQueue *pSubmitQueue = (swapDecodeSubmitQueue *)pDecoder->pSubmitQueue;
+  bool start;
+
+  {
+    std::lock_guard<std::mutex> lock(pSubmitQueue->mutex);
+
+    pSubmitQueue->submissions.push_back(submission);
+
+    start = !pSubmitQueue->processing;
+    pSubmitQueue->processing = true;
+  }
+
+  // Frames queued while others are processed are picked up by the task finishing the previous frame.
+  if (start)
+    swapEnqueueTask((swapTaskQueue *)pDecoder->pTaskQueue, [](void *pContext, const size_t) { swapDecodeSubmitQueueProceed(reinterpret_cast<swapDecoder *>(pContext), false); }, pDecoder, 0);
+
+  return sR_Success;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+struct swapPushState
+{
+  swapPushCallbacks callbacks;
+
+  // Pushed data that hasn't been decoded yet starts at `consumed`.
+  std::vector<uint8_t> pending;
+  size_t consumed = 0;
+
+  bool streamHeaderParsed = false;
+  bool frameHeaderParsed = false;
+  bool ended = false;
+  swapFrameHeader frameHeader;
+  size_t nextFrameIndex = 0;
+  size_t nextTileRow = 0;
+
+  std::vector<uint8_t> payload;
+  std::vector<uint8_t> lines;
+};
+
+swapDecoder * swapcodec::swapDecoder::Create(IN swapThreadPool *pThreadPool, const swapPriority priority)
+{
+  swapDecoder *pDecoder = new swapDecoder();
+
+  if (pDecoder == nullptr)
+    goto epilogue;
+
+  pDecoder->pTaskQueue = swapCreateTaskQueue(pThreadPool, priority);
+
+  if (pDecoder->pTaskQueue == nullptr)
+    goto epilogue;
+
+  pDecoder->pSubmitQueue = new swapDecodeSubmitQueue();
+
+  if (pDecoder->pSubmitQueue == nullptr)
+    goto epilogue;
+
+  return pDecoder;
+
+epilogue:
+  if (pDecoder)
+    delete pDecoder;
+
+  return nullptr;
+}
+
+swapcodec::swapDecoder::~swapDecoder()
+{
+  // Queued frames are decoded before the decoder goes away.
+  if (pSubmitQueue)
+  {
+    swapDecodeSubmitQueue *pQueue = (swapDecodeSubmitQueue *)pSubmitQueue;
+
+    swapDecodeSubmitQueueWait(this, pQueue);
+
+    // Destroyed by a notification, so the task running it deletes the queue once the notification returns.
+    std::unique_lock<std::mutex> lock(pQueue->mutex);
+
+    if (pQueue->notifyingThread == std::this_thread::get_id())
+    {
+      pQueue->orphaned = true;
+    }
+    else
+    {
+      lock.unlock();
+      delete pQueue;
+    }
+  }
+
+  DisableReadAhead();
+  DisableFrameCache();
+
+  if (pFile)
+    fclose(pFile);
+
+  if (pFrameData)
+    free(pFrameData);
+
+  if (pSliceData)
+    free(pSliceData);
+
+  if (pReferenceData)
+    free(pReferenceData);
+
+  if (pPush)
+    delete (swapPushState *)pPush;
+
+  if (pTaskQueue)
+    swapDestroyTaskQueue((swapTaskQueue *)pTaskQueue);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Closes the current stream, whether it was opened or pushed.
+static void swapDecoderCloseStream(swapDecoder *pDecoder)
+{
+  if (pDecoder->pSubmitQueue)
+    swapDecodeSubmitQueueWait(pDecoder, (swapDecodeSubmitQueue *)pDecoder->pSubmitQueue);
+
+  pDecoder->DisableReadAhead();
+
+  // Cached frames belong to the previous stream.
+  if (pDecoder->pFrameCache)
+    swapFrameCacheClear((swapFrameCache *)pDecoder->pFrameCache);
+
+  if (pDecoder->pFile)
+  {
+    fclose(pDecoder->pFile);
+    pDecoder->pFile = nullptr;
+  }
+
+  if (pDecoder->pPush)
+  {
+    delete (swapPushState *)pDecoder->pPush;
+    pDecoder->pPush = nullptr;
+  }
+
+  if (pDecoder->pReferenceData)
+  {
+    free(pDecoder->pReferenceData);
+    pDecoder->pReferenceData = nullptr;
+  }
+
+  pDecoder->index.clear();
+  pDecoder->frameCount = 0;
+  pDecoder->currentFrameIndex = 0;
+  pDecoder->tileReferenceFrameIndex.clear();
+}
+
+// Takes the properties of the stream from its header and allocates the reference coefficients.
+static swapResult swapDecoderInitStream(swapDecoder *pDecoder, const swapStreamHeader &header)
+{
+  swapResult result = sR_Success;
+  swapTileGrid grid;
+  swapChromaFormat outputChromaFormat;
+  bool outputAlpha;
+  size_t outputBytesPerSample;
+
+  if (header.magic != swapStreamHeaderMagic || header.version != swapStreamVersion || header.resX == 0 || header.resY == 0 || header.bitDepth < 8 || header.bitDepth > 16 || header.chromaFormat > sCF_444 || header.tileWidth == 0 || (header.tileWidth & 15) != 0 || header.tileHeight == 0 || (header.tileHeight % SWAP_SLICE_HEIGHT) != 0 || ((header.flags & sSF_LowLatency) != 0 && (header.flags & sSF_Progressive) != 0))
+  {
+    result = sR_InvalidFormat;
+    goto epilogue;
+  }
+
+  pDecoder->resX = header.resX;
+  pDecoder->resY = header.resY;
+  pDecoder->lowResX = pDecoder->resX << 3;
+  pDecoder->lowResY = pDecoder->resY << 4;
+  pDecoder->iframeStep = header.iframeStep;
+  pDecoder->quality = header.quality;
+  pDecoder->bitDepth = header.bitDepth;
+  pDecoder->chromaFormat = (swapChromaFormat)header.chromaFormat;
+  pDecoder->alpha = (header.flags & sSF_Alpha) != 0;
+  pDecoder->progressive = (header.flags & sSF_Progressive) != 0;
+  pDecoder->lossless = (header.flags & sSF_Lossless) != 0;
+  pDecoder->lowLatency = (header.flags & sSF_LowLatency) != 0;
+  pDecoder->tileWidth = header.tileWidth;
+  pDecoder->tileHeight = header.tileHeight;
+
+  if (swapGetPlanarFormatInfo(pDecoder->outputFormat, &outputChromaFormat, &outputAlpha, &outputBytesPerSample))
+    pDecoder->outputFormat = swapGetPlanarFormat(pDecoder->chromaFormat, pDecoder->alpha, pDecoder->bitDepth);
+
+  swapGetTileGrid(pDecoder->resX, pDecoder->resY, pDecoder->tileWidth, pDecoder->tileHeight, pDecoder->chromaFormat, pDecoder->alpha, pDecoder->bitDepth, pDecoder->lossless, &grid);
+
+  pDecoder->pReferenceData = (uint8_t *)malloc(sizeof(uint8_t) * (grid.sliceCount * grid.blocksPerSlice * grid.blockSize));
+
+  if (pDecoder->pReferenceData == nullptr)
+  {
+    result = sR_MemoryAllocationFailure;
+    goto epilogue;
+  }
+
+  swapFirstTouch((swapTaskQueue *)pDecoder->pTaskQueue, pDecoder->pReferenceData, grid.sliceCount * grid.blocksPerSlice * grid.blockSize);
+
+  pDecoder->tileReferenceFrameIndex.resize(grid.tilesX * grid.tilesY, (size_t)-1);
+
+epilogue:
+  return result;
+}
+
+swapResult swapcodec::swapDecoder::Open(const std::string &fileName)
+{
+  swapResult result = sR_Success;
+  swapStreamHeader header;
+
+  swapDecoderCloseStream(this);
+
+  filename = fileName;
+  pFile = fopen(filename.c_str(), "rb");
+
+  if (pFile == nullptr)
+  {
+    result = sR_IOFailure;
+    goto epilogue;
+  }
+
+  if (1 != fread(&header, sizeof(header), 1, pFile))
+  {
+    result = sR_IOFailure;
+    goto epilogue;
+  }
+
+  if (sR_Success != (result = swapDecoderInitStream(this, header)))
+    goto epilogue;
+
+  if (sR_Success != (result = swapDecoderReadIndex(this)))
+    goto epilogue;
+
+  if (sR_Success != (result = swapDecoderReserveLargestFrame(this)))
+    goto epilogue;
+
+epilogue:
+  if (result != sR_Success && pFile != nullptr)
+  {
+    fclose(pFile);
+    pFile = nullptr;
+  }
+
+  return result;
+}
+
+swapResult swapcodec::swapDecoder::BeginPush(const swapPushCallbacks &callbacks)
+{
+  swapResult result = sR_Success;
+  swapPushState *pPushState = nullptr;
+
+  swapDecoderCloseStream(this);
+
+  filename.clear();
+  pPushState = new swapPushState();
+
+  if (pPushState == nullptr)
+  {
+    result = sR_MemoryAllocationFailure;
+    goto epilogue;
+  }
+
+  pPushState->callbacks = callbacks;
+  pPush = pPushState;
+
+epilogue:
+  return result;
+}
+
+// Decodes the next row of tiles of the current low latency frame from its tile size table and tile data at `pRow` and hands its lines over.
+static swapResult swapDecoderPushSlice(swapDecoder *pDecoder, swapPushState *pPushState, const swapTileGrid &grid, IN const uint8_t *pRow, const size_t rowSize)
+{
+  swapResult result = sR_Success;
+
+  const size_t tileCount = grid.tilesX * grid.tilesY;
+  const size_t rowTableSize = grid.tilesX * sizeof(uint32_t);
+  const size_t row = pPushState->nextTileRow;
+  const size_t y = row * grid.tileHeight;
+  const size_t height = std::min(grid.tileHeight, pDecoder->resY - y);
+  const swapRegion region = { 0, y, pDecoder->resX, height };
+  const size_t frameIndex = pPushState->frameHeader.frameIndex;
+
+  // The row is decoded as a frame of which only its tiles have any data.
+  pPushState->payload.assign(tileCount * sizeof(uint32_t), 0);
+  pPushState->payload.insert(pPushState->payload.end(), pRow + rowTableSize, pRow + rowSize);
+  memcpy(pPushState->payload.data() + row * rowTableSize, pRow, rowTableSize);
+
+  pPushState->lines.resize(swapGetImageSize(pDecoder->outputFormat, pDecoder->resX, height));
+
+  if (sR_Success != (result = swapDecodeFrame(pPushState->payload.data(), pPushState->payload.size(), pPushState->payload.size(), false, pDecoder->lossless, frameIndex, (pPushState->frameHeader.flags & sFF_Keyframe) != 0, frameIndex, pDecoder->pReferenceData, pDecoder->tileReferenceFrameIndex.data(), pPushState->lines.data(), region, pDecoder->outputFormat, pDecoder->colorSpace, grid, pDecoder->quality, pDecoder->bitDepth, (swapTaskQueue *)pDecoder->pTaskQueue)))
+    goto epilogue;
+
+  if (pPushState->callbacks.pOnLinesDecoded != nullptr)
+    pPushState->callbacks.pOnLinesDecoded(pPushState->callbacks.pUserData, frameIndex, y, height, pPushState->lines.data());
+
+epilogue:
+  return result;
+}
+
+swapResult swapcodec::swapDecoder::Push(IN const uint8_t *pData, const size_t size)
+{
+  swapResult result = sR_Success;
+  swapPushState *pPushState = (swapPushState *)pPush;
+  swapTileGrid grid;
+
+  if (pPushState == nullptr || (pData == nullptr && size > 0))
+  {
+    result = sR_InvalidParameter;
+    goto epilogue;
+  }
+
+  if (pPushState->ended)
+    goto epilogue;
+
+  pPushState->pending.erase(pPushState->pending.begin(), pPushState->pending.begin() + pPushState->consumed);
+  pPushState->pending.insert(pPushState->pending.end(), pData, pData + size);
+  pPushState->consumed = 0;
+
+  if (pPushState->streamHeaderParsed)
+    swapGetTileGrid(resX, resY, tileWidth, tileHeight, chromaFormat, alpha, bitDepth, lossless, &grid);
+
+  // Takes apart whatever is complete, leaving partial headers and payloads pending for the next push.
+  while (!pPushState->ended)
+  {
+    const uint8_t *pAvailable = pPushState->pending.data() + pPushState->consumed;
+    const size_t availableSize = pPushState->pending.size() - pPushState->consumed;
+    swapFrameHeader &frameHeader = pPushState->frameHeader;
+
+    if (!pPushState->streamHeaderParsed)
+    {
+      swapStreamHeader header;
+
+      if (availableSize < sizeof(header))
+        break;
+
+      memcpy(&header, pAvailable, sizeof(header));
+
+      if (sR_Success != (result = swapDecoderInitStream(this, header)))
+        goto epilogue;
+
+      swapGetTileGrid(resX, resY, tileWidth, tileHeight, chromaFormat, alpha, bitDepth, lossless, &grid);
+
+      // Reserved for the largest possible frame, so pushing frames doesn't allocate. The pages aren't touched before they're needed.
+      pPushState->payload.reserve(swapGetMaxFrameSize(grid));
+      pPushState->lines.reserve(swapGetImageSize(outputFormat, resX, resY));
+
+      pPushState->consumed += sizeof(header);
+      pPushState->streamHeaderParsed = true;
+      continue;
+    }
+
+    if (!pPushState->frameHeaderParsed)
+    {
+      uint32_t magic;
+
+      if (availableSize < sizeof(magic))
+        break;
+
+      memcpy(&magic, pAvailable, sizeof(magic));
+
+      if (magic == swapIndexHeaderMagic)
+      {
+        pPushState->ended = true;
+        break;
+      }
+
+      if (availableSize < sizeof(frameHeader))
+        break;
+
+      memcpy(&frameHeader, pAvailable, sizeof(frameHeader));
+
+      const bool isRepeat = (frameHeader.flags & sFF_Repeat) != 0;
+
+      if (frameHeader.magic != swapFrameHeaderMagic || frameHeader.frameIndex != pPushState->nextFrameIndex || frameHeader.tileCount != (isRepeat ? 0 : tileReferenceFrameIndex.size()) || (lowLatency && frameHeader.payloadSize != 0))
+      {
+        result = sR_InvalidFormat;
+        goto epilogue;
+      }
+
+      pPushState->consumed += sizeof(frameHeader);
+      pPushState->frameHeaderParsed = true;
+      pPushState->nextTileRow = 0;
+
+      if (!isRepeat)
+        continue;
+
+      // Repeated frames carry the coefficients of their predecessor over.
+      for (size_t &tileFrameIndex : tileReferenceFrameIndex)
+        if (tileFrameIndex + 1 == frameHeader.frameIndex)
+          tileFrameIndex = frameHeader.frameIndex;
+    }
+    else if (lowLatency)
+    {
+      swapSliceHeader sliceHeader;
+
+      if (availableSize < sizeof(sliceHeader))
+        break;
+
+      memcpy(&sliceHeader, pAvailable, sizeof(sliceHeader));
+
+      if (sliceHeader.magic != swapSliceHeaderMagic || sliceHeader.tileRow != pPushState->nextTileRow || sliceHeader.payloadSize < grid.tilesX * sizeof(uint32_t))
+      {
+        result = sR_InvalidFormat;
+        goto epilogue;
+      }
+
+      if (availableSize < sizeof(sliceHeader) + sliceHeader.payloadSize)
+        break;
+
+      if (sR_Success != (result = swapDecoderPushSlice(this, pPushState, grid, pAvailable + sizeof(sliceHeader), sliceHeader.payloadSize)))
+        goto epilogue;
+
+      // `pending` is left alone by the callbacks, so `pAvailable` is still valid.
+      pPushState->consumed += sizeof(sliceHeader) + sliceHeader.payloadSize;
+
+      if (++pPushState->nextTileRow < grid.tilesY)
+        continue;
+    }
+    else
+    {
+      const swapRegion frame = { 0, 0, resX, resY };
+
+      if (availableSize < frameHeader.payloadSize)
+        break;
+
+      // Copied out of `pending`, where the tile size table may not be aligned.
+      pPushState->payload.assign(pAvailable, pAvailable + frameHeader.payloadSize);
+      pPushState->lines.resize(swapGetImageSize(outputFormat, resX, resY));
+
+      if (sR_Success != (result = swapDecodeFrame(pPushState->payload.data(), (size_t)frameHeader.payloadSize, (size_t)frameHeader.payloadSize, progressive, lossless, frameHeader.frameIndex, (frameHeader.flags & sFF_Keyframe) != 0, frameHeader.frameIndex, pReferenceData, tileReferenceFrameIndex.data(), pPushState->lines.data(), frame, outputFormat, colorSpace, grid, quality, bitDepth, (swapTaskQueue *)pTaskQueue)))
+        goto epilogue;
+
+      pPushState->consumed += (size_t)frameHeader.payloadSize;
+
+      if (pPushState->callbacks.pOnLinesDecoded != nullptr)
+        pPushState->callbacks.pOnLinesDecoded(pPushState->callbacks.pUserData, frameHeader.frameIndex, 0, resY, pPushState->lines.data());
+    }
+
+    // The frame is complete.
+    pPushState->frameHeaderParsed = false;
+    pPushState->nextFrameIndex++;
+    currentFrameIndex = pPushState->nextFrameIndex;
+
+    if (pPushState->callbacks.pOnFrameDecoded != nullptr)
+      pPushState->callbacks.pOnFrameDecoded(pPushState->callbacks.pUserData, frameHeader.frameIndex);
+  }
+
+epilogue:
+  return result;
+}
+
+swapResult swapcodec::swapDecoder::SetOutputFormat(const swapPixelFormat format, const swapColorSpace space)
+{
+  swapResult result = sR_Success;
+  size_t readAheadFrameCount = 0;
+  swapChromaFormat formatChromaFormat;
+  bool formatAlpha;
+  size_t bytesPerSample;
+
+  if (swapGetImageSize(format, 1, 1) == 0 || format == sPF_NV12 || (space != sCS_BT601 && space != sCS_BT709))
+    return sR_InvalidParameter;
+
+  // Planar output is always in the native format of the stream.
+  if (pFile != nullptr && swapGetPlanarFormatInfo(format, &formatChromaFormat, &formatAlpha, &bytesPerSample) && format != swapGetPlanarFormat(chromaFormat, alpha, bitDepth))
+    return sR_InvalidParameter;
+
+  // The read-ahead buffers and cached pictures are in the previous format.
+  if (pReadAhead != nullptr)
+  {
+    readAheadFrameCount = ((swapReadAhead *)pReadAhead)->readAheadFrameCount;
+    DisableReadAhead();
+  }
+
+  if (pFrameCache != nullptr)
+    swapFrameCacheClear((swapFrameCache *)pFrameCache);
+
+  outputFormat = format;
+  colorSpace = space;
+
+  if (readAheadFrameCount > 0)
+    result = EnableReadAhead(readAheadFrameCount);
+
+  return result;
+}
+
+swapResult swapcodec::swapDecoder::DecodeFrame(const size_t frameIndex, OUT uint8_t *pFrame)
+{
+  swapResult result = sR_Success;
+
+  if (pFile == nullptr || pFrame == nullptr || frameIndex >= frameCount)
+  {
+    result = sR_InvalidParameter;
+    goto epilogue;
+  }
+
+  if (pReadAhead != nullptr)
+  {
+    std::lock_guard<std::mutex> decodeLock(((swapReadAhead *)pReadAhead)->decodeMutex);
+    result = swapDecoderDecodeFrame(this, frameIndex, pFrame);
+  }
+  else
+  {
+    result = swapDecoderDecodeFrame(this, frameIndex, pFrame);
+  }
+
+  if (result == sR_Success)
+    currentFrameIndex = frameIndex + 1;
+
+epilogue:
+  return result;
+}
+
+swapResult swapcodec::swapDecoder::DecodeFrameRegion(const size_t frameIndex, const size_t x, const size_t y, const size_t width, const size_t height, OUT uint8_t *pRegion)
+{
+  const swapRegion region = { x, y, width, height };
+
+  if (pFile == nullptr || pRegion == nullptr || frameIndex >= frameCount || width == 0 || height == 0 || ((x | y) & 1) != 0 || x + width > resX || y + height > resY)
+    return sR_InvalidParameter;
+
+  // Odd sizes share the last chroma sample like the frame itself, so they're only possible at the right and bottom edge.
+  if (((width & 1) != 0 && x + width != resX) || ((height & 1) != 0 && y + height != resY))
+    return sR_InvalidParameter;
+
+  if (pReadAhead != nullptr)
+  {
+    std::lock_guard<std::mutex> decodeLock(((swapReadAhead *)pReadAhead)->decodeMutex);
+    return swapDecoderDecodeRegion(this, frameIndex, region, pRegion);
+  }
+
+  return swapDecoderDecodeRegion(this, frameIndex, region, pRegion);
+}
+
+swapResult swapcodec::swapDecoder::DecodeFrameProgressive(const size_t frameIndex, const size_t maxFrameBytes, OUT uint8_t *pFrame)
+{
+  const swapRegion frame = { 0, 0, resX, resY };
+
+  if (pFile == nullptr || pFrame == nullptr || frameIndex >= frameCount || !progressive || maxFrameBytes < sizeof(swapFrameHeader))
+    return sR_InvalidParameter;
+
+  if (pReadAhead != nullptr)
+  {
+    std::lock_guard<std::mutex> decodeLock(((swapReadAhead *)pReadAhead)->decodeMutex);
+    return swapDecoderDecodeRegion(this, frameIndex, frame, pFrame, maxFrameBytes);
+  }
+
+  return swapDecoderDecodeRegion(this, frameIndex, frame, pFrame, maxFrameBytes);
+}
+
+swapResult swapcodec::swapDecoder::DecodeNext(OUT uint8_t *pFrame)
+{
+  if (pFile != nullptr && currentFrameIndex >= frameCount)
+    return sR_EndOfStream;
+
+  return DecodeFrame(currentFrameIndex, pFrame);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+struct swapBatchDecode
+{
+  swapDecoder *pDecoder;
+  swapTaskQueue *pQueue;
+  size_t firstFrameIndex;
+  size_t workerCount;
+
+  // Groups of pictures are started in order, the first one may start after its keyframe. Every group is decoded by one task at a time that returns once it's done or runs out of frames to decode into.
+  std::vector<size_t> groupStarts;
+  std::vector<size_t> groupNextFrames;
+  std::vector<swapDecoder *> groupClones;
+  size_t nextGroup = 0;
+  size_t groupsInFlight = 0;
+
+  // Groups waiting for a free frame, resumed by the calling thread once it has delivered frames.
+  std::vector<size_t> suspendedGroups;
+
+  // Every group that's started takes a clone of the decoder, which keeps the reference coefficients of the group while it's suspended.
+  std::vector<swapDecoder *> clones;
+  std::vector<swapDecoder *> freeClones;
+
+  // Frames that have been decoded but not delivered yet, by frame index relative to `firstFrameIndex`. The calling thread delivers them in order.
+  std::vector<uint8_t *> decodedFrames;
+  std::vector<uint8_t *> freeFrames;
+  size_t nextFrameIndex;
+
+  swapResult result = sR_Success;
+  std::mutex mutex;
+  std::condition_variable condition;
+};
+
+// Opens a second handle to the stream of `pDecoder` that decodes on the calling thread alone.
+static swapResult swapDecoderCloneStream(swapDecoder *pDecoder, OUT swapDecoder *pClone)
+{
+  swapResult result = sR_Success;
+  swapStreamHeader header;
+
+  pClone->filename = pDecoder->filename;
+  pClone->outputFormat = pDecoder->outputFormat;
+  pClone->colorSpace = pDecoder->colorSpace;
+  pClone->pFile = fopen(pClone->filename.c_str(), "rb");
+
+  if (pClone->pFile == nullptr || 1 != fread(&header, sizeof(header), 1, pClone->pFile))
+  {
+    result = sR_IOFailure;
+    goto epilogue;
+  }
+
+  if (sR_Success != (result = swapDecoderInitStream(pClone, header)))
+    goto epilogue;
+
+  pClone->index = pDecoder->index;
+  pClone->frameCount = pDecoder->frameCount;
+
+  if (sR_Success != (result = swapDecoderReserveLargestFrame(pClone)))
+    goto epilogue;
+
+epilogue:
+  return result;
+}
+
+// The last free frame is left to the group of the next frame to be delivered, which needs it to make progress while every other frame waits for delivery.
+static bool swapBatchDecodeCanTakeFrame(const swapBatchDecode *pBatch, const size_t group)
+{
+  return pBatch->freeFrames.size() > 1 || (!pBatch->freeFrames.empty() && pBatch->groupStarts[group] <= pBatch->nextFrameIndex);
+}
+
+// Decodes the frames of a group of pictures on a worker of the thread pool. Never waits: without a free frame to decode into the group is suspended until the calling thread resumes it.
+static void swapBatchDecodeGroup(swapBatchDecode *pBatch, const size_t group)
+{
+  swapResult result = sR_Success;
+  swapDecoder *pClone = nullptr;
+  size_t frameIndex;
+
+  {
+    std::lock_guard<std::mutex> lock(pBatch->mutex);
+
+    pClone = pBatch->groupClones[group];
+
+    if (pClone == nullptr && !pBatch->freeClones.empty())
+    {
+      pClone = pBatch->freeClones.back();
+      pBatch->freeClones.pop_back();
+    }
+  }
+
+  if (pClone == nullptr)
+  {
+    pClone = new swapDecoder();
+
+    if (pClone == nullptr)
+    {
+      result = sR_MemoryAllocationFailure;
+      goto epilogue;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(pBatch->mutex);
+      pBatch->clones.push_back(pClone);
+    }
+
+    if (sR_Success != (result = swapDecoderCloneStream(pBatch->pDecoder, pClone)))
+      goto epilogue;
+  }
+
+  for (frameIndex = pBatch->groupNextFrames[group]; frameIndex < pBatch->groupStarts[group + 1]; frameIndex++)
+  {
+    uint8_t *pFrame;
+
+    {
+      std::lock_guard<std::mutex> lock(pBatch->mutex);
+
+      if (pBatch->result != sR_Success)
+        goto epilogue;
+
+      if (!swapBatchDecodeCanTakeFrame(pBatch, group))
+      {
+        pBatch->groupNextFrames[group] = frameIndex;
+        pBatch->groupClones[group] = pClone;
+        pBatch->suspendedGroups.push_back(group);
+        pBatch->condition.notify_all();
+
+        return;
+      }
+
+      pFrame = pBatch->freeFrames.back();
+      pBatch->freeFrames.pop_back();
+    }
+
+    result = swapDecoderDecodeFrame(pClone, frameIndex, pFrame);
+
+    std::lock_guard<std::mutex> lock(pBatch->mutex);
+
+    if (result != sR_Success)
+    {
+      pBatch->freeFrames.push_back(pFrame);
+      goto epilogue;
+    }
+
+    pBatch->decodedFrames[frameIndex - pBatch->firstFrameIndex] = pFrame;
+
+    if (frameIndex == pBatch->nextFrameIndex)
+      pBatch->condition.notify_all();
+  }
+
+epilogue:
+  std::lock_guard<std::mutex> lock(pBatch->mutex);
+
+  if (result != sR_Success && pBatch->result == sR_Success)
+    pBatch->result = result;
+
+  // Clones that failed are only deleted, as the batch is over.
+  if (pClone != nullptr && result == sR_Success)
+    pBatch->freeClones.push_back(pClone);
+
+  pBatch->groupClones[group] = nullptr;
+  pBatch->groupsInFlight--;
+  pBatch->condition.notify_all();
+}
+
+static void swapBatchDecodeQueueGroup(swapBatchDecode *pBatch, const size_t group)
+{
+  swapEnqueueTask(pBatch->pQueue, [](void *pContext, const size_t item) { swapBatchDecodeGroup(reinterpret_cast<swapBatchDecode *>(pContext), item); }, pBatch, group);
+}
+
+// Pool workers decode one group of pictures per task, so other streams sharing the thread pool get their turn between groups. The calling thread starts and resumes groups and delivers the frames.
+swapResult swapcodec::swapDecoder::DecodeFrames(const size_t firstFrameIndex, const size_t batchFrameCount, const swapBatchCallbacks &callbacks, const size_t reorderFrameCount)
+{
+  swapResult result = sR_Success;
+  swapBatchDecode batch;
+  std::vector<uint8_t *> frames;
+  size_t frameSize;
+  size_t groupCount;
+
+  if (pFile == nullptr || batchFrameCount == 0 || firstFrameIndex >= frameCount || batchFrameCount > frameCount - firstFrameIndex)
+  {
+    result = sR_InvalidParameter;
+    goto epilogue;
+  }
+
+  frameSize = swapGetImageSize(outputFormat, resX, resY);
+
+  batch.pDecoder = this;
+  batch.pQueue = (swapTaskQueue *)pTaskQueue;
+  batch.firstFrameIndex = firstFrameIndex;
+  batch.nextFrameIndex = firstFrameIndex;
+
+  for (size_t frameIndex = firstFrameIndex; frameIndex < firstFrameIndex + batchFrameCount; frameIndex++)
+    if (frameIndex == firstFrameIndex || (index[frameIndex].flags & sFF_Keyframe) != 0)
+      batch.groupStarts.push_back(frameIndex);
+
+  groupCount = batch.groupStarts.size();
+  batch.groupNextFrames = batch.groupStarts;
+  batch.groupStarts.push_back(firstFrameIndex + batchFrameCount);
+  batch.groupClones.resize(groupCount, nullptr);
+  batch.decodedFrames.resize(batchFrameCount, nullptr);
+
+  batch.workerCount = std::min(groupCount, swapGetTaskQueueThreadCount(batch.pQueue));
+  frames.resize(batch.workerCount + (reorderFrameCount == 0 ? batch.workerCount : reorderFrameCount), nullptr);
+
+  // One frame to decode into for every group in flight and the reorder buffer.
+  for (uint8_t *&pFrame : frames)
+  {
+    pFrame = (uint8_t *)malloc(frameSize);
+
+    if (pFrame == nullptr)
+    {
+      result = sR_MemoryAllocationFailure;
+      goto epilogue;
+    }
+  }
+
+  batch.freeFrames = frames;
+
+  {
+    std::unique_lock<std::mutex> lock(batch.mutex);
+
+    while (batch.result == sR_Success && batch.nextFrameIndex < firstFrameIndex + batchFrameCount)
+    {
+      uint8_t *pFrame = batch.decodedFrames[batch.nextFrameIndex - firstFrameIndex];
+
+      if (pFrame != nullptr)
+      {
+        lock.unlock();
+
+        if (callbacks.pOnFrameDecoded != nullptr)
+          callbacks.pOnFrameDecoded(callbacks.pUserData, batch.nextFrameIndex, pFrame);
+
+        lock.lock();
+
+        batch.freeFrames.push_back(pFrame);
+        batch.nextFrameIndex++;
+      }
+
+      // Suspended groups that would find a free frame to decode into are resumed, the group of the next frame to be delivered first.
+      size_t freeFrameCount = batch.freeFrames.size();
+
+      std::sort(batch.suspendedGroups.begin(), batch.suspendedGroups.end());
+
+      for (size_t i = 0; i < batch.suspendedGroups.size();)
+      {
+        const size_t group = batch.suspendedGroups[i];
+
+        if (freeFrameCount > 1 || (freeFrameCount == 1 && batch.groupStarts[group] <= batch.nextFrameIndex))
+        {
+          freeFrameCount--;
+          batch.suspendedGroups.erase(batch.suspendedGroups.begin() + i);
+          swapBatchDecodeQueueGroup(&batch, group);
+        }
+        else
+        {
+          i++;
+        }
+      }
+
+      // Groups in flight are capped at the number of workers, which limits the number of clones.
+      while (batch.groupsInFlight < batch.workerCount && batch.nextGroup < groupCount)
+      {
+        batch.groupsInFlight++;
+        swapBatchDecodeQueueGroup(&batch, batch.nextGroup++);
+      }
+
+      if (pFrame == nullptr)
+        batch.condition.wait(lock);
+    }
+
+    result = batch.result;
+  }
+
+  // After a failure, running groups stop before their next frame and suspended groups are never resumed.
+  swapWaitForTasks(batch.pQueue);
+
+  if (result != sR_Success)
+    goto epilogue;
+
+  currentFrameIndex = firstFrameIndex + batchFrameCount;
+
+epilogue:
+  for (swapDecoder *pClone : batch.clones)
+    delete pClone;
+
+  for (uint8_t *pFrame : frames)
+    if (pFrame)
+      free(pFrame);
+
+  return result;
+}
+
+swapResult swapcodec::swapDecoder::DecodeFrameAsync(const size_t frameIndex, OUT uint8_t *pFrame, void (*pOnDecoded)(void *pUserData, const size_t frameIndex, const swapResult result), void *pUserData)
+{
+  if (pFile == nullptr || pFrame == nullptr || frameIndex >= frameCount || pReadAhead != nullptr)
+    return sR_InvalidParameter;
+
+  return swapDecoderSubmit(this, { frameIndex, pFrame, pOnDecoded, pUserData });
+}
+
+swapResult swapcodec::swapDecoder::DecodeNextAsync(OUT uint8_t *pFrame, void (*pOnDecoded)(void *pUserData, const size_t frameIndex, const swapResult result), void *pUserData)
+{
+  if (pFile == nullptr || pFrame == nullptr || pReadAhead != nullptr)
+    return sR_InvalidParameter;
+
+  return swapDecoderSubmit(this, { (size_t)-1, pFrame, pOnDecoded, pUserData });
+}
+
+swapResult swapcodec::swapDecoder::EnableReadAhead(const size_t readAheadFrameCount)
+{
+  swapResult result = sR_Success;
+  swapReadAhead *pState = nullptr;
+  const size_t frameSize = swapGetImageSize(outputFormat, resX, resY);
+
+  if (pFile == nullptr || readAheadFrameCount == 0)
+  {
+    result = sR_InvalidParameter;
+    goto epilogue;
+  }
+
+  DisableReadAhead();
+
+  pState = new swapReadAhead();
+
+  if (pState == nullptr)
+  {
+    result = sR_MemoryAllocationFailure;
+    goto epilogue;
+  }
+
+  pState->readAheadFrameCount = readAheadFrameCount;
+  pState->nextFrameIndex = currentFrameIndex;
+
+  // One additional slot, so the frame currently held by the consumer doesn't stall the read-ahead.
+  pState->slots.resize(readAheadFrameCount + 1);
+
+  for (swapReadAheadSlot &slot : pState->slots)
+  {
+    slot.pFrame = (uint8_t *)malloc(frameSize);
+
+    if (slot.pFrame == nullptr)
+    {
+      result = sR_MemoryAllocationFailure;
+      goto epilogue;
+    }
+  }
+
+  pState->thread = std::thread(swapReadAheadThread, this, pState);
+  pReadAhead = pState;
+
+epilogue:
+  if (result != sR_Success && pState != nullptr)
+  {
+    for (swapReadAheadSlot &slot : pState->slots)
+      if (slot.pFrame)
+        free(slot.pFrame);
+
+    delete pState;
+  }
+
+  return result;
+}
+
+void swapcodec::swapDecoder::DisableReadAhead()
+{
+  if (pReadAhead == nullptr)
+    return;
+
+  swapReadAhead *pState = (swapReadAhead *)pReadAhead;
+
+  {
+    std::lock_guard<std::mutex> lock(pState->mutex);
+    pState->stop = true;
+  }
+
+  pState->condition.notify_all();
+  pState->thread.join();
+
+  for (swapReadAheadSlot &slot : pState->slots)
+    free(slot.pFrame);
+
+  delete pState;
+  pReadAhead = nullptr;
+}
+
+swapResult swapcodec::swapDecoder::AcquireFrame(const size_t frameIndex, OUT const uint8_t **ppFrame)
+{
+  if (pReadAhead == nullptr || ppFrame == nullptr || frameIndex >= frameCount)
+    return sR_InvalidParameter;
+
+  swapReadAhead *pState = (swapReadAhead *)pReadAhead;
+  std::unique_lock<std::mutex> lock(pState->mutex);
+
+  while (true)
+  {
+    swapReadAheadSlot *pSlot = nullptr;
+
+    for (swapReadAheadSlot &slot : pState->slots)
+    {
+      if (slot.state != sRASS_Free && slot.frameIndex == frameIndex)
+        pSlot = &slot;
+      else if (slot.state == sRASS_Ready && slot.frameIndex < frameIndex) // Skipped by the consumer.
+        slot.state = sRASS_Free;
+    }
+
+    if (pSlot != nullptr)
+    {
+      if (pSlot->state == sRASS_Decoding)
+      {
+        pState->condition.wait(lock);
+        continue;
+      }
+
+      if (pSlot->result != sR_Success)
+      {
+        const swapResult result = pSlot->result;
+        pSlot->state = sRASS_Free;
+        pState->condition.notify_all();
+
+        return result;
+      }
+
+      pSlot->state = sRASS_Acquired;
+      *ppFrame = pSlot->pFrame;
+      currentFrameIndex = frameIndex + 1;
+
+      pState->condition.notify_all();
+
+      return sR_Success;
+    }
+
+    // The frame will be decoded next.
+    if (frameIndex >= pState->nextFrameIndex && frameIndex < pState->nextFrameIndex + pState->readAheadFrameCount)
+    {
+      pState->nextFrameIndex = frameIndex;
+      pState->condition.notify_all();
+      pState->condition.wait(lock);
+      continue;
+    }
+
+    // The consumer seeked: drop everything that's pending and restart the read-ahead at `frameIndex`.
+    pState->generation++;
+    pState->nextFrameIndex = frameIndex;
+
+    for (swapReadAheadSlot &slot : pState->slots)
+      if (slot.state == sRASS_Ready)
+        slot.state = sRASS_Free;
+
+    pState->condition.notify_all();
+    pState->condition.wait(lock);
+  }
+}
+
+swapResult swapcodec::swapDecoder::ReleaseFrame(const size_t frameIndex)
+{
+  if (pReadAhead == nullptr)
+    return sR_InvalidParameter;
+
+  swapReadAhead *pState = (swapReadAhead *)pReadAhead;
+  std::lock_guard<std::mutex> lock(pState->mutex);
+
+  for (swapReadAheadSlot &slot : pState->slots)
+  {
+    if (slot.state == sRASS_Acquired && slot.frameIndex == frameIndex)
+    {
+      slot.state = sRASS_Free;
+      pState->condition.notify_all();
+
+      return sR_Success;
+    }
+  }
+
+  return sR_InvalidParameter;
+}
+
+swapResult swapcodec::swapDecoder::EnableFrameCache(const size_t memoryBudget)
+{
+  if (memoryBudget == 0)
+    return sR_InvalidParameter;
+
+  swapFrameCache *pCache = new swapFrameCache();
+
+  if (pCache == nullptr)
+    return sR_MemoryAllocationFailure;
+
+  pCache->memoryBudget = memoryBudget;
+
+  DisableFrameCache();
+
+  if (pReadAhead != nullptr)
+  {
+    std::lock_guard<std::mutex> decodeLock(((swapReadAhead *)pReadAhead)->decodeMutex);
+    pFrameCache = pCache;
+  }
+  else
+  {
+    pFrameCache = pCache;
+  }
+
+  return sR_Success;
+}
+
+void swapcodec::swapDecoder::DisableFrameCache()
+{
+  if (pFrameCache == nullptr)
+    return;
+
+  swapFrameCache *pCache = (swapFrameCache *)pFrameCache;
+
+  if (pReadAhead != nullptr)
+  {
+    std::lock_guard<std::mutex> decodeLock(((swapReadAhead *)pReadAhead)->decodeMutex);
+    pFrameCache = nullptr;
+  }
+  else
+  {
+    pFrameCache = nullptr;
+  }
+
+  delete pCache;
+}
@@ -0,0 +1,441 @@
+// Copyright 2018 Christoph Stiller
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+// 
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "swapcodecInternal.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <string.h>
+#include <thread>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace swapcodec;
+
+//////////////////////////////////////////////////////////////////////////
+
+struct swapWorkers;
+
+struct swapTask
+{
+  void (*pFunction)(void *pContext, const size_t item);
+  void *pContext;
+  size_t item;
+};
+
+struct swapTaskQueue
+{
+  swapWorkers *pWorkers;
+
+  // Workers take the next task from the queue with the lowest pass, which advances by the stride of the queue for every task taken. Lower strides get a larger share of the workers.
+  uint64_t stride;
+  uint64_t pass = 0;
+
+  swapQueue<swapTask> tasks;
+  size_t pendingTaskCount = 0; // queued or running.
+
+  // Set if the queue was destroyed by one of its own tasks. The worker running the last task deletes it.
+  bool destroyed = false;
+
+  std::condition_variable condition;
+};
+
+struct swapWorkers
+{
+  std::vector<std::thread> threads;
+  std::vector<swapTaskQueue *> queues;
+
+  // The pass of the queue the last task was taken from. Queues that have been idle start from here rather than catching up on the tasks they didn't have.
+  uint64_t pass = 0;
+  bool stop = false;
+
+  bool pinned = false;
+
+  std::mutex mutex;
+  std::condition_variable condition;
+};
+
+// The queue of the task running on this thread, if any.
+static thread_local swapTaskQueue *pRunningTaskQueue = nullptr;
+
+static void swapWorkerThread(swapWorkers *pWorkers)
+{
+  std::unique_lock<std::mutex> lock(pWorkers->mutex);
+
+  while (true)
+  {
+    swapTaskQueue *pQueue = nullptr;
+
+    for (swapTaskQueue *pCandidate : pWorkers->queues)
+      if (!pCandidate->tasks.empty() && (pQueue == nullptr || pCandidate->pass < pQueue->pass))
+        pQueue = pCandidate;
+
+    if (pQueue == nullptr)
+    {
+      if (pWorkers->stop)
+        break;
+
+      pWorkers->condition.wait(lock);
+      continue;
+    }
+
+    const swapTask task = pQueue->tasks.front();
+    pQueue->tasks.pop_front();
+
+    pWorkers->pass = pQueue->pass;
+    pQueue->pass += pQueue->stride;
+
+    lock.unlock();
+
+    pRunningTaskQueue = pQueue;
+    task.pFunction(task.pContext, task.item);
+    pRunningTaskQueue = nullptr;
+
+    lock.lock();
+
+    if (--pQueue->pendingTaskCount == 0)
+    {
+      if (pQueue->destroyed)
+      {
+        pWorkers->queues.erase(std::find(pWorkers->queues.begin(), pWorkers->queues.end(), pQueue));
+        delete pQueue;
+      }
+      else
+      {
+        pQueue->condition.notify_all();
+      }
+    }
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Cores are numbered across processor groups of 64 cores on Windows, where large nodes span several groups. Returns the cores in ascending order.
+static bool swapGetNumaNodeCores(const int32_t numaNode, OUT std::vector<size_t> *pCores)
+{
+#ifdef _WIN32
+  std::vector<GROUP_AFFINITY> affinities(GetActiveProcessorGroupCount());
+  USHORT groupCount = 0;
+
+  if (affinities.empty() || !GetNumaNodeProcessorMask2((USHORT)numaNode, affinities.data(), (USHORT)affinities.size(), &groupCount))
+    return false;
+
+  for (size_t i = 0; i < groupCount; i++)
+    for (size_t bit = 0; bit < 64; bit++)
+      if (affinities[i].Mask & ((KAFFINITY)1 << bit))
+        pCores->push_back(affinities[i].Group * 64 + bit);
+
+  std::sort(pCores->begin(), pCores->end());
+#elif defined(__linux__)
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", (int)numaNode);
+
+  FILE *pFile = fopen(path, "r");
+
+  if (pFile == nullptr)
+    return false;
+
+  // Comma separated cores and ranges of cores, like `0-7,16-23`.
+  unsigned int first, last;
+
+  while (fscanf(pFile, "%u", &first) == 1)
+  {
+    int separator = fgetc(pFile);
+    last = first;
+
+    if (separator == '-')
+    {
+      if (fscanf(pFile, "%u", &last) != 1)
+        break;
+
+      separator = fgetc(pFile);
+    }
+
+    for (size_t core = first; core <= last; core++)
+      pCores->push_back(core);
+
+    if (separator != ',')
+      break;
+  }
+
+  fclose(pFile);
+#else
+  (void)numaNode;
+#endif
+
+  return !pCores->empty();
+}
+
+// Threads can only be pinned to the cores of a single processor group on Windows, the group of the first core.
+static bool swapPinThread(std::thread &thread, const std::vector<size_t> &cores)
+{
+#ifdef _WIN32
+  GROUP_AFFINITY affinity = {};
+  affinity.Group = (WORD)(cores[0] / 64);
+
+  for (const size_t core : cores)
+    if (core / 64 == affinity.Group)
+      affinity.Mask |= (KAFFINITY)1 << (core % 64);
+
+  return SetThreadGroupAffinity((HANDLE)thread.native_handle(), &affinity, nullptr) != FALSE;
+#elif defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+
+  for (const size_t core : cores)
+    if (core < CPU_SETSIZE)
+      CPU_SET(core, &set);
+
+  return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+  (void)thread;
+  (void)cores;
+  return false;
+#endif
+}
+
+swapThreadPool * swapcodec::swapThreadPool::Create(const size_t threadCount)
+{
+  swapThreadPoolOptions options;
+  options.threadCount = threadCount;
+
+  return Create(options);
+}
+
+swapThreadPool * swapcodec::swapThreadPool::Create(const swapThreadPoolOptions &options)
+{
+  swapThreadPool *pThreadPool = new swapThreadPool();
+  swapWorkers *pWorkers = nullptr;
+  std::vector<size_t> numaNodeCores;
+  std::vector<std::vector<size_t>> workerCores;
+  std::vector<size_t> allCores;
+  size_t firstMaskCore = 0;
+
+  if (pThreadPool == nullptr)
+    goto epilogue;
+
+  if (options.numaNode >= 0)
+  {
+    if (!swapGetNumaNodeCores(options.numaNode, &numaNodeCores))
+      goto epilogue;
+
+    // Masks address the processor group holding the first core of the node.
+    firstMaskCore = numaNodeCores[0] / 64 * 64;
+  }
+
+  for (const uint64_t mask : options.affinityMasks)
+  {
+    std::vector<size_t> cores;
+
+    for (size_t bit = 0; bit < 64; bit++)
+    {
+      const size_t core = firstMaskCore + bit;
+
+      if ((mask & ((uint64_t)1 << bit)) && (options.numaNode < 0 || std::binary_search(numaNodeCores.begin(), numaNodeCores.end(), core)))
+        cores.push_back(core);
+    }
+
+    if (cores.empty())
+      goto epilogue;
+
+    workerCores.push_back(cores);
+  }
+
+  if (workerCores.empty() && options.numaNode >= 0)
+  {
+#ifdef _WIN32
+    // Threads can only be pinned to the cores of one processor group, so the workers take turns between the groups of the node.
+    for (const size_t core : numaNodeCores)
+    {
+      if (workerCores.empty() || workerCores.back()[0] / 64 != core / 64)
+        workerCores.emplace_back();
+
+      workerCores.back().push_back(core);
+    }
+#else
+    workerCores.push_back(numaNodeCores);
+#endif
+  }
+
+  for (const std::vector<size_t> &cores : workerCores)
+    allCores.insert(allCores.end(), cores.begin(), cores.end());
+
+  std::sort(allCores.begin(), allCores.end());
+  allCores.erase(std::unique(allCores.begin(), allCores.end()), allCores.end());
+
+  pWorkers = new swapWorkers();
+
+  if (pWorkers == nullptr)
+    goto epilogue;
+
+  pThreadPool->pWorkers = pWorkers;
+  pThreadPool->threadCount = options.threadCount;
+  pThreadPool->pinned = pWorkers->pinned = !workerCores.empty();
+
+  if (pThreadPool->threadCount == 0)
+  {
+    const size_t coreCount = (size_t)mango::ThreadPool::getHardwareConcurrency();
+    pThreadPool->threadCount = pThreadPool->pinned ? allCores.size() : (coreCount > 1 ? coreCount - 1 : 1);
+  }
+
+  // Workers are pinned before any task is queued, so they never touch memory from another core.
+  for (size_t i = 0; i < pThreadPool->threadCount; i++)
+  {
+    pWorkers->threads.emplace_back(swapWorkerThread, pWorkers);
+
+    if (pThreadPool->pinned && !swapPinThread(pWorkers->threads.back(), workerCores[i % workerCores.size()]))
+      goto epilogue;
+  }
+
+  return pThreadPool;
+
+epilogue:
+  if (pThreadPool)
+    delete pThreadPool;
+
+  return nullptr;
+}
+
+swapcodec::swapThreadPool::~swapThreadPool()
+{
+  swapWorkers *pThreadPoolWorkers = (swapWorkers *)pWorkers;
+
+  if (pThreadPoolWorkers == nullptr)
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(pThreadPoolWorkers->mutex);
+    pThreadPoolWorkers->stop = true;
+  }
+
+  pThreadPoolWorkers->condition.notify_all();
+
+  for (std::thread &thread : pThreadPoolWorkers->threads)
+    thread.join();
+
+  delete pThreadPoolWorkers;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Used by every encoder and decoder created without a thread pool. Never destroyed, as they may still be destroyed during static destruction.
+static swapThreadPool * swapGetDefaultThreadPool()
+{
+  static swapThreadPool *pThreadPool = swapThreadPool::Create();
+
+  return pThreadPool;
+}
+
+swapTaskQueue * swapCreateTaskQueue(IN swapThreadPool *pThreadPool, const swapPriority priority)
+{
+  swapTaskQueue *pQueue = nullptr;
+  swapWorkers *pWorkers;
+
+  if (pThreadPool == nullptr)
+    pThreadPool = swapGetDefaultThreadPool();
+
+  if (pThreadPool == nullptr)
+    goto epilogue;
+
+  pQueue = new swapTaskQueue();
+
+  if (pQueue == nullptr)
+    goto epilogue;
+
+  pWorkers = (swapWorkers *)pThreadPool->pWorkers;
+
+  pQueue->pWorkers = pWorkers;
+  pQueue->stride = priority == sP_High ? 1 : (priority == sP_Low ? 4 : 2);
+
+  {
+    std::lock_guard<std::mutex> lock(pWorkers->mutex);
+    pWorkers->queues.push_back(pQueue);
+  }
+
+epilogue:
+  return pQueue;
+}
+
+void swapDestroyTaskQueue(IN swapTaskQueue *pQueue)
+{
+  swapWorkers *pWorkers = pQueue->pWorkers;
+
+  {
+    std::unique_lock<std::mutex> lock(pWorkers->mutex);
+
+    // The task can't wait for itself, so the queue is deleted by the worker once its last task is done.
+    if (swapIsRunningTaskOf(pQueue))
+    {
+      pQueue->destroyed = true;
+      return;
+    }
+
+    while (pQueue->pendingTaskCount > 0)
+      pQueue->condition.wait(lock);
+
+    pWorkers->queues.erase(std::find(pWorkers->queues.begin(), pWorkers->queues.end(), pQueue));
+  }
+
+  delete pQueue;
+}
+
+void swapEnqueueTask(IN swapTaskQueue *pQueue, void (*pFunction)(void *pContext, const size_t item), void *pContext, const size_t item)
+{
+  swapWorkers *pWorkers = pQueue->pWorkers;
+
+  {
+    std::lock_guard<std::mutex> lock(pWorkers->mutex);
+
+    if (pQueue->pendingTaskCount == 0)
+      pQueue->pass = std::max(pQueue->pass, pWorkers->pass);
+
+    pQueue->tasks.push_back({ pFunction, pContext, item });
+    pQueue->pendingTaskCount++;
+  }
+
+  pWorkers->condition.notify_one();
+}
+
+void swapWaitForTasks(IN swapTaskQueue *pQueue)
+{
+  std::unique_lock<std::mutex> lock(pQueue->pWorkers->mutex);
+
+  while (pQueue->pendingTaskCount > 0)
+    pQueue->condition.wait(lock);
+}
+
+bool swapIsRunningTaskOf(IN const swapTaskQueue *pQueue)
+{
+  return pRunningTaskQueue == pQueue;
+}
+
+size_t swapGetTaskQueueThreadCount(IN const swapTaskQueue *pQueue)
+{
+  return pQueue->pWorkers->threads.size();
+}
+
+bool swapIsTaskQueuePinned(IN const swapTaskQueue *pQueue)
+{
+  return pQueue->pWorkers->pinned;
+}
+
+void swapFirstTouch(IN swapTaskQueue *pQueue, OUT uint8_t *pData, const size_t size)
+{
+  const size_t chunkSize = 256 * 1024;
+
+  swapParallelFor(pQueue, (size + chunkSize - 1) / chunkSize, [&](const size_t chunk) {
+    memset(pData + chunk * chunkSize, 0, std::min(chunkSize, size - chunk * chunkSize));
+  });
+}
@@ -6,31 +6,27 @@
 // 
 // THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
-#include "swapcodec.h"
+#include "swapcodecInternal.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <math.h>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
 
 #include "apex_memmove/apex_memmove.h"
 #include "apex_memmove/apex_memmove.c"
 
-#include <intrin.h>
-#include <xmmintrin.h>
-#include <emmintrin.h>
-
-#ifdef SSSE3
-#include <tmmintrin.h>
-#endif
-
-#pragma warning(push, 0)
-#include "mango/core/thread.hpp"
-#pragma warning(pop)
-
 using namespace swapcodec;
 
 //////////////////////////////////////////////////////////////////////////
 
-#define DCT_PER_BLOCK_SIZE 128
-
-//////////////////////////////////////////////////////////////////////////
-
 void swapcodec::swapMemcpy(OUT void * pDestination, IN const void * pSource, const size_t size)
 {
   apex_memcpy(pDestination, pSource, size);
@@ -41,286 +37,1412 @@ void swapcodec::swapMemmove(OUT void * pDestination, IN_OUT void * pSource, cons
   apex_memmove(pDestination, pSource, size);
 }
 
-//////////////////////////////////////////////////////////////////////////
+bool swapGetPlanarFormatInfo(const swapPixelFormat format, OUT swapChromaFormat *pChromaFormat, OUT bool *pAlpha, OUT size_t *pBytesPerSample)
+{
+  static const struct
+  {
+    swapPixelFormat format;
+    swapChromaFormat chromaFormat;
+    bool alpha;
+    size_t bytesPerSample;
+  } planarFormats[] =
+  {
+    { sPF_YUV420, sCF_420, false, 1 },
+    { sPF_YUV422, sCF_422, false, 1 },
+    { sPF_YUV444, sCF_444, false, 1 },
+    { sPF_YUV420_16, sCF_420, false, 2 },
+    { sPF_YUV422_16, sCF_422, false, 2 },
+    { sPF_YUV444_16, sCF_444, false, 2 },
+    { sPF_YUVA420, sCF_420, true, 1 },
+    { sPF_YUVA422, sCF_422, true, 1 },
+    { sPF_YUVA444, sCF_444, true, 1 },
+    { sPF_YUVA420_16, sCF_420, true, 2 },
+    { sPF_YUVA422_16, sCF_422, true, 2 },
+    { sPF_YUVA444_16, sCF_444, true, 2 },
+  };
+
+  for (const auto &planarFormat : planarFormats)
+  {
+    if (planarFormat.format == format)
+    {
+      *pChromaFormat = planarFormat.chromaFormat;
+      *pAlpha = planarFormat.alpha;
+      *pBytesPerSample = planarFormat.bytesPerSample;
 
-swapResult swapEncodeFrameYUV420(IN uint8_t *pImage, OUT uint8_t *pUncompressedData, const size_t resX, const size_t resY, mango::ConcurrentQueue *pQueue);
-swapResult swapDecodeFrameYUV420(IN uint8_t *pUncompressedData, OUT uint8_t *pImage, const size_t resX, const size_t resY, mango::ConcurrentQueue *pQueue);
-swapResult swapCompressData(IN uint8_t *pData, OUT uint8_t *pCompressedData, IN_OUT size_t *pCompressedDataCapacity, OUT size_t *pCompressedDataLength);
-swapResult swapDecompressData(IN uint8_t *pCompressedData, const size_t compressedDataLength, OUT uint8_t *pUncompressedData, IN_OUT size_t *pUncompressedDataCompressedLength, OUT size_t *pUncompressedDataLength);
+      return true;
+    }
+  }
 
-//////////////////////////////////////////////////////////////////////////
+  return false;
+}
 
-swapEncoder * swapcodec::swapEncoder::Create(const std::string &filename, const size_t resX, const size_t resY)
+swapPixelFormat swapGetPlanarFormat(const swapChromaFormat chromaFormat, const bool alpha, const uint32_t bitDepth)
 {
-  swapEncoder *pEncoder = nullptr;
+  static const swapPixelFormat planarFormats[2][2][3] =
+  {
+    { { sPF_YUV420, sPF_YUV422, sPF_YUV444 }, { sPF_YUVA420, sPF_YUVA422, sPF_YUVA444 } },
+    { { sPF_YUV420_16, sPF_YUV422_16, sPF_YUV444_16 }, { sPF_YUVA420_16, sPF_YUVA422_16, sPF_YUVA444_16 } },
+  };
 
-  if ((resX & 63) != 0 || (resY & 63) != 0)
-    goto epilogue;
+  return planarFormats[bitDepth > 8 ? 1 : 0][alpha ? 1 : 0][chromaFormat];
+}
 
-  pEncoder = new swapEncoder();
-  
-  if (pEncoder == nullptr)
-    goto epilogue;
+void swapGetPlaneLayout(const size_t resX, const swapChromaFormat chromaFormat, const bool alpha, OUT swapPlaneLayout *pLayout)
+{
+  const size_t blockX = swapGetBlockCountX(resX);
+  const size_t chromaShiftX = chromaFormat == sCF_444 ? 0 : 1;
+  const size_t chromaShiftY = chromaFormat == sCF_420 ? 1 : 0;
 
-  pEncoder->filename = filename;
+  const size_t shifts[SWAP_MAX_PLANES][2] = { { 0, 0 }, { chromaShiftX, chromaShiftY }, { chromaShiftX, chromaShiftY }, { 0, 0 } };
 
-  pEncoder->resX = resX;
-  pEncoder->resY = resY;
-  pEncoder->lowResX = resX << 3;
-  pEncoder->lowResY = resY << 4;
+  pLayout->planeCount = alpha ? 4 : 3;
+  pLayout->blocksPerSlice = 0;
 
-  pEncoder->pCompressibleData = (uint8_t *)malloc(sizeof(uint8_t) * ((resX >> 3) * ((resY * 3 / 2) >> 3) * DCT_PER_BLOCK_SIZE));
+  for (size_t plane = 0; plane < pLayout->planeCount; plane++)
+  {
+    pLayout->planes[plane].shiftX = shifts[plane][0];
+    pLayout->planes[plane].shiftY = shifts[plane][1];
+    pLayout->planes[plane].blocksPerRow = blockX >> shifts[plane][0];
+    pLayout->planes[plane].blockRows = 2 >> shifts[plane][1];
+    pLayout->planes[plane].firstBlock = pLayout->blocksPerSlice;
+    pLayout->planes[plane].isChroma = plane == 1 || plane == 2;
+
+    pLayout->blocksPerSlice += pLayout->planes[plane].blocksPerRow * pLayout->planes[plane].blockRows;
+  }
+}
 
-  if (pEncoder->pCompressibleData == nullptr)
-    goto epilogue;
+void swapGetTileGrid(const size_t resX, const size_t resY, const size_t tileWidth, const size_t tileHeight, const swapChromaFormat chromaFormat, const bool alpha, const uint32_t bitDepth, const bool lossless, OUT swapTileGrid *pGrid)
+{
+  const size_t paddedResX = ((resX + 15) >> 4) << 4;
 
-  pEncoder->pThreadPool = new mango::ConcurrentQueue();
+  pGrid->tileWidth = tileWidth == 0 ? paddedResX : std::min(tileWidth, paddedResX);
+  pGrid->tileHeight = tileHeight == 0 ? SWAP_SLICE_HEIGHT : tileHeight;
+  pGrid->tilesX = (resX + pGrid->tileWidth - 1) / pGrid->tileWidth;
+  pGrid->tilesY = (resY + pGrid->tileHeight - 1) / pGrid->tileHeight;
+  pGrid->sliceCount = swapGetSliceCount(resY);
+  pGrid->slicesPerTile = pGrid->tileHeight / SWAP_SLICE_HEIGHT;
 
-  if (pEncoder->pThreadPool == nullptr)
-    goto epilogue;
+  swapGetPlaneLayout(pGrid->tileWidth, chromaFormat, alpha, &pGrid->columns[0]);
+  swapGetPlaneLayout(resX - (pGrid->tilesX - 1) * pGrid->tileWidth, chromaFormat, alpha, &pGrid->columns[1]);
 
-  return pEncoder;
+  pGrid->blocksPerSlice = (pGrid->tilesX - 1) * pGrid->columns[0].blocksPerSlice + pGrid->columns[1].blocksPerSlice;
+  pGrid->coefficientSize = swapGetCoefficientSize(bitDepth, lossless);
+  pGrid->blockSize = 64 * pGrid->coefficientSize;
+}
 
-epilogue:
-  if (pEncoder)
-    delete pEncoder;
+size_t swapcodec::swapGetImageSize(const swapPixelFormat format, const size_t resX, const size_t resY)
+{
+  swapChromaFormat chromaFormat;
+  bool alpha;
+  size_t bytesPerSample;
 
-  return nullptr;
+  if (swapGetPlanarFormatInfo(format, &chromaFormat, &alpha, &bytesPerSample))
+  {
+    const size_t chromaShiftX = chromaFormat == sCF_444 ? 0 : 1;
+    const size_t chromaShiftY = chromaFormat == sCF_420 ? 1 : 0;
+
+    return (resX * resY * (alpha ? 2 : 1) + swapGetPlaneSize(resX, chromaShiftX) * swapGetPlaneSize(resY, chromaShiftY) * 2) * bytesPerSample;
+  }
+
+  switch (format)
+  {
+  case sPF_NV12:
+    return swapGetImageSize(sPF_YUV420, resX, resY);
+
+  case sPF_BGRA:
+  case sPF_RGBA:
+    return resX * resY * 4;
+
+  case sPF_RGB24:
+    return resX * resY * 3;
+
+  default:
+    return 0;
+  }
 }
 
-swapcodec::swapEncoder::~swapEncoder()
+swapFrameDescriptor swapcodec::swapFrameDescriptor::Packed(const swapPixelFormat format, IN const uint8_t *pData, const size_t resX, const size_t resY)
 {
-  if (pCompressibleData)
-    free(pCompressibleData);
+  swapFrameDescriptor frame;
+  frame.format = format;
 
-  if (pThreadPool)
-    delete (mango::ConcurrentQueue *)pThreadPool;
-}
+  if (pData == nullptr)
+    return frame;
 
-void testDCT(uint8_t *, size_t, size_t);
+  swapChromaFormat chromaFormat;
+  bool alpha;
+  size_t bytesPerSample;
 
-swapResult swapcodec::swapEncoder::AddFrameYUV420(IN_OUT uint8_t *pFrameData)
-{
-  testDCT(pFrameData, resX, resY);
-  return sR_Success;
-  //  swapResult result = sR_Success;
-  //
-  //  if (sR_Success != (result = swapEncodeFrameYUV420(pFrameData, pCompressibleData, resX, resY, (mango::ConcurrentQueue *)pThreadPool)))
-  //    goto epilogue;
-  //
-  //  //swapMemcpy(pFrameData, pCompressibleData, resX * resY * 3 / 2);
-  //
-  //  if (sR_Success != (result = swapDecodeFrameYUV420(pCompressibleData, pFrameData, resX, resY, (mango::ConcurrentQueue *)pThreadPool)))
-  //    goto epilogue;
-  //
-  //epilogue:
-  //  return result;
+  if (swapGetPlanarFormatInfo(format, &chromaFormat, &alpha, &bytesPerSample))
+  {
+    swapPlaneLayout layout;
+    swapGetPlaneLayout(resX, chromaFormat, alpha, &layout);
+
+    for (size_t plane = 0; plane < layout.planeCount; plane++)
+    {
+      frame.pPlanes[plane] = pData;
+      frame.strides[plane] = swapGetPlaneSize(resX, layout.planes[plane].shiftX) * bytesPerSample;
+
+      pData += frame.strides[plane] * swapGetPlaneSize(resY, layout.planes[plane].shiftY);
+    }
+
+    return frame;
+  }
+
+  frame.pPlanes[0] = pData;
+
+  switch (format)
+  {
+  case sPF_NV12:
+    frame.pPlanes[1] = pData + resX * resY;
+    frame.strides[0] = resX;
+    frame.strides[1] = swapGetPlaneSize(resX, 1) * 2;
+    break;
+
+  default:
+    frame.strides[0] = swapGetImageSize(format, resX, 1);
+    break;
+  }
+
+  return frame;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-const uint8_t zigzag_table[] =
+swapFileSink * swapcodec::swapFileSink::Create(const std::string &filename)
 {
-  0,  1,   5,  6, 14, 15, 27, 28,
-  2,  4,   7, 13, 16, 26, 29, 42,
-  3,  8,  12, 17, 25, 30, 41, 43,
-  9,  11, 18, 24, 31, 40, 44, 53,
-  10, 19, 23, 32, 39, 45, 52, 54,
-  20, 22, 33, 38, 46, 51, 55, 60,
-  21, 34, 37, 47, 50, 56, 59, 61,
-  35, 36, 48, 49, 57, 58, 62, 63
-};
+  FILE *pFile = fopen(filename.c_str(), "wb");
 
-const uint8_t luminance_quant_table[] =
-{
-  16, 11, 10, 16,  24,  40,  51,  61,
-  12, 12, 14, 19,  26,  58,  60,  55,
-  14, 13, 16, 24,  40,  57,  69,  56,
-  14, 17, 22, 29,  51,  87,  80,  62,
-  18, 22, 37, 56,  68, 109, 103,  77,
-  24, 35, 55, 64,  81, 104, 113,  92,
-  49, 64, 78, 87, 103, 121, 120, 101,
-  72, 92, 95, 98, 112, 100, 103,  99
-};
+  if (pFile == nullptr)
+    return nullptr;
 
-const uint8_t chrominance_quant_table[] =
-{
-  17, 18, 24, 47, 99, 99, 99, 99,
-  18, 21, 26, 66, 99, 99, 99, 99,
-  24, 26, 56, 99, 99, 99, 99, 99,
-  47, 66, 99, 99, 99, 99, 99, 99,
-  99, 99, 99, 99, 99, 99, 99, 99,
-  99, 99, 99, 99, 99, 99, 99, 99,
-  99, 99, 99, 99, 99, 99, 99, 99,
-  99, 99, 99, 99, 99, 99, 99, 99
-};
+  swapFileSink *pSink = Create(pFile, true);
 
-void swapInitDctQuantizationTables(uint32_t quality, uint8_t *pLqt, uint8_t *pCqt, uint16_t *pILqt, uint16_t *pICqt)
-{
-  quality = std::min(quality, 1024u) * 16;
+  if (pSink == nullptr)
+    fclose(pFile);
 
-  for (size_t i = 0; i < 64; ++i)
-  {
-    uint16_t index = zigzag_table[i];
-    uint32_t value;
+  return pSink;
+}
 
-    // luminance quantization table * quality factor
-    value = luminance_quant_table[i] * quality;
-    value = (value + 0x200) >> 10;
+swapFileSink * swapcodec::swapFileSink::Create(IN FILE *pFile, const bool closeFile)
+{
+  if (pFile == nullptr)
+    return nullptr;
 
-    if (value < 2)
-      value = 2;
-    else if (value > 255)
-      value = 255;
+#ifdef _WIN32
+  // `stdout` and pipes from `_popen` start out in text mode, which would expand every 0x0A byte of the stream.
+  if (-1 == _setmode(_fileno(pFile), _O_BINARY))
+    return nullptr;
+#endif
 
-    pLqt[index] = (uint8_t)value;
-    pILqt[i] = static_cast<uint16_t>(0x8000 / value);
+  swapFileSink *pSink = new swapFileSink();
 
-    // chrominance quantization table * quality factor
-    value = chrominance_quant_table[i] * quality;
-    value = (value + 0x200) >> 10;
+  if (pSink == nullptr)
+    return nullptr;
 
-    if (value < 2)
-      value = 2;
-    else if (value > 255)
-      value = 255;
+  pSink->pFile = pFile;
+  pSink->closeFile = closeFile;
 
-    pCqt[index] = (uint8_t)value;
-    pICqt[i] = static_cast<uint16_t>(0x8000 / value);
-  }
+  return pSink;
 }
 
-void slapDCT(int16_t * pDestination, int16_t * pData, const uint16_t * pQuantizationTable)
+swapcodec::swapFileSink::~swapFileSink()
 {
-  const uint16_t c1 = 1420;  // cos  PI/16 * root(2)
-  const uint16_t c2 = 1338;  // cos  PI/8  * root(2)
-  const uint16_t c3 = 1204;  // cos 3PI/16 * root(2)
-  const uint16_t c5 = 805;   // cos 5PI/16 * root(2)
-  const uint16_t c6 = 554;   // cos 3PI/8  * root(2)
-  const uint16_t c7 = 283;   // cos 7PI/16 * root(2)
-
-  for (int32_t i = 0; i < 8; ++i)
+  if (pFile)
   {
-    int32_t x8 = pData[0] + pData[7];
-    int32_t x0 = pData[0] - pData[7];
-    int32_t x7 = pData[1] + pData[6];
-    int32_t x1 = pData[1] - pData[6];
-    int32_t x6 = pData[2] + pData[5];
-    int32_t x2 = pData[2] - pData[5];
-    int32_t x5 = pData[3] + pData[4];
-    int32_t x3 = pData[3] - pData[4];
-    int32_t x4 = x8 + x5;
+    fflush(pFile);
 
-    x8 = x8 - x5;
-    x5 = x7 + x6;
-    x7 = x7 - x6;
-
-    pData[0] = int16_t(x4 + x5);
-    pData[4] = int16_t(x4 - x5);
-    pData[2] = int16_t((x8 * c2 + x7 * c6) >> 10);
-    pData[6] = int16_t((x8 * c6 - x7 * c2) >> 10);
-    pData[7] = int16_t((x0 * c7 - x1 * c5 + x2 * c3 - x3 * c1) >> 10);
-    pData[5] = int16_t((x0 * c5 - x1 * c1 + x2 * c7 + x3 * c3) >> 10);
-    pData[3] = int16_t((x0 * c3 - x1 * c7 - x2 * c1 - x3 * c5) >> 10);
-    pData[1] = int16_t((x0 * c1 + x1 * c3 + x2 * c5 + x3 * c7) >> 10);
-    pData += 8;
+    if (closeFile)
+      fclose(pFile);
   }
+}
 
-  pData -= 64;
-
-  for (int32_t i = 0; i < 8; ++i)
-  {
-    int32_t x8 = pData[i + 0] + pData[i + 56];
-    int32_t x0 = pData[i + 0] - pData[i + 56];
-    int32_t x7 = pData[i + 8] + pData[i + 48];
-    int32_t x1 = pData[i + 8] - pData[i + 48];
-    int32_t x6 = pData[i + 16] + pData[i + 40];
-    int32_t x2 = pData[i + 16] - pData[i + 40];
-    int32_t x5 = pData[i + 24] + pData[i + 32];
-    int32_t x3 = pData[i + 24] - pData[i + 32];
-    int32_t x4 = x8 + x5;
+static swapResult swapFileSinkWrite(FILE *pFile, IN const uint8_t *pData, const size_t size)
+{
+  if (size != fwrite(pData, 1, size, pFile))
+    return sR_IOFailure;
 
-    x8 = x8 - x5;
-    x5 = x7 + x6;
-    x7 = x7 - x6;
+  return sR_Success;
+}
 
-    int16_t v0 = int16_t((x4 + x5) >> 3);
-    int16_t v4 = int16_t((x4 - x5) >> 3);
-    int16_t v2 = int16_t((x8 * c2 + x7 * c6) >> 13);
-    int16_t v6 = int16_t((x8 * c6 - x7 * c2) >> 13);
-    int16_t v7 = int16_t((x0 * c7 - x1 * c5 + x2 * c3 - x3 * c1) >> 13);
-    int16_t v5 = int16_t((x0 * c5 - x1 * c1 + x2 * c7 + x3 * c3) >> 13);
-    int16_t v3 = int16_t((x0 * c3 - x1 * c7 - x2 * c1 - x3 * c5) >> 13);
-    int16_t v1 = int16_t((x0 * c1 + x1 * c3 + x2 * c5 + x3 * c7) >> 13);
+swapResult swapcodec::swapFileSink::WriteHeader(IN const uint8_t *pData, const size_t size)
+{
+  return swapFileSinkWrite(pFile, pData, size);
+}
 
-    pDestination[/*zigzag_table[*/i + 0 * 8/*]*/] = int16_t((v0 * pQuantizationTable[i + 0 * 8] + 0x4000) >> 15);
-    pDestination[/*zigzag_table[*/i + 1 * 8/*]*/] = int16_t((v1 * pQuantizationTable[i + 1 * 8] + 0x4000) >> 15);
-    pDestination[/*zigzag_table[*/i + 2 * 8/*]*/] = int16_t((v2 * pQuantizationTable[i + 2 * 8] + 0x4000) >> 15);
-    pDestination[/*zigzag_table[*/i + 3 * 8/*]*/] = int16_t((v3 * pQuantizationTable[i + 3 * 8] + 0x4000) >> 15);
-    pDestination[/*zigzag_table[*/i + 4 * 8/*]*/] = int16_t((v4 * pQuantizationTable[i + 4 * 8] + 0x4000) >> 15);
-    pDestination[/*zigzag_table[*/i + 5 * 8/*]*/] = int16_t((v5 * pQuantizationTable[i + 5 * 8] + 0x4000) >> 15);
-    pDestination[/*zigzag_table[*/i + 6 * 8/*]*/] = int16_t((v6 * pQuantizationTable[i + 6 * 8] + 0x4000) >> 15);
-    pDestination[/*zigzag_table[*/i + 7 * 8/*]*/] = int16_t((v7 * pQuantizationTable[i + 7 * 8] + 0x4000) >> 15);
-  }
+swapResult swapcodec::swapFileSink::WriteFrame(const size_t /* frameIndex */, const bool /* isKeyframe */, IN const uint8_t *pData, const size_t size)
+{
+  return swapFileSinkWrite(pFile, pData, size);
 }
 
-void swapFormatMCUBlock(int16_t * pBlock, uint8_t * pInput, int rows, int cols, int incr)
+swapResult swapcodec::swapFileSink::WriteFramePart(const size_t /* frameIndex */, const bool /* isKeyframe */, IN const uint8_t *pData, const size_t size)
 {
-  for (int i = 0; i < rows; ++i)
-  {
-    for (int j = cols; j > 0; --j)
-    {
-      *pBlock++ = (*pInput++) - 128;
-    }
+  swapResult result = swapFileSinkWrite(pFile, pData, size);
 
-    // replicate last column
-    for (int j = 8 - cols; j > 0; --j)
-    {
-      *pBlock = *(pBlock - 1);
-      ++pBlock;
-    }
+  if (result == sR_Success && fflush(pFile) != 0)
+    result = sR_IOFailure;
 
-    pInput += incr;
-  }
+  return result;
+}
 
-  // replicate last row
-  for (int i = 8 - rows; i > 0; --i)
-  {
-    for (int j = 8; j > 0; --j)
-    {
-      *pBlock = *(pBlock - 8);
-      ++pBlock;
-    }
-  }
+swapResult swapcodec::swapFileSink::WriteIndex(IN const uint8_t *pData, const size_t size)
+{
+  swapResult result = swapFileSinkWrite(pFile, pData, size);
+
+  if (result == sR_Success && fflush(pFile) != 0)
+    result = sR_IOFailure;
+
+  return result;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-static const int _izigzag_table_standard[] =
+swapMemorySink * swapcodec::swapMemorySink::Create()
 {
-  0 , 1 , 8 , 16, 9 , 2 , 3 , 10, 17, 24, 32, 25, 18, 11, 4 , 5 ,
-  12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6 , 7 , 14, 21, 28,
-  35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
-  58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+  return new swapMemorySink();
+}
 
-  63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63,
-};
+swapcodec::swapMemorySink::~swapMemorySink()
+{
+  if (pData)
+    free(pData);
+}
 
-static const int _izigzag_table_variant[] =
+swapResult swapcodec::swapMemorySink::Append(IN const uint8_t *pAppendData, const size_t appendSize)
 {
-  0,  8,  1,  2,  9, 16, 24, 17, 10,  3,  4, 11, 18, 25, 32, 40,
-  33, 26, 19, 12,  5,  6, 13, 20, 27, 34, 41, 48, 56, 49, 42, 35,
-  28, 21, 14,  7, 15, 22, 29, 36, 43, 50, 57, 58, 51, 44, 37, 30,
-  23, 31, 38, 45, 52, 59, 60, 53, 46, 39, 47, 54, 61, 62, 55, 63,
+  if (size + appendSize > capacity)
+  {
+    const size_t newCapacity = std::max(size + appendSize, capacity * 2);
+    uint8_t *pNewData = (uint8_t *)realloc(pData, newCapacity);
 
-  63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63,
-};
+    if (pNewData == nullptr)
+      return sR_MemoryAllocationFailure;
 
-constexpr int _IDCT_PREC = 12;
-constexpr int _IDCT_HALF(int precision) { return (1 << ((precision)-1)); }
-constexpr int _IDCT_FIXED(double x) { return int((x * double(1 << _IDCT_PREC) + 0.5)); }
+    pData = pNewData;
+    capacity = newCapacity;
+  }
 
-constexpr int _IDCT_M_2_562915447 = _IDCT_FIXED(-2.562915447);
+  swapMemcpy(pData + size, pAppendData, appendSize);
+  size += appendSize;
+
+  return sR_Success;
+}
+
+swapResult swapcodec::swapMemorySink::WriteHeader(IN const uint8_t *pHeaderData, const size_t headerSize)
+{
+  return Append(pHeaderData, headerSize);
+}
+
+swapResult swapcodec::swapMemorySink::WriteFrame(const size_t /* frameIndex */, const bool /* isKeyframe */, IN const uint8_t *pFrameData, const size_t frameSize)
+{
+  return Append(pFrameData, frameSize);
+}
+
+swapResult swapcodec::swapMemorySink::WriteIndex(IN const uint8_t *pIndexData, const size_t indexSize)
+{
+  return Append(pIndexData, indexSize);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Frames being coded or waiting to be written. Repeated frames have no payload.
+struct swapEncodeJob
+{
+  size_t frameIndex;
+  bool isKeyframe;
+  bool isRepeat;
+  uint8_t *pCompressedData; // the frame header followed by the payload.
+  size_t compressedDataSize;
+  size_t ticket;
+  swapFrameCallbacks callbacks;
+};
+
+// Frames added with `AddFrameAsync` are hashed and transformed on a thread of their own. Tracks the completion of all frames added to the encoder in order.
+struct swapEncodeSubmitQueue
+{
+  struct swapSubmission
+  {
+    swapFrameDescriptor frame;
+    size_t ticket;
+    swapFrameCallbacks callbacks;
+  };
+
+  swapQueue<swapSubmission> submissions;
+  bool processing = false;
+  bool stop = false;
+
+  size_t submittedFrameCount = 0;
+  size_t completedFrameCount = 0;
+
+  // The first error of any frame.
+  swapResult result = sR_Success;
+
+  std::mutex mutex;
+  std::condition_variable condition;
+
+  // Started by the first call to `AddFrameAsync`.
+  std::thread thread;
+
+  ~swapEncodeSubmitQueue()
+  {
+    if (thread.joinable())
+      thread.join();
+  }
+};
+
+// Adds the queued frames before the thread exits.
+static void swapEncodeSubmitQueueStop(swapEncodeSubmitQueue *pSubmitQueue)
+{
+  {
+    std::lock_guard<std::mutex> lock(pSubmitQueue->mutex);
+    pSubmitQueue->stop = true;
+  }
+
+  pSubmitQueue->condition.notify_all();
+
+  if (pSubmitQueue->thread.joinable())
+    pSubmitQueue->thread.join();
+}
+
+// Frames complete in the order they were added, once they have been written or have failed.
+static void swapEncoderCompleteFrame(swapEncoder *pEncoder, const size_t ticket, const swapFrameCallbacks &callbacks, const swapResult result)
+{
+  swapEncodeSubmitQueue *pSubmitQueue = (swapEncodeSubmitQueue *)pEncoder->pSubmitQueue;
+
+  if (callbacks.pOnFrameWritten != nullptr)
+    callbacks.pOnFrameWritten(callbacks.pUserData, ticket, result);
+
+  std::lock_guard<std::mutex> lock(pSubmitQueue->mutex);
+
+  pSubmitQueue->completedFrameCount++;
+
+  if (result != sR_Success && pSubmitQueue->result == sR_Success)
+    pSubmitQueue->result = result;
+
+  pSubmitQueue->condition.notify_all();
+}
+
+// Writes the frames coded by `AddFrame` to the sink on a thread of its own, so coding the next frame overlaps writing them.
+struct swapEncodePipeline
+{
+  // `pipelineDepth` buffers for coded frames: one for the frame being coded and one for every frame waiting to be written.
+  std::vector<uint8_t *> buffers;
+  std::vector<uint8_t *> freeBuffers;
+
+  swapQueue<swapEncodeJob> jobs;
+  bool processing = false;
+  bool stop = false;
+
+  // The first error of the pipeline, returned by the next call to `AddFrame` or `Finalize`.
+  swapResult result = sR_Success;
+
+  std::mutex mutex;
+  std::condition_variable condition;
+
+  std::thread thread;
+
+  ~swapEncodePipeline()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop = true;
+    }
+
+    condition.notify_all();
+
+    if (thread.joinable())
+      thread.join();
+
+    // The first buffer belongs to the encoder.
+    for (size_t i = 1; i < buffers.size(); i++)
+      free(buffers[i]);
+  }
+};
+
+// Transforms and entropy codes a frame against the reference coefficients in a single pass over its tiles into `pJob->pCompressedData`, behind the frame header.
+// The coefficients of the frame are left in `pCompressibleData`.
+static swapResult swapEncoderCodeFrame(swapEncoder *pEncoder, IN_OUT swapEncodeJob *pJob, const swapFrameDescriptor &frame, swapTaskQueue *pQueue)
+{
+  swapResult result = sR_Success;
+  swapFrameHeader *pFrameHeader;
+  size_t payloadSize = 0;
+  swapTileGrid grid;
+
+  swapGetTileGrid(pEncoder->resX, pEncoder->resY, pEncoder->tileWidth, pEncoder->tileHeight, pEncoder->chromaFormat, pEncoder->alpha, pEncoder->bitDepth, pEncoder->lossless, &grid);
+
+  if (!pJob->isRepeat)
+    if (sR_Success != (result = swapEncodeCompressFrame(frame, pEncoder->pCompressibleData, pJob->isKeyframe ? nullptr : pEncoder->pLastFrameUncompressed, pJob->pCompressedData + sizeof(swapFrameHeader), pEncoder->compressedDataCapacity - sizeof(swapFrameHeader), &payloadSize, pEncoder->resX, pEncoder->resY, grid, pEncoder->quality, pEncoder->bitDepth, pEncoder->lossless, pEncoder->progressive, pQueue)))
+      goto epilogue;
+
+  pFrameHeader = reinterpret_cast<swapFrameHeader *>(pJob->pCompressedData);
+  pFrameHeader->magic = swapFrameHeaderMagic;
+  pFrameHeader->frameIndex = (uint32_t)pJob->frameIndex;
+  pFrameHeader->flags = pJob->isKeyframe ? sFF_Keyframe : (pJob->isRepeat ? sFF_Repeat : sFF_None);
+  pFrameHeader->tileCount = pJob->isRepeat ? 0 : (uint32_t)(grid.tilesX * grid.tilesY);
+  pFrameHeader->payloadSize = payloadSize;
+
+  pJob->compressedDataSize = sizeof(swapFrameHeader) + payloadSize;
+
+epilogue:
+  return result;
+}
+
+// Writes a coded frame to the sink and adds it to the index.
+static swapResult swapEncoderWriteFrame(swapEncoder *pEncoder, const swapEncodeJob &job)
+{
+  swapResult result = sR_Success;
+  swapIndexEntry indexEntry;
+
+  if (sR_Success != (result = pEncoder->pSink->WriteFrame(job.frameIndex, job.isKeyframe, job.pCompressedData, job.compressedDataSize)))
+    goto epilogue;
+
+  pEncoder->compressedDataSize = job.compressedDataSize;
+
+  indexEntry.offset = pEncoder->streamOffset;
+  indexEntry.size = job.compressedDataSize;
+  indexEntry.flags = reinterpret_cast<const swapFrameHeader *>(job.pCompressedData)->flags;
+  pEncoder->index.push_back(indexEntry);
+
+  pEncoder->streamOffset += job.compressedDataSize;
+
+epilogue:
+  return result;
+}
+
+// Moves the planes of `frame` down by `y` lines, which have to be even.
+static swapFrameDescriptor swapOffsetFrameLines(const swapFrameDescriptor &frame, const size_t y, const size_t chromaShiftY)
+{
+  swapFrameDescriptor lines = frame;
+
+  for (size_t plane = 0; plane < 4; plane++)
+    if (lines.pPlanes[plane] != nullptr)
+      lines.pPlanes[plane] += ((plane == 1 || plane == 2) ? (y >> chromaShiftY) : y) * lines.strides[plane];
+
+  return lines;
+}
+
+// Transforms, entropy codes and writes a low latency frame row of tiles by row of tiles. Every worker codes whole rows, taking the next row once it's done with one,
+// and whoever completes the next row to be written writes it along with the completed rows following it, so rows reach the sink in order as early as possible.
+static swapResult swapEncoderWriteFrameLowLatency(swapEncoder *pEncoder, const swapFrameDescriptor &frame, const swapEncodeJob &job, IN uint8_t *pReference, swapTaskQueue *pQueue)
+{
+  swapResult result = sR_Success;
+  swapFrameHeader *pFrameHeader;
+  swapIndexEntry indexEntry;
+  swapTileGrid grid;
+  size_t rowCapacity;
+  size_t rowCoefficientSize;
+  size_t frameSize = sizeof(swapFrameHeader);
+  size_t nextRowToWrite = 0;
+  std::atomic<size_t> nextRowToCode(0);
+  std::atomic<bool> failed(false);
+  size_t *pRowSizes;
+  std::mutex writeMutex;
+  swapArenaScope scope;
+
+  const size_t chromaShiftY = pEncoder->chromaFormat == sCF_420 ? 1 : 0;
+
+  swapGetTileGrid(pEncoder->resX, pEncoder->resY, pEncoder->tileWidth, pEncoder->tileHeight, pEncoder->chromaFormat, pEncoder->alpha, pEncoder->bitDepth, pEncoder->lossless, &grid);
+
+  // Every row is coded into its own share of the buffer for a frame, which leaves room for the slice header as rows don't need the tables of progressive bands.
+  rowCapacity = ((pEncoder->compressedDataCapacity - sizeof(swapFrameHeader)) / grid.tilesY) & ~(size_t)(sizeof(uint32_t) - 1);
+  rowCoefficientSize = grid.slicesPerTile * grid.blocksPerSlice * grid.blockSize;
+  pRowSizes = swapArenaAllocArray<size_t>(grid.tilesY);
+
+  if (pRowSizes == nullptr)
+  {
+    result = sR_MemoryAllocationFailure;
+    goto epilogue;
+  }
+
+  memset(pRowSizes, 0, grid.tilesY * sizeof(size_t));
+
+  pFrameHeader = reinterpret_cast<swapFrameHeader *>(pEncoder->pCompressedData);
+  pFrameHeader->magic = swapFrameHeaderMagic;
+  pFrameHeader->frameIndex = (uint32_t)job.frameIndex;
+  pFrameHeader->flags = job.isKeyframe ? sFF_Keyframe : sFF_None;
+  pFrameHeader->tileCount = (uint32_t)(grid.tilesX * grid.tilesY);
+  pFrameHeader->payloadSize = 0;
+
+  if (sR_Success != (result = pEncoder->pSink->WriteFramePart(job.frameIndex, job.isKeyframe, pEncoder->pCompressedData, sizeof(swapFrameHeader))))
+    goto epilogue;
+
+  swapParallelFor(pQueue, std::min(grid.tilesY, swapGetTaskQueueThreadCount(pQueue) + 1), [&](const size_t /* worker */) {
+
+    while (!failed)
+    {
+      const size_t row = nextRowToCode++;
+
+      if (row >= grid.tilesY)
+        return;
+
+      const size_t y = row * grid.tileHeight;
+      const size_t height = std::min(grid.tileHeight, pEncoder->resY - y);
+      uint8_t *pRow = pEncoder->pCompressedData + sizeof(swapFrameHeader) + row * rowCapacity;
+      uint8_t *pCoefficients = pEncoder->pCompressibleData + row * rowCoefficientSize;
+      swapSliceHeader *pSliceHeader = reinterpret_cast<swapSliceHeader *>(pRow);
+      size_t payloadSize = 0;
+      swapTileGrid rowGrid;
+
+      // A row of tiles is coded like a frame of its own with a single row of tiles, on this worker alone.
+      swapGetTileGrid(pEncoder->resX, height, pEncoder->tileWidth, pEncoder->tileHeight, pEncoder->chromaFormat, pEncoder->alpha, pEncoder->bitDepth, pEncoder->lossless, &rowGrid);
+
+      const swapResult rowResult = swapEncodeCompressFrame(swapOffsetFrameLines(frame, y, chromaShiftY), pCoefficients, job.isKeyframe ? nullptr : pReference + row * rowCoefficientSize, pRow + sizeof(swapSliceHeader), rowCapacity - sizeof(swapSliceHeader), &payloadSize, pEncoder->resX, height, rowGrid, pEncoder->quality, pEncoder->bitDepth, pEncoder->lossless, false, nullptr);
+
+      pSliceHeader->magic = swapSliceHeaderMagic;
+      pSliceHeader->tileRow = (uint32_t)row;
+      pSliceHeader->payloadSize = (uint32_t)payloadSize;
+
+      std::lock_guard<std::mutex> lock(writeMutex);
+
+      if (rowResult != sR_Success)
+      {
+        if (result == sR_Success)
+          result = rowResult;
+
+        failed = true;
+        return;
+      }
+
+      pRowSizes[row] = sizeof(swapSliceHeader) + payloadSize;
+
+      while (result == sR_Success && nextRowToWrite < grid.tilesY && pRowSizes[nextRowToWrite] != 0)
+      {
+        result = pEncoder->pSink->WriteFramePart(job.frameIndex, job.isKeyframe, pEncoder->pCompressedData + sizeof(swapFrameHeader) + nextRowToWrite * rowCapacity, pRowSizes[nextRowToWrite]);
+
+        frameSize += pRowSizes[nextRowToWrite];
+        nextRowToWrite++;
+      }
+
+      if (result != sR_Success)
+        failed = true;
+    }
+  });
+
+  if (result != sR_Success)
+    goto epilogue;
+
+  pEncoder->compressedDataSize = frameSize;
+
+  indexEntry.offset = pEncoder->streamOffset;
+  indexEntry.size = frameSize;
+  indexEntry.flags = pFrameHeader->flags;
+  pEncoder->index.push_back(indexEntry);
+
+  pEncoder->streamOffset += frameSize;
+
+epilogue:
+  return result;
+}
+
+static void swapEncodePipelineThread(swapEncoder *pEncoder, swapEncodePipeline *pPipeline)
+{
+  std::unique_lock<std::mutex> lock(pPipeline->mutex);
+
+  while (true)
+  {
+    if (pPipeline->jobs.empty())
+    {
+      if (pPipeline->stop)
+        return;
+
+      pPipeline->condition.wait(lock);
+      continue;
+    }
+
+    const swapEncodeJob job = pPipeline->jobs.front();
+    pPipeline->jobs.pop_front();
+    pPipeline->processing = true;
+
+    // Frames following an error are dropped, as the stream can't be continued anyway.
+    const bool failed = pPipeline->result != sR_Success;
+
+    lock.unlock();
+
+    const swapResult result = failed ? pPipeline->result : swapEncoderWriteFrame(pEncoder, job);
+
+    swapEncoderCompleteFrame(pEncoder, job.ticket, job.callbacks, result);
+
+    lock.lock();
+
+    pPipeline->freeBuffers.push_back(job.pCompressedData);
+
+    if (result != sR_Success && pPipeline->result == sR_Success)
+      pPipeline->result = result;
+
+    pPipeline->processing = false;
+    pPipeline->condition.notify_all();
+  }
+}
+
+// Waits for all queued frames to be written and returns the first error of the pipeline.
+static swapResult swapEncodePipelineFlush(swapEncodePipeline *pPipeline)
+{
+  std::unique_lock<std::mutex> lock(pPipeline->mutex);
+
+  while (!pPipeline->jobs.empty() || pPipeline->processing)
+    pPipeline->condition.wait(lock);
+
+  return pPipeline->result;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+swapEncoder * swapcodec::swapEncoder::Create(const std::string &filename, const size_t resX, const size_t resY, const size_t iframeStep)
+{
+  swapEncoderOptions options;
+  options.iframeStep = iframeStep;
+
+  return Create(filename, resX, resY, options);
+}
+
+swapEncoder * swapcodec::swapEncoder::Create(const std::string &filename, const size_t resX, const size_t resY, const swapEncoderOptions &options)
+{
+  swapFileSink *pSink = swapFileSink::Create(filename);
+
+  if (pSink == nullptr)
+    return nullptr;
+
+  swapEncoder *pEncoder = Create(pSink, resX, resY, options);
+
+  if (pEncoder == nullptr)
+  {
+    delete pSink;
+    return nullptr;
+  }
+
+  pEncoder->ownsSink = true;
+
+  return pEncoder;
+}
+
+swapEncoder * swapcodec::swapEncoder::Create(IN swapSink *pSink, const size_t resX, const size_t resY, const size_t iframeStep)
+{
+  swapEncoderOptions options;
+  options.iframeStep = iframeStep;
+
+  return Create(pSink, resX, resY, options);
+}
+
+swapEncoder * swapcodec::swapEncoder::Create(IN swapSink *pSink, const size_t resX, const size_t resY, const swapEncoderOptions &options)
+{
+  swapEncoder *pEncoder = nullptr;
+  swapStreamHeader header;
+  swapTileGrid grid;
+  size_t coefficientDataSize;
+
+  if (pSink == nullptr || (options.lowLatency && options.progressive) || options.iframeStep == 0 || options.iframeStep > UINT32_MAX || options.bitDepth < 8 || options.bitDepth > 16 || options.chromaFormat > sCF_444 || (options.tileWidth & 15) != 0 || (options.tileHeight % SWAP_SLICE_HEIGHT) != 0)
+    goto epilogue;
+
+  if (resX == 0 || resY == 0 || resX > UINT32_MAX || resY > UINT32_MAX)
+    goto epilogue;
+
+  pEncoder = new swapEncoder();
+  
+  if (pEncoder == nullptr)
+    goto epilogue;
+
+  pEncoder->pSink = pSink;
+
+  pEncoder->resX = resX;
+  pEncoder->resY = resY;
+  pEncoder->lowResX = resX << 3;
+  pEncoder->lowResY = resY << 4;
+  pEncoder->iframeStep = options.iframeStep;
+  pEncoder->quality = SWAP_DEFAULT_QUALITY;
+  pEncoder->bitDepth = options.bitDepth;
+  pEncoder->chromaFormat = options.chromaFormat;
+  pEncoder->alpha = options.alpha;
+  pEncoder->progressive = options.progressive;
+  pEncoder->lossless = options.lossless;
+  pEncoder->lowLatency = options.lowLatency;
+
+  swapGetTileGrid(resX, resY, options.tileWidth, options.tileHeight, options.chromaFormat, options.alpha, options.bitDepth, options.lossless, &grid);
+
+  pEncoder->tileWidth = grid.tileWidth;
+  pEncoder->tileHeight = grid.tileHeight;
+
+  coefficientDataSize = sizeof(uint8_t) * (grid.sliceCount * grid.blocksPerSlice * grid.blockSize);
+
+  pEncoder->pCompressibleData = (uint8_t *)malloc(coefficientDataSize);
+
+  if (pEncoder->pCompressibleData == nullptr)
+    goto epilogue;
+
+  pEncoder->pLastFrameUncompressed = (uint8_t *)malloc(coefficientDataSize);
+
+  if (pEncoder->pLastFrameUncompressed == nullptr)
+    goto epilogue;
+
+  // Every band of every tile is compressed into a buffer large enough for a full tile before they're packed.
+  pEncoder->compressedDataCapacity = swapGetMaxFrameSize(grid);
+  pEncoder->pCompressedData = (uint8_t *)malloc(pEncoder->compressedDataCapacity);
+
+  if (pEncoder->pCompressedData == nullptr)
+    goto epilogue;
+
+  pEncoder->pTaskQueue = swapCreateTaskQueue(options.pThreadPool, options.priority);
+
+  if (pEncoder->pTaskQueue == nullptr)
+    goto epilogue;
+
+  swapFirstTouch((swapTaskQueue *)pEncoder->pTaskQueue, pEncoder->pCompressibleData, coefficientDataSize);
+  swapFirstTouch((swapTaskQueue *)pEncoder->pTaskQueue, pEncoder->pLastFrameUncompressed, coefficientDataSize);
+  swapFirstTouch((swapTaskQueue *)pEncoder->pTaskQueue, pEncoder->pCompressedData, pEncoder->compressedDataCapacity);
+
+  pEncoder->pSubmitQueue = new swapEncodeSubmitQueue();
+
+  if (pEncoder->pSubmitQueue == nullptr)
+    goto epilogue;
+
+  if (options.pipelineDepth > 1 && !options.lowLatency)
+  {
+    swapEncodePipeline *pPipeline = new swapEncodePipeline();
+
+    if (pPipeline == nullptr)
+      goto epilogue;
+
+    pEncoder->pPipeline = pPipeline;
+
+    pPipeline->buffers.push_back(pEncoder->pCompressedData);
+
+    while (pPipeline->buffers.size() < options.pipelineDepth)
+    {
+      uint8_t *pBuffer = (uint8_t *)malloc(pEncoder->compressedDataCapacity);
+
+      if (pBuffer == nullptr)
+        goto epilogue;
+
+      pPipeline->buffers.push_back(pBuffer);
+      swapFirstTouch((swapTaskQueue *)pEncoder->pTaskQueue, pBuffer, pEncoder->compressedDataCapacity);
+    }
+
+    pPipeline->freeBuffers = pPipeline->buffers;
+    pPipeline->thread = std::thread(swapEncodePipelineThread, pEncoder, pPipeline);
+  }
+
+  header.magic = swapStreamHeaderMagic;
+  header.version = swapStreamVersion;
+  header.flags = (uint16_t)((options.alpha ? sSF_Alpha : sSF_None) | (options.progressive ? sSF_Progressive : sSF_None) | (options.lossless ? sSF_Lossless : sSF_None) | (options.lowLatency ? sSF_LowLatency : sSF_None));
+  header.resX = (uint32_t)resX;
+  header.resY = (uint32_t)resY;
+  header.iframeStep = (uint32_t)options.iframeStep;
+  header.quality = pEncoder->quality;
+  header.bitDepth = pEncoder->bitDepth;
+  header.chromaFormat = (uint32_t)pEncoder->chromaFormat;
+  header.tileWidth = (uint32_t)grid.tileWidth;
+  header.tileHeight = (uint32_t)grid.tileHeight;
+
+  if (sR_Success != pSink->WriteHeader(reinterpret_cast<const uint8_t *>(&header), sizeof(header)))
+    goto epilogue;
+
+  pEncoder->streamOffset = sizeof(header);
+
+  return pEncoder;
+
+epilogue:
+  if (pEncoder)
+    delete pEncoder;
+
+  return nullptr;
+}
+
+swapcodec::swapEncoder::~swapEncoder()
+{
+  // Adds the queued frames and writes the frames that are still in flight before the buffers are freed.
+  if (pSubmitQueue)
+    swapEncodeSubmitQueueStop((swapEncodeSubmitQueue *)pSubmitQueue);
+
+  if (pPipeline)
+    delete (swapEncodePipeline *)pPipeline;
+
+  // The pipeline completes its frames in the submit queue.
+  if (pSubmitQueue)
+    delete (swapEncodeSubmitQueue *)pSubmitQueue;
+
+  if (pCompressibleData)
+    free(pCompressibleData);
+
+  if (pLastFrameUncompressed)
+    free(pLastFrameUncompressed);
+
+  if (pCompressedData)
+    free(pCompressedData);
+
+  if (pTaskQueue)
+    swapDestroyTaskQueue((swapTaskQueue *)pTaskQueue);
+
+  if (pSink && ownsSink)
+    delete pSink;
+}
+
+static bool swapIsValidFrameDescriptor(const swapFrameDescriptor &frame, const size_t resX, const uint32_t bitDepth, const swapChromaFormat chromaFormat, const bool alpha)
+{
+  swapChromaFormat frameChromaFormat;
+  bool frameAlpha;
+  size_t bytesPerSample;
+
+  if (swapGetPlanarFormatInfo(frame.format, &frameChromaFormat, &frameAlpha, &bytesPerSample))
+  {
+    // Planar frames are encoded as-is and have to match the stream exactly.
+    if (frameChromaFormat != chromaFormat || frameAlpha != alpha || (bytesPerSample == 2) != (bitDepth > 8))
+      return false;
+
+    swapPlaneLayout layout;
+    swapGetPlaneLayout(resX, chromaFormat, alpha, &layout);
+
+    for (size_t plane = 0; plane < layout.planeCount; plane++)
+      if (frame.pPlanes[plane] == nullptr || frame.strides[plane] < swapGetPlaneSize(resX, layout.planes[plane].shiftX) * bytesPerSample || (frame.strides[plane] & (bytesPerSample - 1)) != 0)
+        return false;
+
+    return true;
+  }
+
+  // Interleaved formats are only converted into 8 bit 4:2:0 streams.
+  if (bitDepth > 8 || chromaFormat != sCF_420)
+    return false;
+
+  switch (frame.format)
+  {
+  case sPF_NV12:
+    return !alpha && frame.pPlanes[0] != nullptr && frame.pPlanes[1] != nullptr && frame.strides[0] >= resX && frame.strides[1] >= swapGetPlaneSize(resX, 1) * 2;
+
+  case sPF_BGRA:
+  case sPF_RGBA:
+    return frame.pPlanes[0] != nullptr && frame.strides[0] >= resX * 4;
+
+  default:
+    return false;
+  }
+}
+
+swapResult swapcodec::swapEncoder::AddFrameYUV420(IN const uint8_t *pFrameData)
+{
+  return AddFrame(swapFrameDescriptor::Packed(sPF_YUV420, pFrameData, resX, resY));
+}
+
+swapResult swapcodec::swapEncoder::AddFrameBGRA(IN const uint8_t *pFrameData)
+{
+  return AddFrame(swapFrameDescriptor::Packed(sPF_BGRA, pFrameData, resX, resY));
+}
+
+swapResult swapcodec::swapEncoder::AddFrameRGBA(IN const uint8_t *pFrameData)
+{
+  return AddFrame(swapFrameDescriptor::Packed(sPF_RGBA, pFrameData, resX, resY));
+}
+
+swapResult swapcodec::swapEncoder::AddFrameNV12(IN const uint8_t *pFrameData)
+{
+  return AddFrame(swapFrameDescriptor::Packed(sPF_NV12, pFrameData, resX, resY));
+}
+
+static swapResult swapEncoderAddFrame(swapEncoder *pEncoder, const swapFrameDescriptor &frame, const size_t ticket, const swapFrameCallbacks &callbacks)
+{
+  swapResult result = sR_Success;
+  swapEncodePipeline *pEncodePipeline = (swapEncodePipeline *)pEncoder->pPipeline;
+  swapTaskQueue *pQueue = (swapTaskQueue *)pEncoder->pTaskQueue;
+  bool inputReleased = false;
+  bool handedOff = false;
+  swapEncodeJob job;
+  swapTileGrid grid;
+  uint64_t frameHash;
+
+  swapGetTileGrid(pEncoder->resX, pEncoder->resY, pEncoder->tileWidth, pEncoder->tileHeight, pEncoder->chromaFormat, pEncoder->alpha, pEncoder->bitDepth, pEncoder->lossless, &grid);
+
+  if (sR_Success != (result = swapHashFrame(frame, pEncoder->resX, pEncoder->resY, &frameHash, pQueue)))
+    goto epilogue;
+
+  job.frameIndex = pEncoder->currentFrameIndex;
+  job.isKeyframe = (pEncoder->currentFrameIndex % pEncoder->iframeStep) == 0;
+  job.isRepeat = !job.isKeyframe && pEncoder->lastFrameHashValid && frameHash == pEncoder->lastFrameHash;
+
+  // Lossless streams have to reproduce every frame exactly, so a matching hash only makes a repeat once the coefficients of the frame turn out to be the ones of the previous frame.
+  if (job.isRepeat && pEncoder->lossless)
+    if (sR_Success != (result = swapEncodeMatchesReference(frame, pEncoder->pCompressibleData, pEncoder->pLastFrameUncompressed, &job.isRepeat, pEncoder->resX, pEncoder->resY, grid, pEncoder->quality, pEncoder->bitDepth, pEncoder->lossless, pQueue)))
+      goto epilogue;
+
+  job.pCompressedData = pEncoder->pCompressedData;
+  job.compressedDataSize = 0;
+  job.ticket = ticket;
+  job.callbacks = callbacks;
+
+  if (pEncodePipeline != nullptr)
+  {
+    // Wait for a free buffer for the coded frame, which caps the number of frames in flight.
+    {
+      std::unique_lock<std::mutex> lock(pEncodePipeline->mutex);
+
+      while (pEncodePipeline->freeBuffers.empty() && pEncodePipeline->result == sR_Success)
+        pEncodePipeline->condition.wait(lock);
+
+      if (sR_Success != (result = pEncodePipeline->result))
+        goto epilogue;
+
+      job.pCompressedData = pEncodePipeline->freeBuffers.back();
+      pEncodePipeline->freeBuffers.pop_back();
+    }
+
+    result = swapEncoderCodeFrame(pEncoder, &job, frame, pQueue);
+
+    // The frame has been read by the single pass that codes it; only writing it is left.
+    if (callbacks.pOnInputReleased != nullptr)
+      callbacks.pOnInputReleased(callbacks.pUserData, ticket);
+
+    inputReleased = true;
+
+    std::lock_guard<std::mutex> lock(pEncodePipeline->mutex);
+
+    if (result == sR_Success)
+      result = pEncodePipeline->result;
+
+    if (result != sR_Success)
+    {
+      pEncodePipeline->freeBuffers.push_back(job.pCompressedData);
+      goto epilogue;
+    }
+
+    pEncodePipeline->jobs.push_back(job);
+    pEncodePipeline->condition.notify_all();
+    handedOff = true;
+  }
+  else
+  {
+    if (pEncoder->lowLatency && !job.isRepeat)
+      result = swapEncoderWriteFrameLowLatency(pEncoder, frame, job, pEncoder->pLastFrameUncompressed, pQueue);
+    else if (sR_Success == (result = swapEncoderCodeFrame(pEncoder, &job, frame, pQueue)))
+      result = swapEncoderWriteFrame(pEncoder, job);
+
+    if (callbacks.pOnInputReleased != nullptr)
+      callbacks.pOnInputReleased(callbacks.pUserData, ticket);
+
+    inputReleased = true;
+
+    swapEncoderCompleteFrame(pEncoder, ticket, callbacks, result);
+    handedOff = true;
+
+    if (result != sR_Success)
+      goto epilogue;
+  }
+
+  // The coefficients of this frame are the reference for the next one. Repeated frames leave the reference untouched, as it's the one of the repeated frame.
+  if (!job.isRepeat)
+    std::swap(pEncoder->pCompressibleData, pEncoder->pLastFrameUncompressed);
+
+  pEncoder->currentFrameIndex++;
+
+  pEncoder->lastFrameHash = frameHash;
+  pEncoder->lastFrameHashValid = true;
+
+epilogue:
+  if (!inputReleased && callbacks.pOnInputReleased != nullptr)
+    callbacks.pOnInputReleased(callbacks.pUserData, ticket);
+
+  if (!handedOff)
+    swapEncoderCompleteFrame(pEncoder, ticket, callbacks, result);
+
+  return result;
+}
+
+static void swapEncodeSubmitThread(swapEncoder *pEncoder, swapEncodeSubmitQueue *pSubmitQueue)
+{
+  std::unique_lock<std::mutex> lock(pSubmitQueue->mutex);
+
+  while (true)
+  {
+    if (pSubmitQueue->submissions.empty())
+    {
+      if (pSubmitQueue->stop)
+        break;
+
+      pSubmitQueue->condition.wait(lock);
+      continue;
+    }
+
+    const swapEncodeSubmitQueue::swapSubmission submission = pSubmitQueue->submissions.front();
+    pSubmitQueue->submissions.pop_front();
+    pSubmitQueue->processing = true;
+
+    lock.unlock();
+
+    // Errors are recorded by `swapEncoderCompleteFrame`.
+    swapEncoderAddFrame(pEncoder, submission.frame, submission.ticket, submission.callbacks);
+
+    lock.lock();
+
+    pSubmitQueue->processing = false;
+    pSubmitQueue->condition.notify_all();
+  }
+}
+
+swapResult swapcodec::swapEncoder::AddFrame(const swapFrameDescriptor &frame)
+{
+  swapResult result = sR_Success;
+  swapEncodeSubmitQueue *pQueue = (swapEncodeSubmitQueue *)pSubmitQueue;
+  size_t ticket;
+
+  if (finalized || !swapIsValidFrameDescriptor(frame, resX, bitDepth, chromaFormat, alpha))
+  {
+    result = sR_InvalidParameter;
+    goto epilogue;
+  }
+
+  // Frames queued with `AddFrameAsync` are added first to keep the frames in order.
+  {
+    std::unique_lock<std::mutex> lock(pQueue->mutex);
+
+    while (!pQueue->submissions.empty() || pQueue->processing)
+      pQueue->condition.wait(lock);
+
+    ticket = pQueue->submittedFrameCount++;
+  }
+
+  result = swapEncoderAddFrame(this, frame, ticket, swapFrameCallbacks());
+
+epilogue:
+  return result;
+}
+
+swapResult swapcodec::swapEncoder::AddFrameAsync(const swapFrameDescriptor &frame, OUT size_t *pTicket, const swapFrameCallbacks &callbacks)
+{
+  swapResult result = sR_Success;
+  swapEncodeSubmitQueue *pQueue = (swapEncodeSubmitQueue *)pSubmitQueue;
+  swapEncodeSubmitQueue::swapSubmission submission;
+
+  if (finalized || !swapIsValidFrameDescriptor(frame, resX, bitDepth, chromaFormat, alpha))
+  {
+    result = sR_InvalidParameter;
+    goto epilogue;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(pQueue->mutex);
+
+    if (sR_Success != (result = pQueue->result))
+      goto epilogue;
+
+    submission.frame = frame;
+    submission.ticket = pQueue->submittedFrameCount++;
+    submission.callbacks = callbacks;
+
+    pQueue->submissions.push_back(submission);
+
+    if (!pQueue->thread.joinable())
+      pQueue->thread = std::thread(swapEncodeSubmitThread, this, pQueue);
+
+    pQueue->condition.notify_all();
+  }
+
+  if (pTicket != nullptr)
+    *pTicket = submission.ticket;
+
+epilogue:
+  return result;
+}
+
+swapResult swapcodec::swapEncoder::WaitForFrame(const size_t ticket)
+{
+  swapEncodeSubmitQueue *pQueue = (swapEncodeSubmitQueue *)pSubmitQueue;
+  std::unique_lock<std::mutex> lock(pQueue->mutex);
+
+  if (ticket >= pQueue->submittedFrameCount)
+    return sR_InvalidParameter;
+
+  while (pQueue->completedFrameCount <= ticket)
+    pQueue->condition.wait(lock);
+
+  return pQueue->result;
+}
+
+swapResult swapcodec::swapEncoder::Flush()
+{
+  swapEncodeSubmitQueue *pQueue = (swapEncodeSubmitQueue *)pSubmitQueue;
+  std::unique_lock<std::mutex> lock(pQueue->mutex);
+
+  while (pQueue->completedFrameCount < pQueue->submittedFrameCount)
+    pQueue->condition.wait(lock);
+
+  return pQueue->result;
+}
+
+swapResult swapcodec::swapEncoder::Finalize()
+{
+  swapResult result = sR_Success;
+  uint8_t *pIndexData = nullptr;
+  size_t indexDataSize;
+  swapIndexHeader indexHeader;
+  swapStreamTrailer trailer;
+
+  if (finalized)
+  {
+    result = sR_InvalidParameter;
+    goto epilogue;
+  }
+
+  if (sR_Success != (result = Flush()))
+    goto epilogue;
+
+  if (pPipeline != nullptr)
+    if (sR_Success != (result = swapEncodePipelineFlush((swapEncodePipeline *)pPipeline)))
+      goto epilogue;
+
+  indexDataSize = sizeof(indexHeader) + index.size() * sizeof(swapIndexEntry) + sizeof(trailer);
+  pIndexData = (uint8_t *)malloc(indexDataSize);
+
+  if (pIndexData == nullptr)
+  {
+    result = sR_MemoryAllocationFailure;
+    goto epilogue;
+  }
+
+  indexHeader.magic = swapIndexHeaderMagic;
+  indexHeader.frameCount = (uint32_t)index.size();
+
+  trailer.indexOffset = streamOffset;
+  trailer.frameCount = (uint32_t)index.size();
+  trailer.magic = swapStreamTrailerMagic;
+
+  swapMemcpy(pIndexData, &indexHeader, sizeof(indexHeader));
+
+  if (index.size() > 0)
+    swapMemcpy(pIndexData + sizeof(indexHeader), index.data(), index.size() * sizeof(swapIndexEntry));
+
+  swapMemcpy(pIndexData + indexDataSize - sizeof(trailer), &trailer, sizeof(trailer));
+
+  if (sR_Success != (result = pSink->WriteIndex(pIndexData, indexDataSize)))
+    goto epilogue;
+
+  streamOffset += indexDataSize;
+  finalized = true;
+
+epilogue:
+  if (pIndexData)
+    free(pIndexData);
+
+  return result;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+const uint8_t zigzag_table[] =
+{
+  0,  1,   5,  6, 14, 15, 27, 28,
+  2,  4,   7, 13, 16, 26, 29, 42,
+  3,  8,  12, 17, 25, 30, 41, 43,
+  9,  11, 18, 24, 31, 40, 44, 53,
+  10, 19, 23, 32, 39, 45, 52, 54,
+  20, 22, 33, 38, 46, 51, 55, 60,
+  21, 34, 37, 47, 50, 56, 59, 61,
+  35, 36, 48, 49, 57, 58, 62, 63
+};
+
+const uint8_t luminance_quant_table[] =
+{
+  16, 11, 10, 16,  24,  40,  51,  61,
+  12, 12, 14, 19,  26,  58,  60,  55,
+  14, 13, 16, 24,  40,  57,  69,  56,
+  14, 17, 22, 29,  51,  87,  80,  62,
+  18, 22, 37, 56,  68, 109, 103,  77,
+  24, 35, 55, 64,  81, 104, 113,  92,
+  49, 64, 78, 87, 103, 121, 120, 101,
+  72, 92, 95, 98, 112, 100, 103,  99
+};
+
+const uint8_t chrominance_quant_table[] =
+{
+  17, 18, 24, 47, 99, 99, 99, 99,
+  18, 21, 26, 66, 99, 99, 99, 99,
+  24, 26, 56, 99, 99, 99, 99, 99,
+  47, 66, 99, 99, 99, 99, 99, 99,
+  99, 99, 99, 99, 99, 99, 99, 99,
+  99, 99, 99, 99, 99, 99, 99, 99,
+  99, 99, 99, 99, 99, 99, 99, 99,
+  99, 99, 99, 99, 99, 99, 99, 99
+};
+
+void swapInitDctQuantizationTables(uint32_t quality, uint8_t *pLqt, uint8_t *pCqt, uint16_t *pILqt, uint16_t *pICqt)
+{
+  quality = std::min(quality, 1024u) * 16;
+
+  for (size_t i = 0; i < 64; ++i)
+  {
+    uint16_t index = zigzag_table[i];
+    uint32_t value;
+
+    // luminance quantization table * quality factor
+    value = luminance_quant_table[i] * quality;
+    value = (value + 0x200) >> 10;
+
+    if (value < 2)
+      value = 2;
+    else if (value > 255)
+      value = 255;
+
+    pLqt[index] = (uint8_t)value;
+    pILqt[i] = static_cast<uint16_t>(0x8000 / value);
+
+    // chrominance quantization table * quality factor
+    value = chrominance_quant_table[i] * quality;
+    value = (value + 0x200) >> 10;
+
+    if (value < 2)
+      value = 2;
+    else if (value > 255)
+      value = 255;
+
+    pCqt[index] = (uint8_t)value;
+    pICqt[i] = static_cast<uint16_t>(0x8000 / value);
+  }
+}
+
+void swapInitDequantizationTables(const uint32_t quality, OUT uint16_t *pLdqt, OUT uint16_t *pCdqt)
+{
+  uint8_t Lqt[64];
+  uint8_t Cqt[64];
+  uint16_t ILqt[64];
+  uint16_t ICqt[64];
+
+  swapInitDctQuantizationTables(quality, Lqt, Cqt, ILqt, ICqt);
+
+  for (size_t i = 0; i < 64; i++)
+  {
+    pLdqt[i] = Lqt[zigzag_table[i]];
+    pCdqt[i] = Cqt[zigzag_table[i]];
+  }
+}
+
+void slapDCT(int16_t * pDestination, int16_t * pData, const uint16_t * pQuantizationTable)
+{
+  const uint16_t c1 = 1420;  // cos  PI/16 * root(2)
+  const uint16_t c2 = 1338;  // cos  PI/8  * root(2)
+  const uint16_t c3 = 1204;  // cos 3PI/16 * root(2)
+  const uint16_t c5 = 805;   // cos 5PI/16 * root(2)
+  const uint16_t c6 = 554;   // cos 3PI/8  * root(2)
+  const uint16_t c7 = 283;   // cos 7PI/16 * root(2)
+
+  for (int32_t i = 0; i < 8; ++i)
+  {
+    int32_t x8 = pData[0] + pData[7];
+    int32_t x0 = pData[0] - pData[7];
+    int32_t x7 = pData[1] + pData[6];
+    int32_t x1 = pData[1] - pData[6];
+    int32_t x6 = pData[2] + pData[5];
+    int32_t x2 = pData[2] - pData[5];
+    int32_t x5 = pData[3] + pData[4];
+    int32_t x3 = pData[3] - pData[4];
+    int32_t x4 = x8 + x5;
+
+    x8 = x8 - x5;
+    x5 = x7 + x6;
+    x7 = x7 - x6;
+
+    pData[0] = int16_t(x4 + x5);
+    pData[4] = int16_t(x4 - x5);
+    pData[2] = int16_t((x8 * c2 + x7 * c6) >> 10);
+    pData[6] = int16_t((x8 * c6 - x7 * c2) >> 10);
+    pData[7] = int16_t((x0 * c7 - x1 * c5 + x2 * c3 - x3 * c1) >> 10);
+    pData[5] = int16_t((x0 * c5 - x1 * c1 + x2 * c7 + x3 * c3) >> 10);
+    pData[3] = int16_t((x0 * c3 - x1 * c7 - x2 * c1 - x3 * c5) >> 10);
+    pData[1] = int16_t((x0 * c1 + x1 * c3 + x2 * c5 + x3 * c7) >> 10);
+    pData += 8;
+  }
+
+  pData -= 64;
+
+  for (int32_t i = 0; i < 8; ++i)
+  {
+    int32_t x8 = pData[i + 0] + pData[i + 56];
+    int32_t x0 = pData[i + 0] - pData[i + 56];
+    int32_t x7 = pData[i + 8] + pData[i + 48];
+    int32_t x1 = pData[i + 8] - pData[i + 48];
+    int32_t x6 = pData[i + 16] + pData[i + 40];
+    int32_t x2 = pData[i + 16] - pData[i + 40];
+    int32_t x5 = pData[i + 24] + pData[i + 32];
+    int32_t x3 = pData[i + 24] - pData[i + 32];
+    int32_t x4 = x8 + x5;
+
+    x8 = x8 - x5;
+    x5 = x7 + x6;
+    x7 = x7 - x6;
+
+    int16_t v0 = int16_t((x4 + x5) >> 3);
+    int16_t v4 = int16_t((x4 - x5) >> 3);
+    int16_t v2 = int16_t((x8 * c2 + x7 * c6) >> 13);
+    int16_t v6 = int16_t((x8 * c6 - x7 * c2) >> 13);
+    int16_t v7 = int16_t((x0 * c7 - x1 * c5 + x2 * c3 - x3 * c1) >> 13);
+    int16_t v5 = int16_t((x0 * c5 - x1 * c1 + x2 * c7 + x3 * c3) >> 13);
+    int16_t v3 = int16_t((x0 * c3 - x1 * c7 - x2 * c1 - x3 * c5) >> 13);
+    int16_t v1 = int16_t((x0 * c1 + x1 * c3 + x2 * c5 + x3 * c7) >> 13);
+
+    pDestination[/*zigzag_table[*/i + 0 * 8/*]*/] = int16_t((v0 * pQuantizationTable[i + 0 * 8] + 0x4000) >> 15);
+    pDestination[/*zigzag_table[*/i + 1 * 8/*]*/] = int16_t((v1 * pQuantizationTable[i + 1 * 8] + 0x4000) >> 15);
+    pDestination[/*zigzag_table[*/i + 2 * 8/*]*/] = int16_t((v2 * pQuantizationTable[i + 2 * 8] + 0x4000) >> 15);
+    pDestination[/*zigzag_table[*/i + 3 * 8/*]*/] = int16_t((v3 * pQuantizationTable[i + 3 * 8] + 0x4000) >> 15);
+    pDestination[/*zigzag_table[*/i + 4 * 8/*]*/] = int16_t((v4 * pQuantizationTable[i + 4 * 8] + 0x4000) >> 15);
+    pDestination[/*zigzag_table[*/i + 5 * 8/*]*/] = int16_t((v5 * pQuantizationTable[i + 5 * 8] + 0x4000) >> 15);
+    pDestination[/*zigzag_table[*/i + 6 * 8/*]*/] = int16_t((v6 * pQuantizationTable[i + 6 * 8] + 0x4000) >> 15);
+    pDestination[/*zigzag_table[*/i + 7 * 8/*]*/] = int16_t((v7 * pQuantizationTable[i + 7 * 8] + 0x4000) >> 15);
+  }
+}
+
+void swapFormatMCUBlock(int16_t * pBlock, const uint8_t * pInput, int rows, int cols, int incr)
+{
+  for (int i = 0; i < rows; ++i)
+  {
+    for (int j = cols; j > 0; --j)
+    {
+      *pBlock++ = (*pInput++) - 128;
+    }
+
+    // replicate last column
+    for (int j = 8 - cols; j > 0; --j)
+    {
+      *pBlock = *(pBlock - 1);
+      ++pBlock;
+    }
+
+    pInput += incr;
+  }
+
+  // replicate last row
+  for (int i = 8 - rows; i > 0; --i)
+  {
+    for (int j = 8; j > 0; --j)
+    {
+      *pBlock = *(pBlock - 8);
+      ++pBlock;
+    }
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+const int _izigzag_table_standard[] =
+{
+  0 , 1 , 8 , 16, 9 , 2 , 3 , 10, 17, 24, 32, 25, 18, 11, 4 , 5 ,
+  12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6 , 7 , 14, 21, 28,
+  35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+  58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+
+  63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63,
+};
+
+static const int _izigzag_table_variant[] =
+{
+  0,  8,  1,  2,  9, 16, 24, 17, 10,  3,  4, 11, 18, 25, 32, 40,
+  33, 26, 19, 12,  5,  6, 13, 20, 27, 34, 41, 48, 56, 49, 42, 35,
+  28, 21, 14,  7, 15, 22, 29, 36, 43, 50, 57, 58, 51, 44, 37, 30,
+  23, 31, 38, 45, 52, 59, 60, 53, 46, 39, 47, 54, 61, 62, 55, 63,
+
+  63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63,
+};
+
+const size_t swapProgressiveBands[SWAP_PROGRESSIVE_BAND_COUNT + 1] = { 0, 1, 6, 28, 64 };
+const size_t swapSequentialBands[2] = { 0, 64 };
+
+constexpr int _IDCT_PREC = 12;
+constexpr int _IDCT_HALF(int precision) { return (1 << ((precision)-1)); }
+constexpr int _IDCT_FIXED(double x) { return int((x * double(1 << _IDCT_PREC) + 0.5)); }
+
+constexpr int _IDCT_M_2_562915447 = _IDCT_FIXED(-2.562915447);
 constexpr int _IDCT_M_1_961570560 = _IDCT_FIXED(-1.961570560);
 constexpr int _IDCT_M_1_847759065 = _IDCT_FIXED(-1.847759065);
 constexpr int _IDCT_M_0_899976223 = _IDCT_FIXED(-0.899976223);
@@ -333,326 +1455,1654 @@ constexpr int _IDCT_P_1_501321110 = _IDCT_FIXED(1.501321110);
 constexpr int _IDCT_P_2_053119869 = _IDCT_FIXED(2.053119869);
 constexpr int _IDCT_P_3_072711026 = _IDCT_FIXED(3.072711026);
 
-// Keep 2 bits of extra precision for the intermediate results
-constexpr int _IDCT_COL_NORM = (_IDCT_PREC - 2);
-constexpr int _IDCT_COL_BIAS = _IDCT_HALF(_IDCT_COL_NORM);
+// Keep 2 bits of extra precision for the intermediate results
+constexpr int _IDCT_COL_NORM = (_IDCT_PREC - 2);
+constexpr int _IDCT_COL_BIAS = _IDCT_HALF(_IDCT_COL_NORM);
+
+// Consume 2 bits of an intermediate results precision and 3 bits that were
+// produced by `2 * sqrt(8)`. Also normalize to from `-128..127` to `0..255`
+constexpr int _IDCT_ROW_NORM = (_IDCT_PREC + 2 + 3);
+constexpr int _IDCT_ROW_BIAS = (_IDCT_HALF(_IDCT_ROW_NORM) + (128 << _IDCT_ROW_NORM));
+
+#define _CONST16_SSE2(x, y)  _mm_setr_epi16(x, y, x, y, x, y, x, y)
+#define _CONST32_SSE2(x)     _mm_setr_epi32(x, x, x, x)
+
+static const __m128i rot0_0 = _CONST16_SSE2(_IDCT_P_0_541196100, _IDCT_P_0_541196100 + _IDCT_M_1_847759065);
+static const __m128i rot0_1 = _CONST16_SSE2(_IDCT_P_0_541196100 + _IDCT_P_0_765366865, _IDCT_P_0_541196100);
+static const __m128i rot1_0 = _CONST16_SSE2(_IDCT_P_1_175875602 + _IDCT_M_0_899976223, _IDCT_P_1_175875602);
+static const __m128i rot1_1 = _CONST16_SSE2(_IDCT_P_1_175875602, _IDCT_P_1_175875602 + _IDCT_M_2_562915447);
+static const __m128i rot2_0 = _CONST16_SSE2(_IDCT_M_1_961570560 + _IDCT_P_0_298631336, _IDCT_M_1_961570560);
+static const __m128i rot2_1 = _CONST16_SSE2(_IDCT_M_1_961570560, _IDCT_M_1_961570560 + _IDCT_P_3_072711026);
+static const __m128i rot3_0 = _CONST16_SSE2(_IDCT_M_0_390180644 + _IDCT_P_2_053119869, _IDCT_M_0_390180644);
+static const __m128i rot3_1 = _CONST16_SSE2(_IDCT_M_0_390180644, _IDCT_M_0_390180644 + _IDCT_P_1_501321110);
+static const __m128i colBias = _CONST32_SSE2(_IDCT_COL_BIAS);
+static const __m128i rowBias = _CONST32_SSE2(_IDCT_ROW_BIAS);
+
+#define _IDCT_ROTATE_XMM(dst0, dst1, x, y, c0, c1) \
+    __m128i c0##_l = _mm_unpacklo_epi16(x, y); \
+    __m128i c0##_h = _mm_unpackhi_epi16(x, y); \
+    __m128i dst0##_l = _mm_madd_epi16(c0##_l, c0); \
+    __m128i dst0##_h = _mm_madd_epi16(c0##_h, c0); \
+    __m128i dst1##_l = _mm_madd_epi16(c0##_l, c1); \
+    __m128i dst1##_h = _mm_madd_epi16(c0##_h, c1);
+
+// out = in << 12  (in 16-bit, out 32-bit)
+#define _IDCT_WIDEN_XMM(dst, in) \
+    __m128i dst##_l = _mm_srai_epi32(_mm_unpacklo_epi16(_mm_setzero_si128(), (in)), 4); \
+    __m128i dst##_h = _mm_srai_epi32(_mm_unpackhi_epi16(_mm_setzero_si128(), (in)), 4);
+
+// wide add
+#define _IDCT_WADD_XMM(dst, a, b) \
+    __m128i dst##_l = _mm_add_epi32(a##_l, b##_l); \
+    __m128i dst##_h = _mm_add_epi32(a##_h, b##_h);
+
+// wide sub
+#define _IDCT_WSUB_XMM(dst, a, b) \
+    __m128i dst##_l = _mm_sub_epi32(a##_l, b##_l); \
+    __m128i dst##_h = _mm_sub_epi32(a##_h, b##_h);
+
+// butterfly a/b, add bias, then shift by `norm` and pack to 16-bit
+#define _IDCT_BFLY_XMM(dst0, dst1, a, b, bias, norm) { \
+    __m128i abiased_l = _mm_add_epi32(a##_l, bias); \
+    __m128i abiased_h = _mm_add_epi32(a##_h, bias); \
+    _IDCT_WADD_XMM(sum, abiased, b) \
+    _IDCT_WSUB_XMM(diff, abiased, b) \
+    dst0 = _mm_packs_epi32(_mm_srai_epi32(sum_l, norm), _mm_srai_epi32(sum_h, norm)); \
+    dst1 = _mm_packs_epi32(_mm_srai_epi32(diff_l, norm), _mm_srai_epi32(diff_h, norm)); \
+    }
+
+#define _IDCT_IDCT_PASS_XMM(bias, norm) { \
+    _IDCT_ROTATE_XMM(t2e, t3e, v2, v6, rot0_0, rot0_1) \
+    __m128i sum04 = _mm_add_epi16(v0, v4); \
+    __m128i dif04 = _mm_sub_epi16(v0, v4); \
+    _IDCT_WIDEN_XMM(t0e, sum04) \
+    _IDCT_WIDEN_XMM(t1e, dif04) \
+    _IDCT_WADD_XMM(x0, t0e, t3e) \
+    _IDCT_WSUB_XMM(x3, t0e, t3e) \
+    _IDCT_WADD_XMM(x1, t1e, t2e) \
+    _IDCT_WSUB_XMM(x2, t1e, t2e) \
+    _IDCT_ROTATE_XMM(y0o, y2o, v7, v3, rot2_0, rot2_1) \
+    _IDCT_ROTATE_XMM(y1o, y3o, v5, v1, rot3_0, rot3_1) \
+    __m128i sum17 = _mm_add_epi16(v1, v7); \
+    __m128i sum35 = _mm_add_epi16(v3, v5); \
+    _IDCT_ROTATE_XMM(y4o,y5o, sum17, sum35, rot1_0, rot1_1) \
+    _IDCT_WADD_XMM(x4, y0o, y4o) \
+    _IDCT_WADD_XMM(x5, y1o, y5o) \
+    _IDCT_WADD_XMM(x6, y2o, y5o) \
+    _IDCT_WADD_XMM(x7, y3o, y4o) \
+    _IDCT_BFLY_XMM(v0, v7, x0, x7, bias, norm) \
+    _IDCT_BFLY_XMM(v1, v6, x1, x6, bias, norm) \
+    _IDCT_BFLY_XMM(v2, v5, x2, x5, bias, norm) \
+    _IDCT_BFLY_XMM(v3, v4, x3, x4, bias, norm) \
+    }
+
+static inline void interleave8(__m128i &a, __m128i &b)
+{
+  __m128i c = a;
+  a = _mm_unpacklo_epi8(a, b);
+  b = _mm_unpackhi_epi8(c, b);
+}
+
+static inline void interleave16(__m128i &a, __m128i &b)
+{
+  __m128i c = a;
+  a = _mm_unpacklo_epi16(a, b);
+  b = _mm_unpackhi_epi16(c, b);
+}
+
+void idct_sse2(uint8_t* dest, int stride, const int16_t* src, const uint16_t* qt)
+{
+  const __m128i* data = reinterpret_cast<const __m128i *>(src);
+  const __m128i* qtable = reinterpret_cast<const __m128i *>(qt);
+
+  // Load and dequantize
+  __m128i v0 = _mm_mullo_epi16(data[0], qtable[0]);
+  __m128i v1 = _mm_mullo_epi16(data[1], qtable[1]);
+  __m128i v2 = _mm_mullo_epi16(data[2], qtable[2]);
+  __m128i v3 = _mm_mullo_epi16(data[3], qtable[3]);
+  __m128i v4 = _mm_mullo_epi16(data[4], qtable[4]);
+  __m128i v5 = _mm_mullo_epi16(data[5], qtable[5]);
+  __m128i v6 = _mm_mullo_epi16(data[6], qtable[6]);
+  __m128i v7 = _mm_mullo_epi16(data[7], qtable[7]);
+
+  // IDCT columns
+  _IDCT_IDCT_PASS_XMM(colBias, 10);
+
+  // Transpose
+  interleave16(v0, v4);
+  interleave16(v2, v6);
+  interleave16(v1, v5);
+  interleave16(v3, v7);
+
+  interleave16(v0, v2);
+  interleave16(v1, v3);
+  interleave16(v4, v6);
+  interleave16(v5, v7);
+
+  interleave16(v0, v1);
+  interleave16(v2, v3);
+  interleave16(v4, v5);
+  interleave16(v6, v7);
+
+  // IDCT rows
+  _IDCT_IDCT_PASS_XMM(rowBias, 17);
+
+  // Pack to 8-bit integers, also saturates the result to 0..255
+  __m128i s0 = _mm_packus_epi16(v0, v1);
+  __m128i s1 = _mm_packus_epi16(v2, v3);
+  __m128i s2 = _mm_packus_epi16(v4, v5);
+  __m128i s3 = _mm_packus_epi16(v6, v7);
+
+  // Transpose
+  interleave8(s0, s2);
+  interleave8(s1, s3);
+  interleave8(s0, s1);
+  interleave8(s2, s3);
+  interleave8(s0, s2);
+  interleave8(s1, s3);
+
+  // Store
+  _mm_storel_epi64(reinterpret_cast<__m128i *>(dest + 0 * stride), s0);
+  _mm_storel_epi64(reinterpret_cast<__m128i *>(dest + 1 * stride), _mm_srli_si128(s0, 8));
+  _mm_storel_epi64(reinterpret_cast<__m128i *>(dest + 2 * stride), s2);
+  _mm_storel_epi64(reinterpret_cast<__m128i *>(dest + 3 * stride), _mm_srli_si128(s2, 8));
+  _mm_storel_epi64(reinterpret_cast<__m128i *>(dest + 4 * stride), s1);
+  _mm_storel_epi64(reinterpret_cast<__m128i *>(dest + 5 * stride), _mm_srli_si128(s1, 8));
+  _mm_storel_epi64(reinterpret_cast<__m128i *>(dest + 6 * stride), s3);
+  _mm_storel_epi64(reinterpret_cast<__m128i *>(dest + 7 * stride), _mm_srli_si128(s3, 8));
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Quantization steps in natural order for high bit depth samples: the steps of 8 bit streams applied to the samples as they are, so every extra bit of the samples is kept.
+// The transform of 16 bit samples quantized with the smallest step still fits into 32 bit coefficients, so the steps don't have to be scaled.
+void swapInitHighBitDepthQuantizationTables(uint32_t quality, OUT float *pLqt, OUT float *pCqt)
+{
+  uint8_t Lqt[64];
+  uint8_t Cqt[64];
+  uint16_t ILqt[64];
+  uint16_t ICqt[64];
+
+  swapInitDctQuantizationTables(quality, Lqt, Cqt, ILqt, ICqt);
+
+  for (size_t i = 0; i < 64; i++)
+  {
+    pLqt[i] = (float)Lqt[zigzag_table[i]];
+    pCqt[i] = (float)Cqt[zigzag_table[i]];
+  }
+}
+
+// Orthonormal 8x8 DCT-II basis: `c[u][x] = s(u) * cos((2x + 1) * u * pi / 16)` and its transpose.
+struct swapDctBasis
+{
+  alignas(16) float c[8][8];
+  alignas(16) float ct[8][8];
+};
+
+static const swapDctBasis & swapGetDctBasis()
+{
+  static const swapDctBasis basis = []
+  {
+    swapDctBasis b;
+
+    for (size_t u = 0; u < 8; u++)
+    {
+      for (size_t x = 0; x < 8; x++)
+      {
+        b.c[u][x] = (float)((u == 0 ? sqrt(1.0 / 8.0) : sqrt(2.0 / 8.0)) * cos((2.0 * x + 1.0) * u * 3.14159265358979323846 / 16.0));
+        b.ct[x][u] = b.c[u][x];
+      }
+    }
+
+    return b;
+  }();
+
+  return basis;
+}
+
+// Transforms and quantizes a block of zero centered samples with 32 bit floating point intermediates, as 16 bit lanes would overflow for more than 8 bits per sample.
+void swapDctHighBitDepth(OUT int32_t *pCoefficients, IN const int32_t *pBlock, IN const float *pInverseQt)
+{
+  const swapDctBasis &basis = swapGetDctBasis();
+  __m128 rows[8][2];
+
+  // Rows: T = X * C^T.
+  for (size_t y = 0; y < 8; y++)
+  {
+    __m128 lo = _mm_setzero_ps();
+    __m128 hi = _mm_setzero_ps();
+
+    for (size_t k = 0; k < 8; k++)
+    {
+      const __m128 x = _mm_set1_ps((float)pBlock[y * 8 + k]);
+
+      lo = _mm_add_ps(lo, _mm_mul_ps(x, _mm_load_ps(basis.ct[k])));
+      hi = _mm_add_ps(hi, _mm_mul_ps(x, _mm_load_ps(basis.ct[k] + 4)));
+    }
+
+    rows[y][0] = lo;
+    rows[y][1] = hi;
+  }
+
+  // Columns: Y = C * T.
+  for (size_t u = 0; u < 8; u++)
+  {
+    __m128 lo = _mm_setzero_ps();
+    __m128 hi = _mm_setzero_ps();
+
+    for (size_t k = 0; k < 8; k++)
+    {
+      const __m128 c = _mm_set1_ps(basis.c[u][k]);
+
+      lo = _mm_add_ps(lo, _mm_mul_ps(c, rows[k][0]));
+      hi = _mm_add_ps(hi, _mm_mul_ps(c, rows[k][1]));
+    }
+
+    lo = _mm_mul_ps(lo, _mm_loadu_ps(pInverseQt + u * 8));
+    hi = _mm_mul_ps(hi, _mm_loadu_ps(pInverseQt + u * 8 + 4));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(pCoefficients + u * 8), _mm_cvtps_epi32(lo));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(pCoefficients + u * 8 + 4), _mm_cvtps_epi32(hi));
+  }
+}
+
+// Dequantizes and inverse transforms a block into `bitDepth` bit samples with 32 bit floating point intermediates. `stride` is in samples.
+void swapIdctHighBitDepth(OUT uint16_t *pDestination, const size_t stride, IN const int32_t *pCoefficients, IN const float *pQt, const uint32_t bitDepth)
+{
+  const swapDctBasis &basis = swapGetDctBasis();
+  __m128 rows[8][2];
+
+  // Rows: S = Y * C.
+  for (size_t u = 0; u < 8; u++)
+  {
+    __m128 lo = _mm_setzero_ps();
+    __m128 hi = _mm_setzero_ps();
+
+    for (size_t k = 0; k < 8; k++)
+    {
+      const __m128 y = _mm_set1_ps((float)pCoefficients[u * 8 + k] * pQt[u * 8 + k]);
+
+      lo = _mm_add_ps(lo, _mm_mul_ps(y, _mm_load_ps(basis.c[k])));
+      hi = _mm_add_ps(hi, _mm_mul_ps(y, _mm_load_ps(basis.c[k] + 4)));
+    }
+
+    rows[u][0] = lo;
+    rows[u][1] = hi;
+  }
+
+  const __m128 bias = _mm_set1_ps((float)(1 << (bitDepth - 1)));
+  const __m128 maxValue = _mm_set1_ps((float)((1 << bitDepth) - 1));
+  const __m128i unsignedOffset = _mm_set1_epi32(0x8000);
+  const __m128i signFlip = _mm_set1_epi16(-0x8000);
+
+  // Columns: X = C^T * S.
+  for (size_t y = 0; y < 8; y++)
+  {
+    __m128 lo = bias;
+    __m128 hi = bias;
+
+    for (size_t k = 0; k < 8; k++)
+    {
+      const __m128 c = _mm_set1_ps(basis.ct[y][k]);
+
+      lo = _mm_add_ps(lo, _mm_mul_ps(c, rows[k][0]));
+      hi = _mm_add_ps(hi, _mm_mul_ps(c, rows[k][1]));
+    }
+
+    lo = _mm_min_ps(_mm_max_ps(lo, _mm_setzero_ps()), maxValue);
+    hi = _mm_min_ps(_mm_max_ps(hi, _mm_setzero_ps()), maxValue);
+
+    // SSE2 can only pack with signed saturation, so the samples are offset into the signed range and back.
+    const __m128i packed = _mm_packs_epi32(_mm_sub_epi32(_mm_cvtps_epi32(lo), unsignedOffset), _mm_sub_epi32(_mm_cvtps_epi32(hi), unsignedOffset));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(pDestination + y * stride), _mm_xor_si128(packed, signFlip));
+  }
+}
+
+// Rounds `bitDepth` bit samples to 8 bits.
+void swapNarrowSamples(IN const uint16_t *pSource, OUT uint8_t *pDestination, const size_t count, const uint32_t bitDepth)
+{
+  const __m128i shift = _mm_cvtsi32_si128((int)bitDepth - 9);
+  const __m128i zero = _mm_setzero_si128();
+
+  size_t i = 0;
+
+  // (x >> (shift - 1) + 1) >> 1 rounds without overflowing 16 bits.
+  for (; i + 16 <= count; i += 16)
+  {
+    const __m128i lo = _mm_avg_epu16(_mm_srl_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pSource + i)), shift), zero);
+    const __m128i hi = _mm_avg_epu16(_mm_srl_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pSource + i + 8)), shift), zero);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(pDestination + i), _mm_packus_epi16(lo, hi));
+  }
+
+  for (; i < count; i++)
+    pDestination[i] = (uint8_t)std::min(((pSource[i] >> (bitDepth - 9)) + 1) >> 1, 255);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Lossless blocks hold the residuals of the median edge detector (LOCO-I) prediction of every sample from its left, top and top left neighbour within the block.
+// The first line is predicted from the left, the first column from the top and the first sample not at all; residuals wrap around modulo `1 << bitDepth`.
+
+static inline int32_t swapWrapResidual(const int32_t value, const uint32_t bitDepth)
+{
+  return (int32_t)((uint32_t)value << (32 - bitDepth)) >> (32 - bitDepth);
+}
+
+static inline int32_t swapPredictMED(const int32_t a, const int32_t b, const int32_t c)
+{
+  const int32_t mn = std::min(a, b);
+  const int32_t mx = std::max(a, b);
+
+  return c >= mx ? mn : (c <= mn ? mx : a + b - c);
+}
+
+void swapPredictBlockLossless(OUT int16_t *pResiduals, IN const int16_t *pBlock, const uint32_t bitDepth)
+{
+  const __m128i shift = _mm_cvtsi32_si128(16 - (int)bitDepth);
+  const __m128i firstLane = _mm_set_epi16(0, 0, 0, 0, 0, 0, 0, -1);
+
+  __m128i top = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pBlock));
+  __m128i residual = _mm_sub_epi16(top, _mm_slli_si128(top, 2));
+
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(pResiduals), _mm_sra_epi16(_mm_sll_epi16(residual, shift), shift));
+
+  for (size_t y = 1; y < 8; y++)
+  {
+    const __m128i line = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pBlock + y * 8));
+
+    // The first column has no left neighbour, MED(top, top, top) predicts it from the top.
+    const __m128i topFirst = _mm_and_si128(top, firstLane);
+    const __m128i a = _mm_or_si128(_mm_slli_si128(line, 2), topFirst);
+    const __m128i c = _mm_or_si128(_mm_slli_si128(top, 2), topFirst);
+    const __m128i mn = _mm_min_epi16(a, top);
+    const __m128i mx = _mm_max_epi16(a, top);
+
+    // `a + b - c` may wrap around, but is only selected if it lies between `mn` and `mx`.
+    const __m128i gradient = _mm_sub_epi16(_mm_add_epi16(a, top), c);
+    const __m128i lessThanMax = _mm_cmpgt_epi16(mx, c);
+    const __m128i greaterThanMin = _mm_cmpgt_epi16(c, mn);
+    const __m128i inner = _mm_or_si128(_mm_and_si128(greaterThanMin, gradient), _mm_andnot_si128(greaterThanMin, mx));
+    const __m128i prediction = _mm_or_si128(_mm_and_si128(lessThanMax, inner), _mm_andnot_si128(lessThanMax, mn));
+
+    residual = _mm_sub_epi16(line, prediction);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(pResiduals + y * 8), _mm_sra_epi16(_mm_sll_epi16(residual, shift), shift));
+
+    top = line;
+  }
+}
+
+// Every sample depends on its reconstructed left neighbour, so the prediction is undone sample by sample.
+template <typename TSample>
+static void swapUnpredictBlock(OUT TSample *pDestination, const size_t stride, IN const int16_t *pResiduals, const uint32_t bitDepth)
+{
+  const int32_t bias = 1 << (bitDepth - 1);
+  int32_t block[64];
+
+  for (size_t y = 0; y < 8; y++)
+  {
+    for (size_t x = 0; x < 8; x++)
+    {
+      int32_t prediction;
+
+      if (y == 0)
+        prediction = x == 0 ? 0 : block[x - 1];
+      else if (x == 0)
+        prediction = block[(y - 1) * 8];
+      else
+        prediction = swapPredictMED(block[y * 8 + x - 1], block[(y - 1) * 8 + x], block[(y - 1) * 8 + x - 1]);
+
+      block[y * 8 + x] = swapWrapResidual(prediction + pResiduals[y * 8 + x], bitDepth);
+    }
+
+    for (size_t x = 0; x < 8; x++)
+      pDestination[y * stride + x] = (TSample)(block[y * 8 + x] + bias);
+  }
+}
+
+void swapReconstructBlockLossless(OUT uint8_t *pDestination, const size_t stride, IN const int16_t *pResiduals, const uint32_t bitDepth)
+{
+  swapUnpredictBlock(pDestination, stride, pResiduals, bitDepth);
+}
+
+void swapReconstructBlockLossless(OUT uint16_t *pDestination, const size_t stride, IN const int16_t *pResiduals, const uint32_t bitDepth)
+{
+  swapUnpredictBlock(pDestination, stride, pResiduals, bitDepth);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Limited range YUV to RGB in 2.13 fixed point: Y, V to R, U to G, V to G, U to B.
+static const int16_t swapYUVToRGBCoefficients[][5] =
+{
+  { 9535, 13074, 3211, 6660, 16523 }, // BT.601
+  { 9535, 14688, 1745, 4366, 17302 }, // BT.709
+};
+
+// Matches `_mm_mulhi_epi16` so the scalar tail produces the same result as the SIMD path.
+static inline int swapMulHi(const int a, const int b)
+{
+  return (a * b) >> 16;
+}
+
+static inline uint8_t swapClampToByte(const int value)
+{
+  return (uint8_t)(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+static inline void swapStorePixels(OUT uint8_t *pOut, const __m128i r, const __m128i g, const __m128i b, const __m128i alpha, const swapPixelFormat format)
+{
+  const __m128i c0 = format == sPF_BGRA ? b : r;
+  const __m128i c2 = format == sPF_BGRA ? r : b;
+
+  const __m128i lo01 = _mm_unpacklo_epi8(c0, g);
+  const __m128i hi01 = _mm_unpackhi_epi8(c0, g);
+  const __m128i lo23 = _mm_unpacklo_epi8(c2, alpha);
+  const __m128i hi23 = _mm_unpackhi_epi8(c2, alpha);
+
+  const __m128i p0 = _mm_unpacklo_epi16(lo01, lo23);
+  const __m128i p1 = _mm_unpackhi_epi16(lo01, lo23);
+  const __m128i p2 = _mm_unpacklo_epi16(hi01, hi23);
+  const __m128i p3 = _mm_unpackhi_epi16(hi01, hi23);
+
+  if (format != sPF_RGB24)
+  {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(pOut) + 0, p0);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(pOut) + 1, p1);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(pOut) + 2, p2);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(pOut) + 3, p3);
+    return;
+  }
+
+#ifdef SSSE3
+  const __m128i dropAlpha = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+  const __m128i a = _mm_shuffle_epi8(p0, dropAlpha);
+  const __m128i b0 = _mm_shuffle_epi8(p1, dropAlpha);
+  const __m128i c = _mm_shuffle_epi8(p2, dropAlpha);
+  const __m128i d = _mm_shuffle_epi8(p3, dropAlpha);
+
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(pOut) + 0, _mm_or_si128(a, _mm_slli_si128(b0, 12)));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(pOut) + 1, _mm_or_si128(_mm_srli_si128(b0, 4), _mm_slli_si128(c, 8)));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(pOut) + 2, _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+#else
+  alignas(16) uint8_t pixels[64];
+
+  _mm_store_si128(reinterpret_cast<__m128i *>(pixels) + 0, p0);
+  _mm_store_si128(reinterpret_cast<__m128i *>(pixels) + 1, p1);
+  _mm_store_si128(reinterpret_cast<__m128i *>(pixels) + 2, p2);
+  _mm_store_si128(reinterpret_cast<__m128i *>(pixels) + 3, p3);
+
+  for (size_t i = 0; i < 16; i++)
+  {
+    pOut[i * 3 + 0] = pixels[i * 4 + 0];
+    pOut[i * 3 + 1] = pixels[i * 4 + 1];
+    pOut[i * 3 + 2] = pixels[i * 4 + 2];
+  }
+#endif
+}
+
+void swapConvertYUVToRGB(IN const uint8_t *pY, IN const uint8_t *pU, IN const uint8_t *pV, IN const uint8_t *pA, const size_t width, const size_t height, const size_t strideY, const size_t strideUV, const size_t strideA, const size_t chromaShiftX, const size_t chromaShiftY, OUT uint8_t *pOut, const size_t outStride, const swapPixelFormat format, const swapColorSpace colorSpace)
+{
+  const int16_t *pC = swapYUVToRGBCoefficients[colorSpace == sCS_BT709 ? 1 : 0];
+  const size_t bytesPerPixel = format == sPF_RGB24 ? 3 : 4;
+
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i opaque = _mm_set1_epi8(-1);
+  const __m128i lumaOffset = _mm_set1_epi16(16);
+  const __m128i chromaOffset = _mm_set1_epi16(128);
+  const __m128i rounding = _mm_set1_epi16(8);
+  const __m128i cY = _mm_set1_epi16(pC[0]);
+  const __m128i cRV = _mm_set1_epi16(pC[1]);
+  const __m128i cGU = _mm_set1_epi16(pC[2]);
+  const __m128i cGV = _mm_set1_epi16(pC[3]);
+  const __m128i cBU = _mm_set1_epi16(pC[4]);
+
+  for (size_t line = 0; line < height; line++)
+  {
+    const uint8_t *pLineY = pY + line * strideY;
+    const uint8_t *pLineU = pU + (line >> chromaShiftY) * strideUV;
+    const uint8_t *pLineV = pV + (line >> chromaShiftY) * strideUV;
+    const uint8_t *pLineA = pA == nullptr ? nullptr : pA + line * strideA;
+    uint8_t *pLineOut = pOut + line * outStride;
+
+    size_t x = 0;
+
+    for (; x + 16 <= width; x += 16)
+    {
+      const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pLineY + x));
+      const __m128i alpha = pLineA == nullptr ? opaque : _mm_loadu_si128(reinterpret_cast<const __m128i *>(pLineA + x));
+
+      __m128i rcLo, rcHi, gcLo, gcHi, bcLo, bcHi;
+
+      if (chromaShiftX == 0)
+      {
+        const __m128i u8 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pLineU + x));
+        const __m128i v8 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pLineV + x));
+
+        const __m128i uLo = _mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(u8, zero), chromaOffset), 7);
+        const __m128i uHi = _mm_slli_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(u8, zero), chromaOffset), 7);
+        const __m128i vLo = _mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(v8, zero), chromaOffset), 7);
+        const __m128i vHi = _mm_slli_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(v8, zero), chromaOffset), 7);
+
+        rcLo = _mm_mulhi_epi16(vLo, cRV);
+        rcHi = _mm_mulhi_epi16(vHi, cRV);
+        gcLo = _mm_add_epi16(_mm_mulhi_epi16(uLo, cGU), _mm_mulhi_epi16(vLo, cGV));
+        gcHi = _mm_add_epi16(_mm_mulhi_epi16(uHi, cGU), _mm_mulhi_epi16(vHi, cGV));
+        bcLo = _mm_mulhi_epi16(uLo, cBU);
+        bcHi = _mm_mulhi_epi16(uHi, cBU);
+      }
+      else
+      {
+        const __m128i u = _mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(pLineU + (x >> 1))), zero), chromaOffset), 7);
+        const __m128i v = _mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(pLineV + (x >> 1))), zero), chromaOffset), 7);
+
+        const __m128i rc = _mm_mulhi_epi16(v, cRV);
+        const __m128i gc = _mm_add_epi16(_mm_mulhi_epi16(u, cGU), _mm_mulhi_epi16(v, cGV));
+        const __m128i bc = _mm_mulhi_epi16(u, cBU);
+
+        // Every chroma sample covers two horizontally neighbouring pixels.
+        rcLo = _mm_unpacklo_epi16(rc, rc);
+        rcHi = _mm_unpackhi_epi16(rc, rc);
+        gcLo = _mm_unpacklo_epi16(gc, gc);
+        gcHi = _mm_unpackhi_epi16(gc, gc);
+        bcLo = _mm_unpacklo_epi16(bc, bc);
+        bcHi = _mm_unpackhi_epi16(bc, bc);
+      }
+
+      const __m128i yLo = _mm_add_epi16(_mm_mulhi_epi16(_mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(y, zero), lumaOffset), 7), cY), rounding);
+      const __m128i yHi = _mm_add_epi16(_mm_mulhi_epi16(_mm_slli_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(y, zero), lumaOffset), 7), cY), rounding);
+
+      const __m128i r = _mm_packus_epi16(_mm_srai_epi16(_mm_add_epi16(yLo, rcLo), 4), _mm_srai_epi16(_mm_add_epi16(yHi, rcHi), 4));
+      const __m128i g = _mm_packus_epi16(_mm_srai_epi16(_mm_sub_epi16(yLo, gcLo), 4), _mm_srai_epi16(_mm_sub_epi16(yHi, gcHi), 4));
+      const __m128i b = _mm_packus_epi16(_mm_srai_epi16(_mm_add_epi16(yLo, bcLo), 4), _mm_srai_epi16(_mm_add_epi16(yHi, bcHi), 4));
+
+      swapStorePixels(pLineOut + x * bytesPerPixel, r, g, b, alpha, format);
+    }
+
+    for (; x < width; x++)
+    {
+      const int luma = swapMulHi((pLineY[x] - 16) << 7, pC[0]) + 8;
+      const int u = (pLineU[x >> chromaShiftX] - 128) << 7;
+      const int v = (pLineV[x >> chromaShiftX] - 128) << 7;
+      const uint8_t alpha = pLineA == nullptr ? 0xFF : pLineA[x];
+
+      const uint8_t r = swapClampToByte((luma + swapMulHi(v, pC[1])) >> 4);
+      const uint8_t g = swapClampToByte((luma - (swapMulHi(u, pC[2]) + swapMulHi(v, pC[3]))) >> 4);
+      const uint8_t b = swapClampToByte((luma + swapMulHi(u, pC[4])) >> 4);
+
+      uint8_t *pPixel = pLineOut + x * bytesPerPixel;
+
+      switch (format)
+      {
+      case sPF_BGRA:
+        pPixel[0] = b;
+        pPixel[1] = g;
+        pPixel[2] = r;
+        pPixel[3] = alpha;
+        break;
+
+      case sPF_RGBA:
+        pPixel[0] = r;
+        pPixel[1] = g;
+        pPixel[2] = b;
+        pPixel[3] = alpha;
+        break;
+
+      default:
+        pPixel[0] = r;
+        pPixel[1] = g;
+        pPixel[2] = b;
+        break;
+      }
+    }
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Limited range BT.601 RGB to YUV in 8 bit fixed point: R, G, B to Y, U and V.
+static const int16_t swapRGBToYUVCoefficients[3][3] =
+{
+  { 66, 129, 25 },
+  { -38, -74, 112 },
+  { 112, -94, -18 },
+};
+
+// Extracts the first and third colour channel and green of 8 packed pixels into 16 bit lanes.
+static inline void swapLoadPixels(IN const uint8_t *pIn, OUT __m128i *pC0, OUT __m128i *pG, OUT __m128i *pC2)
+{
+  const __m128i mask = _mm_set1_epi32(0xFF);
+  const __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pIn));
+  const __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pIn) + 1);
 
-// Consume 2 bits of an intermediate results precision and 3 bits that were
-// produced by `2 * sqrt(8)`. Also normalize to from `-128..127` to `0..255`
-constexpr int _IDCT_ROW_NORM = (_IDCT_PREC + 2 + 3);
-constexpr int _IDCT_ROW_BIAS = (_IDCT_HALF(_IDCT_ROW_NORM) + (128 << _IDCT_ROW_NORM));
+  *pC0 = _mm_packs_epi32(_mm_and_si128(p0, mask), _mm_and_si128(p1, mask));
+  *pG = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 8), mask), _mm_and_si128(_mm_srli_epi32(p1, 8), mask));
+  *pC2 = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 16), mask), _mm_and_si128(_mm_srli_epi32(p1, 16), mask));
+}
 
-#define _CONST16_SSE2(x, y)  _mm_setr_epi16(x, y, x, y, x, y, x, y)
-#define _CONST32_SSE2(x)     _mm_setr_epi32(x, x, x, x)
+// All intermediate values stay within 16 bits: luma is accumulated unsigned, chroma signed.
+static inline __m128i swapRGBToLuma(const __m128i r, const __m128i g, const __m128i b)
+{
+  const __m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(swapRGBToYUVCoefficients[0][0])), _mm_mullo_epi16(g, _mm_set1_epi16(swapRGBToYUVCoefficients[0][1]))), _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(swapRGBToYUVCoefficients[0][2])), _mm_set1_epi16(128)));
 
-static const __m128i rot0_0 = _CONST16_SSE2(_IDCT_P_0_541196100, _IDCT_P_0_541196100 + _IDCT_M_1_847759065);
-static const __m128i rot0_1 = _CONST16_SSE2(_IDCT_P_0_541196100 + _IDCT_P_0_765366865, _IDCT_P_0_541196100);
-static const __m128i rot1_0 = _CONST16_SSE2(_IDCT_P_1_175875602 + _IDCT_M_0_899976223, _IDCT_P_1_175875602);
-static const __m128i rot1_1 = _CONST16_SSE2(_IDCT_P_1_175875602, _IDCT_P_1_175875602 + _IDCT_M_2_562915447);
-static const __m128i rot2_0 = _CONST16_SSE2(_IDCT_M_1_961570560 + _IDCT_P_0_298631336, _IDCT_M_1_961570560);
-static const __m128i rot2_1 = _CONST16_SSE2(_IDCT_M_1_961570560, _IDCT_M_1_961570560 + _IDCT_P_3_072711026);
-static const __m128i rot3_0 = _CONST16_SSE2(_IDCT_M_0_390180644 + _IDCT_P_2_053119869, _IDCT_M_0_390180644);
-static const __m128i rot3_1 = _CONST16_SSE2(_IDCT_M_0_390180644, _IDCT_M_0_390180644 + _IDCT_P_1_501321110);
-static const __m128i colBias = _CONST32_SSE2(_IDCT_COL_BIAS);
-static const __m128i rowBias = _CONST32_SSE2(_IDCT_ROW_BIAS);
+  return _mm_add_epi16(_mm_srli_epi16(sum, 8), _mm_set1_epi16(16));
+}
 
-#define _IDCT_ROTATE_XMM(dst0, dst1, x, y, c0, c1) \
-    __m128i c0##_l = _mm_unpacklo_epi16(x, y); \
-    __m128i c0##_h = _mm_unpackhi_epi16(x, y); \
-    __m128i dst0##_l = _mm_madd_epi16(c0##_l, c0); \
-    __m128i dst0##_h = _mm_madd_epi16(c0##_h, c0); \
-    __m128i dst1##_l = _mm_madd_epi16(c0##_l, c1); \
-    __m128i dst1##_h = _mm_madd_epi16(c0##_h, c1);
+static inline __m128i swapRGBToChroma(const __m128i r, const __m128i g, const __m128i b, const int16_t *pC)
+{
+  const __m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(pC[0])), _mm_mullo_epi16(g, _mm_set1_epi16(pC[1]))), _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(pC[2])), _mm_set1_epi16(128)));
+
+  return _mm_add_epi16(_mm_srai_epi16(sum, 8), _mm_set1_epi16(128));
+}
+
+// Averages two lines and horizontally neighbouring lanes, leaving 4 values in the lower half.
+static inline __m128i swapAverageQuad(const __m128i line0, const __m128i line1)
+{
+  const __m128i pairs = _mm_madd_epi16(_mm_add_epi16(line0, line1), _mm_set1_epi16(1));
+
+  return _mm_srli_epi16(_mm_add_epi16(_mm_packs_epi32(pairs, pairs), _mm_set1_epi16(2)), 2);
+}
+
+void swapConvertRGBToYUV420(IN const uint8_t *pIn, const size_t inStride, const size_t width, const size_t height, const swapPixelFormat format, OUT uint8_t *pY, OUT uint8_t *pU, OUT uint8_t *pV, const size_t strideY, const size_t strideUV)
+{
+  const bool isBGRA = format == sPF_BGRA;
+
+  for (size_t line = 0; line < height; line += 2)
+  {
+    // A trailing odd line is converted twice into the same output line.
+    const size_t nextLine = std::min(line + 1, height - 1) - line;
+    const uint8_t *pLine0 = pIn + line * inStride;
+    const uint8_t *pLine1 = pLine0 + nextLine * inStride;
+    uint8_t *pLineY0 = pY + line * strideY;
+    uint8_t *pLineY1 = pLineY0 + nextLine * strideY;
+    uint8_t *pLineU = pU + (line >> 1) * strideUV;
+    uint8_t *pLineV = pV + (line >> 1) * strideUV;
+
+    size_t x = 0;
+
+    for (; x + 8 <= width; x += 8)
+    {
+      __m128i c00, g0, c20, c01, g1, c21;
+
+      swapLoadPixels(pLine0 + x * 4, &c00, &g0, &c20);
+      swapLoadPixels(pLine1 + x * 4, &c01, &g1, &c21);
+
+      const __m128i r0 = isBGRA ? c20 : c00;
+      const __m128i b0 = isBGRA ? c00 : c20;
+      const __m128i r1 = isBGRA ? c21 : c01;
+      const __m128i b1 = isBGRA ? c01 : c21;
+
+      _mm_storel_epi64(reinterpret_cast<__m128i *>(pLineY0 + x), _mm_packus_epi16(swapRGBToLuma(r0, g0, b0), _mm_setzero_si128()));
+      _mm_storel_epi64(reinterpret_cast<__m128i *>(pLineY1 + x), _mm_packus_epi16(swapRGBToLuma(r1, g1, b1), _mm_setzero_si128()));
+
+      const __m128i r = swapAverageQuad(r0, r1);
+      const __m128i g = swapAverageQuad(g0, g1);
+      const __m128i b = swapAverageQuad(b0, b1);
+
+      const int u = _mm_cvtsi128_si32(_mm_packus_epi16(swapRGBToChroma(r, g, b, swapRGBToYUVCoefficients[1]), _mm_setzero_si128()));
+      const int v = _mm_cvtsi128_si32(_mm_packus_epi16(swapRGBToChroma(r, g, b, swapRGBToYUVCoefficients[2]), _mm_setzero_si128()));
+
+      memcpy(pLineU + (x >> 1), &u, sizeof(u));
+      memcpy(pLineV + (x >> 1), &v, sizeof(v));
+    }
+
+    for (; x < width; x += 2)
+    {
+      const size_t nextX = std::min(x + 1, width - 1) - x;
+      int rgb[3] = { 0, 0, 0 };
+
+      for (size_t i = 0; i < 4; i++)
+      {
+        const uint8_t *pPixel = ((i & 2) ? pLine1 : pLine0) + (x + (i & 1) * nextX) * 4;
+        const int r = isBGRA ? pPixel[2] : pPixel[0];
+        const int g = pPixel[1];
+        const int b = isBGRA ? pPixel[0] : pPixel[2];
+
+        ((i & 2) ? pLineY1 : pLineY0)[x + (i & 1) * nextX] = (uint8_t)(((swapRGBToYUVCoefficients[0][0] * r + swapRGBToYUVCoefficients[0][1] * g + swapRGBToYUVCoefficients[0][2] * b + 128) >> 8) + 16);
+
+        rgb[0] += r;
+        rgb[1] += g;
+        rgb[2] += b;
+      }
+
+      for (size_t i = 0; i < 3; i++)
+        rgb[i] = (rgb[i] + 2) >> 2;
+
+      pLineU[x >> 1] = swapClampToByte(((swapRGBToYUVCoefficients[1][0] * rgb[0] + swapRGBToYUVCoefficients[1][1] * rgb[1] + swapRGBToYUVCoefficients[1][2] * rgb[2] + 128) >> 8) + 128);
+      pLineV[x >> 1] = swapClampToByte(((swapRGBToYUVCoefficients[2][0] * rgb[0] + swapRGBToYUVCoefficients[2][1] * rgb[1] + swapRGBToYUVCoefficients[2][2] * rgb[2] + 128) >> 8) + 128);
+    }
+  }
+}
+
+void swapDeinterleaveUV(IN const uint8_t *pUV, const size_t inStride, const size_t width, const size_t height, OUT uint8_t *pU, OUT uint8_t *pV, const size_t strideUV)
+{
+  const __m128i mask = _mm_set1_epi16(0xFF);
+
+  for (size_t line = 0; line < height; line++)
+  {
+    const uint8_t *pLineUV = pUV + line * inStride;
+    uint8_t *pLineU = pU + line * strideUV;
+    uint8_t *pLineV = pV + line * strideUV;
+
+    size_t x = 0;
+
+    for (; x + 16 <= width; x += 16)
+    {
+      const __m128i uv0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pLineUV + x * 2));
+      const __m128i uv1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pLineUV + x * 2) + 1);
+
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(pLineU + x), _mm_packus_epi16(_mm_and_si128(uv0, mask), _mm_and_si128(uv1, mask)));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(pLineV + x), _mm_packus_epi16(_mm_srli_epi16(uv0, 8), _mm_srli_epi16(uv1, 8)));
+    }
+
+    for (; x < width; x++)
+    {
+      pLineU[x] = pLineUV[x * 2];
+      pLineV[x] = pLineUV[x * 2 + 1];
+    }
+  }
+}
+
+void swapExtractAlpha(IN const uint8_t *pIn, const size_t inStride, const size_t width, const size_t height, OUT uint8_t *pA, const size_t strideA)
+{
+  for (size_t line = 0; line < height; line++)
+  {
+    const uint8_t *pLineIn = pIn + line * inStride;
+    uint8_t *pLineA = pA + line * strideA;
+
+    size_t x = 0;
+
+    for (; x + 16 <= width; x += 16)
+    {
+      const __m128i a0 = _mm_srli_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pLineIn + x * 4) + 0), 24);
+      const __m128i a1 = _mm_srli_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pLineIn + x * 4) + 1), 24);
+      const __m128i a2 = _mm_srli_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pLineIn + x * 4) + 2), 24);
+      const __m128i a3 = _mm_srli_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pLineIn + x * 4) + 3), 24);
+
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(pLineA + x), _mm_packus_epi16(_mm_packs_epi32(a0, a1), _mm_packs_epi32(a2, a3)));
+    }
+
+    for (; x < width; x++)
+      pLineA[x] = pLineIn[x * 4 + 3];
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+#define SWAP_CACHE_LINE_SIZE 64
+
+// Memory taken while the arena was full. Released once the outermost scope ends, when the arena grows to fit it.
+struct swapArenaOverflow
+{
+  swapArenaOverflow *pNext;
+};
+
+struct swapArena
+{
+  uint8_t *pAllocation = nullptr;
+  uint8_t *pData = nullptr;
+  size_t capacity = 0;
+  size_t used = 0;
+  size_t scopeCount = 0;
+
+  swapArenaOverflow *pOverflow = nullptr;
+  size_t overflowSize = 0;
+  size_t peakSize = 0;
+
+  ~swapArena();
+};
+
+static void swapArenaReleaseOverflow(swapArena *pArena)
+{
+  while (pArena->pOverflow != nullptr)
+  {
+    swapArenaOverflow *pNext = pArena->pOverflow->pNext;
+    free(pArena->pOverflow);
+    pArena->pOverflow = pNext;
+  }
+
+  pArena->overflowSize = 0;
+}
+
+swapArena::~swapArena()
+{
+  swapArenaReleaseOverflow(this);
+
+  if (pAllocation)
+    free(pAllocation);
+}
+
+static thread_local swapArena swapThreadArena;
+
+static inline uint8_t * swapAlignToCacheLine(uint8_t *pData)
+{
+  return pData + ((SWAP_CACHE_LINE_SIZE - ((uintptr_t)pData & (SWAP_CACHE_LINE_SIZE - 1))) & (SWAP_CACHE_LINE_SIZE - 1));
+}
+
+swapArenaScope::swapArenaScope()
+{
+  swapArena &arena = swapThreadArena;
+
+  used = arena.used;
+  arena.scopeCount++;
+}
+
+swapArenaScope::~swapArenaScope()
+{
+  swapArena &arena = swapThreadArena;
+
+  arena.used = used;
+
+  if (--arena.scopeCount > 0)
+    return;
+
+  swapArenaReleaseOverflow(&arena);
+
+  if (arena.peakSize > arena.capacity)
+  {
+    if (arena.pAllocation)
+      free(arena.pAllocation);
+
+    arena.pAllocation = (uint8_t *)malloc(arena.peakSize + SWAP_CACHE_LINE_SIZE);
+    arena.pData = arena.pAllocation == nullptr ? nullptr : swapAlignToCacheLine(arena.pAllocation);
+    arena.capacity = arena.pAllocation == nullptr ? 0 : arena.peakSize;
+  }
+}
+
+uint8_t * swapArenaAlloc(const size_t size)
+{
+  swapArena &arena = swapThreadArena;
+  const size_t alignedSize = (size + SWAP_CACHE_LINE_SIZE - 1) & ~(size_t)(SWAP_CACHE_LINE_SIZE - 1);
+  uint8_t *pData;
+
+  if (arena.used + alignedSize <= arena.capacity)
+  {
+    pData = arena.pData + arena.used;
+    arena.used += alignedSize;
+  }
+  else
+  {
+    swapArenaOverflow *pOverflow = (swapArenaOverflow *)malloc(sizeof(swapArenaOverflow) + SWAP_CACHE_LINE_SIZE + alignedSize);
+
+    if (pOverflow == nullptr)
+      return nullptr;
+
+    pOverflow->pNext = arena.pOverflow;
+    arena.pOverflow = pOverflow;
+    arena.overflowSize += alignedSize;
+
+    pData = swapAlignToCacheLine(reinterpret_cast<uint8_t *>(pOverflow + 1));
+  }
+
+  arena.peakSize = std::max(arena.peakSize, arena.used + arena.overflowSize);
+
+  return pData;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+
+// The unclaimed items of a worker: the first item in the lower and the end in the upper 32 bits. Padded to a cache line, as every worker keeps claiming from its own range.
+struct swapWorkerRange
+{
+  std::atomic<uint64_t> range;
+  uint8_t padding[SWAP_CACHE_LINE_SIZE - sizeof(std::atomic<uint64_t>)];
+};
+
+struct swapParallelForState
+{
+  swapWorkerRange *pRanges;
+  size_t workerCount;
+  void (*pFunction)(void *pContext, const size_t item);
+  void *pContext;
+};
+
+static inline uint64_t swapPackRange(const uint64_t first, const uint64_t end)
+{
+  return first | (end << 32);
+}
+
+static void swapParallelForWorker(const swapParallelForState &state, const size_t worker)
+{
+  std::atomic<uint64_t> &ownRange = state.pRanges[worker].range;
+
+  while (true)
+  {
+    uint64_t range = ownRange.load(std::memory_order_acquire);
+    const uint64_t first = range & 0xFFFFFFFF;
+    const uint64_t end = range >> 32;
+
+    if (first < end)
+    {
+      if (ownRange.compare_exchange_weak(range, swapPackRange(first + 1, end), std::memory_order_acq_rel))
+        state.pFunction(state.pContext, (size_t)first);
+
+      continue;
+    }
+
+    // Steal the upper half of the fullest range. Items are never handed out twice, so a range can't reappear in a slot once it has been claimed from.
+    size_t victim = 0;
+    uint64_t mostRemaining = 0;
+
+    for (size_t i = 0; i < state.workerCount; i++)
+    {
+      const uint64_t otherRange = state.pRanges[i].range.load(std::memory_order_relaxed);
+      const uint64_t remaining = (otherRange >> 32) > (otherRange & 0xFFFFFFFF) ? (otherRange >> 32) - (otherRange & 0xFFFFFFFF) : 0;
+
+      if (remaining > mostRemaining)
+      {
+        victim = i;
+        mostRemaining = remaining;
+      }
+    }
+
+    if (mostRemaining == 0)
+      return;
+
+    uint64_t victimRange = state.pRanges[victim].range.load(std::memory_order_acquire);
+    const uint64_t victimFirst = victimRange & 0xFFFFFFFF;
+    const uint64_t victimEnd = victimRange >> 32;
+
+    if (victimFirst >= victimEnd)
+      continue;
+
+    const uint64_t stolen = (victimEnd - victimFirst + 1) / 2;
+
+    if (state.pRanges[victim].range.compare_exchange_strong(victimRange, swapPackRange(victimFirst, victimEnd - stolen), std::memory_order_acq_rel))
+      ownRange.store(swapPackRange(victimEnd - stolen, victimEnd), std::memory_order_release);
+  }
+}
+
+void swapParallelFor(swapTaskQueue *pQueue, const size_t itemCount, void (*pFunction)(void *pContext, const size_t item), void *pContext)
+{
+  // A task waiting for the tasks of its own queue would wait for itself.
+  if (pQueue != nullptr && swapIsRunningTaskOf(pQueue))
+    pQueue = nullptr;
+
+  // Pinned workers keep the items off the calling thread, which may run on any core.
+  const bool callerWorks = pQueue == nullptr || !swapIsTaskQueuePinned(pQueue);
+  const size_t workerCount = std::min(itemCount, pQueue == nullptr ? 1 : swapGetTaskQueueThreadCount(pQueue) + (callerWorks ? 1 : 0));
+  swapArenaScope scope;
+  swapWorkerRange *pRanges = nullptr;
+  swapParallelForState state;
+
+  if (workerCount > 1 || (!callerWorks && workerCount > 0))
+    pRanges = swapArenaAllocArray<swapWorkerRange>(workerCount);
+
+  // Runs on the calling thread if there's nothing to split or no memory to split it with.
+  if (pRanges == nullptr)
+  {
+    for (size_t item = 0; item < itemCount; item++)
+      pFunction(pContext, item);
+
+    return;
+  }
+
+  state.pRanges = pRanges;
+  state.workerCount = workerCount;
+  state.pFunction = pFunction;
+  state.pContext = pContext;
+
+  // Every worker starts on a contiguous chunk, so neighbouring tiles and their output stay with the same core unless they're stolen.
+  for (size_t worker = 0; worker < workerCount; worker++)
+    new (&state.pRanges[worker].range) std::atomic<uint64_t>(swapPackRange(worker * itemCount / workerCount, (worker + 1) * itemCount / workerCount));
+
+  for (size_t worker = callerWorks ? 1 : 0; worker < workerCount; worker++)
+    swapEnqueueTask(pQueue, [](void *pContext, const size_t item) { swapParallelForWorker(*reinterpret_cast<const swapParallelForState *>(pContext), item); }, &state, worker);
+
+  if (callerWorks)
+    swapParallelForWorker(state, 0);
+
+  swapWaitForTasks(pQueue);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Frames are hashed in bands of lines, in the style of XXH3: every 64 byte stripe is mixed into eight 64 bit accumulators that are scrambled after each line.
+#define SWAP_HASH_LINES_PER_TASK 64
+#define SWAP_HASH_STRIPE_SIZE 64
+
+static const uint64_t swapHashSecret[8] = { 0xBE4BA423396CFEB8ULL, 0x1CAD21F72C81017CULL, 0xDB979083E96DD4DEULL, 0x1F67B3B7A4A44072ULL, 0x78E5C0CC4EE679CBULL, 0x2172FFCC7DD05A82ULL, 0x8E2443F7744608B8ULL, 0x4C263A81E69035E0ULL };
+
+static const uint64_t swapHashPrime64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t swapHashPrime64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t swapHashPrime64_3 = 0x165667B19E3779F9ULL;
+static const uint32_t swapHashPrime32_1 = 0x9E3779B1U;
+
+static inline void swapHashStripe(IN_OUT __m128i *pAccumulators, IN const uint8_t *pStripe)
+{
+  for (size_t i = 0; i < 4; i++)
+  {
+    const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pStripe) + i);
+    const __m128i key = _mm_xor_si128(data, _mm_loadu_si128(reinterpret_cast<const __m128i *>(swapHashSecret) + i));
+    const __m128i product = _mm_mul_epu32(key, _mm_shuffle_epi32(key, _MM_SHUFFLE(0, 3, 0, 1)));
+
+    pAccumulators[i] = _mm_add_epi64(pAccumulators[i], _mm_add_epi64(product, _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2))));
+  }
+}
+
+static inline void swapHashScramble(IN_OUT __m128i *pAccumulators)
+{
+  const __m128i prime = _mm_set1_epi32((int)swapHashPrime32_1);
+
+  for (size_t i = 0; i < 4; i++)
+  {
+    __m128i accumulator = _mm_xor_si128(pAccumulators[i], _mm_srli_epi64(pAccumulators[i], 47));
+    accumulator = _mm_xor_si128(accumulator, _mm_loadu_si128(reinterpret_cast<const __m128i *>(swapHashSecret) + (3 - i)));
+
+    const __m128i lo = _mm_mul_epu32(accumulator, prime);
+    const __m128i hi = _mm_mul_epu32(_mm_srli_epi64(accumulator, 32), prime);
+
+    pAccumulators[i] = _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+  }
+}
+
+static inline uint64_t swapHashAvalanche(uint64_t hash)
+{
+  hash ^= hash >> 33;
+  hash *= swapHashPrime64_2;
+  hash ^= hash >> 29;
+  hash *= swapHashPrime64_3;
+  hash ^= hash >> 32;
+
+  return hash;
+}
+
+// Hashes `lineCount` lines of `lineSize` bytes that are `stride` bytes apart.
+static uint64_t swapHashLines(IN const uint8_t *pData, const size_t lineSize, const size_t lineCount, const size_t stride, const uint64_t seed)
+{
+  __m128i accumulators[4];
+  uint64_t lanes[8];
+
+  for (size_t i = 0; i < 4; i++)
+    accumulators[i] = _mm_set_epi64x((int64_t)(seed + swapHashPrime64_2 * (2 * i + 1)), (int64_t)(seed + swapHashPrime64_1 * (2 * i)));
+
+  for (size_t line = 0; line < lineCount; line++)
+  {
+    const uint8_t *pLine = pData + line * stride;
+    size_t offset = 0;
+
+    for (; offset + SWAP_HASH_STRIPE_SIZE <= lineSize; offset += SWAP_HASH_STRIPE_SIZE)
+      swapHashStripe(accumulators, pLine + offset);
+
+    if (offset < lineSize)
+    {
+      alignas(16) uint8_t stripe[SWAP_HASH_STRIPE_SIZE] = { 0 };
+      memcpy(stripe, pLine + offset, lineSize - offset);
+      swapHashStripe(accumulators, stripe);
+    }
+
+    swapHashScramble(accumulators);
+  }
+
+  memcpy(lanes, accumulators, sizeof(lanes));
+
+  uint64_t hash = seed ^ ((uint64_t)(lineSize * lineCount) * swapHashPrime64_1);
+
+  for (size_t i = 0; i < 8; i++)
+    hash = (hash ^ swapHashAvalanche(lanes[i] ^ swapHashSecret[7 - i])) * swapHashPrime64_1 + swapHashPrime64_3;
+
+  return swapHashAvalanche(hash);
+}
+
+swapResult swapHashFrame(const swapFrameDescriptor &frame, const size_t resX, const size_t resY, OUT uint64_t *pHash, swapTaskQueue *pQueue)
+{
+  struct swapHashPlane
+  {
+    const uint8_t *pData;
+    size_t stride;
+    size_t lineSize;
+    size_t lineCount;
+  };
+
+  swapHashPlane planes[SWAP_MAX_PLANES];
+  size_t planeCount = 0;
+
+  swapChromaFormat chromaFormat;
+  bool alpha;
+  size_t bytesPerSample;
+
+  if (swapGetPlanarFormatInfo(frame.format, &chromaFormat, &alpha, &bytesPerSample))
+  {
+    swapPlaneLayout layout;
+    swapGetPlaneLayout(resX, chromaFormat, alpha, &layout);
+
+    for (; planeCount < layout.planeCount; planeCount++)
+      planes[planeCount] = { frame.pPlanes[planeCount], frame.strides[planeCount], swapGetPlaneSize(resX, layout.planes[planeCount].shiftX) * bytesPerSample, swapGetPlaneSize(resY, layout.planes[planeCount].shiftY) };
+  }
+  else if (frame.format == sPF_NV12)
+  {
+    planes[planeCount++] = { frame.pPlanes[0], frame.strides[0], resX, resY };
+    planes[planeCount++] = { frame.pPlanes[1], frame.strides[1], swapGetPlaneSize(resX, 1) * 2, swapGetPlaneSize(resY, 1) };
+  }
+  else
+  {
+    planes[planeCount++] = { frame.pPlanes[0], frame.strides[0], swapGetImageSize(frame.format, resX, 1), resY };
+  }
+
+  size_t taskCount = 0;
+
+  for (size_t p = 0; p < planeCount; p++)
+    taskCount += (planes[p].lineCount + SWAP_HASH_LINES_PER_TASK - 1) / SWAP_HASH_LINES_PER_TASK;
+
+  swapArenaScope scope;
+  uint64_t *pBandHashes = swapArenaAllocArray<uint64_t>(taskCount);
+
+  if (pBandHashes == nullptr)
+    return sR_MemoryAllocationFailure;
+
+  swapParallelFor(pQueue, taskCount, [&](const size_t task) {
+
+    size_t p = 0;
+    size_t band = task;
+
+    while (band >= (planes[p].lineCount + SWAP_HASH_LINES_PER_TASK - 1) / SWAP_HASH_LINES_PER_TASK)
+      band -= (planes[p++].lineCount + SWAP_HASH_LINES_PER_TASK - 1) / SWAP_HASH_LINES_PER_TASK;
+
+    const swapHashPlane &plane = planes[p];
+    const size_t line = band * SWAP_HASH_LINES_PER_TASK;
+
+    pBandHashes[task] = swapHashLines(plane.pData + line * plane.stride, plane.lineSize, std::min((size_t)SWAP_HASH_LINES_PER_TASK, plane.lineCount - line), plane.stride, task);
+  });
+
+  // The band hashes are combined in order, so the result doesn't depend on the scheduling.
+  *pHash = swapHashLines(reinterpret_cast<const uint8_t *>(pBandHashes), taskCount * sizeof(uint64_t), 1, 0, frame.format);
+
+  return sR_Success;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Formats the block at `x`, `y` of a `width` x `height` plane. Blocks on or beyond the right and bottom edge replicate the last column and line.
+static void swapFormatPlaneBlock(OUT int16_t *pBlock, IN const uint8_t *pPlane, const size_t stride, const size_t x, const size_t y, const size_t width, const size_t height)
+{
+  const size_t x0 = std::min(x, width - 1);
+  const size_t y0 = std::min(y, height - 1);
+  const size_t cols = std::min((size_t)8, width - x0);
+  const size_t rows = std::min((size_t)8, height - y0);
+
+  swapFormatMCUBlock(pBlock, pPlane + y0 * stride + x0, (int)rows, (int)cols, (int)(stride - cols));
+}
+
+// Formats the block at `x`, `y` of a `width` x `height` plane of 16 bit samples, replicating the last column and line like `swapFormatPlaneBlock`.
+static void swapFormatPlaneBlockHighBitDepth(OUT int32_t *pBlock, IN const uint8_t *pPlane, const size_t stride, const size_t x, const size_t y, const size_t width, const size_t height, const int32_t bias)
+{
+  for (size_t row = 0; row < 8; row++)
+  {
+    const uint16_t *pLine = reinterpret_cast<const uint16_t *>(pPlane + std::min(y + row, height - 1) * stride);
 
-// out = in << 12  (in 16-bit, out 32-bit)
-#define _IDCT_WIDEN_XMM(dst, in) \
-    __m128i dst##_l = _mm_srai_epi32(_mm_unpacklo_epi16(_mm_setzero_si128(), (in)), 4); \
-    __m128i dst##_h = _mm_srai_epi32(_mm_unpackhi_epi16(_mm_setzero_si128(), (in)), 4);
+    for (size_t col = 0; col < 8; col++)
+      pBlock[row * 8 + col] = (int32_t)pLine[std::min(x + col, width - 1)] - bias;
+  }
+}
 
-// wide add
-#define _IDCT_WADD_XMM(dst, a, b) \
-    __m128i dst##_l = _mm_add_epi32(a##_l, b##_l); \
-    __m128i dst##_h = _mm_add_epi32(a##_h, b##_h);
+// Quantization tables and parameters of the transform of every tile of a frame.
+struct swapTransformTables
+{
+  uint16_t ILqt[64];
+  uint16_t ICqt[64];
+  float ILqtHighBitDepth[64];
+  float ICqtHighBitDepth[64];
+  int32_t bias;
+  uint32_t bitDepth;
+  bool lossless;
+};
 
-// wide sub
-#define _IDCT_WSUB_XMM(dst, a, b) \
-    __m128i dst##_l = _mm_sub_epi32(a##_l, b##_l); \
-    __m128i dst##_h = _mm_sub_epi32(a##_h, b##_h);
+static void swapInitTransformTables(const uint32_t quality, const uint32_t bitDepth, const bool lossless, OUT swapTransformTables *pTables)
+{
+  pTables->bitDepth = bitDepth;
+  pTables->lossless = lossless;
+  pTables->bias = 1 << (bitDepth - 1);
 
-// butterfly a/b, add bias, then shift by `norm` and pack to 16-bit
-#define _IDCT_BFLY_XMM(dst0, dst1, a, b, bias, norm) { \
-    __m128i abiased_l = _mm_add_epi32(a##_l, bias); \
-    __m128i abiased_h = _mm_add_epi32(a##_h, bias); \
-    _IDCT_WADD_XMM(sum, abiased, b) \
-    _IDCT_WSUB_XMM(diff, abiased, b) \
-    dst0 = _mm_packs_epi32(_mm_srai_epi32(sum_l, norm), _mm_srai_epi32(sum_h, norm)); \
-    dst1 = _mm_packs_epi32(_mm_srai_epi32(diff_l, norm), _mm_srai_epi32(diff_h, norm)); \
-    }
+  if (bitDepth > 8)
+  {
+    float Lqt[64];
+    float Cqt[64];
 
-#define _IDCT_IDCT_PASS_XMM(bias, norm) { \
-    _IDCT_ROTATE_XMM(t2e, t3e, v2, v6, rot0_0, rot0_1) \
-    __m128i sum04 = _mm_add_epi16(v0, v4); \
-    __m128i dif04 = _mm_sub_epi16(v0, v4); \
-    _IDCT_WIDEN_XMM(t0e, sum04) \
-    _IDCT_WIDEN_XMM(t1e, dif04) \
-    _IDCT_WADD_XMM(x0, t0e, t3e) \
-    _IDCT_WSUB_XMM(x3, t0e, t3e) \
-    _IDCT_WADD_XMM(x1, t1e, t2e) \
-    _IDCT_WSUB_XMM(x2, t1e, t2e) \
-    _IDCT_ROTATE_XMM(y0o, y2o, v7, v3, rot2_0, rot2_1) \
-    _IDCT_ROTATE_XMM(y1o, y3o, v5, v1, rot3_0, rot3_1) \
-    __m128i sum17 = _mm_add_epi16(v1, v7); \
-    __m128i sum35 = _mm_add_epi16(v3, v5); \
-    _IDCT_ROTATE_XMM(y4o,y5o, sum17, sum35, rot1_0, rot1_1) \
-    _IDCT_WADD_XMM(x4, y0o, y4o) \
-    _IDCT_WADD_XMM(x5, y1o, y5o) \
-    _IDCT_WADD_XMM(x6, y2o, y5o) \
-    _IDCT_WADD_XMM(x7, y3o, y4o) \
-    _IDCT_BFLY_XMM(v0, v7, x0, x7, bias, norm) \
-    _IDCT_BFLY_XMM(v1, v6, x1, x6, bias, norm) \
-    _IDCT_BFLY_XMM(v2, v5, x2, x5, bias, norm) \
-    _IDCT_BFLY_XMM(v3, v4, x3, x4, bias, norm) \
+    swapInitHighBitDepthQuantizationTables(quality, Lqt, Cqt);
+
+    for (size_t i = 0; i < 64; i++)
+    {
+      pTables->ILqtHighBitDepth[i] = 1.0f / Lqt[i];
+      pTables->ICqtHighBitDepth[i] = 1.0f / Cqt[i];
     }
+  }
+  else
+  {
+    uint8_t Lqt[64];
+    uint8_t Cqt[64];
 
-static inline void interleave8(__m128i &a, __m128i &b)
-{
-  __m128i c = a;
-  a = _mm_unpacklo_epi8(a, b);
-  b = _mm_unpackhi_epi8(c, b);
+    swapInitDctQuantizationTables(quality, Lqt, Cqt, pTables->ILqt, pTables->ICqt);
+  }
 }
 
-static inline void interleave16(__m128i &a, __m128i &b)
+static void swapEncodeTileHighBitDepth(const swapFrameDescriptor &frame, OUT uint8_t *pUncompressedData, const size_t resX, const size_t resY, const swapTileGrid &grid, const swapTransformTables &tables, const size_t tile)
 {
-  __m128i c = a;
-  a = _mm_unpacklo_epi16(a, b);
-  b = _mm_unpackhi_epi16(c, b);
+  int32_t block[64];
+  int16_t samples[64];
+
+  const size_t column = tile % grid.tilesX;
+  const size_t firstSlice = (tile / grid.tilesX) * grid.slicesPerTile;
+  const size_t lastSlice = std::min(firstSlice + grid.slicesPerTile, grid.sliceCount);
+  const swapPlaneLayout &layout = swapGetTileColumnLayout(grid, column);
+  const size_t columnX = column * grid.tileWidth;
+
+  for (size_t slice = firstSlice; slice < lastSlice; slice++)
+  {
+    uint8_t *pCoefficients = pUncompressedData + (slice * grid.blocksPerSlice + swapGetTileColumnOffset(grid, column)) * grid.blockSize;
+
+    const size_t firstLine = slice * SWAP_SLICE_HEIGHT;
+
+    for (size_t p = 0; p < layout.planeCount; p++)
+    {
+      const auto &plane = layout.planes[p];
+      const size_t width = swapGetPlaneSize(resX, plane.shiftX);
+      const size_t height = swapGetPlaneSize(resY, plane.shiftY);
+
+      for (size_t row = 0; row < plane.blockRows; row++)
+      {
+        for (size_t x = 0; x < plane.blocksPerRow; x++)
+        {
+          swapFormatPlaneBlockHighBitDepth(block, frame.pPlanes[p], frame.strides[p], (columnX >> plane.shiftX) + (x << 3), (firstLine >> plane.shiftY) + (row << 3), width, height, tables.bias);
+
+          if (tables.lossless)
+          {
+            for (size_t i = 0; i < 64; i++)
+              samples[i] = (int16_t)block[i];
+
+            swapPredictBlockLossless(reinterpret_cast<int16_t *>(pCoefficients), samples, tables.bitDepth);
+          }
+          else
+          {
+            swapDctHighBitDepth(reinterpret_cast<int32_t *>(pCoefficients), block, plane.isChroma ? tables.ICqtHighBitDepth : tables.ILqtHighBitDepth);
+          }
+
+          pCoefficients += grid.blockSize;
+        }
+      }
+    }
+  }
 }
 
-void idct_sse2(uint8_t* dest, int stride, const int16_t* src, const uint16_t* qt)
+// Transforms the slices of `tile` into `pUncompressedData`. Returns `false` if the slice scratch couldn't be allocated.
+static bool swapEncodeTile(const swapFrameDescriptor &frame, OUT uint8_t *pUncompressedData, const size_t resX, const size_t resY, const swapTileGrid &grid, const swapTransformTables &tables, const size_t tile)
 {
-  (void)(stride);
+  const swapPixelFormat format = frame.format;
+  const bool planar = format != sPF_NV12 && format != sPF_BGRA && format != sPF_RGBA;
 
-  const __m128i* data = reinterpret_cast<const __m128i *>(src);
-  const __m128i* qtable = reinterpret_cast<const __m128i *>(qt);
+  if (tables.bitDepth > 8)
+  {
+    swapEncodeTileHighBitDepth(frame, pUncompressedData, resX, resY, grid, tables, tile);
+    return true;
+  }
 
-  // Load and dequantize
-  __m128i v0 = _mm_mullo_epi16(data[0], qtable[0]);
-  __m128i v1 = _mm_mullo_epi16(data[1], qtable[1]);
-  __m128i v2 = _mm_mullo_epi16(data[2], qtable[2]);
-  __m128i v3 = _mm_mullo_epi16(data[3], qtable[3]);
-  __m128i v4 = _mm_mullo_epi16(data[4], qtable[4]);
-  __m128i v5 = _mm_mullo_epi16(data[5], qtable[5]);
-  __m128i v6 = _mm_mullo_epi16(data[6], qtable[6]);
-  __m128i v7 = _mm_mullo_epi16(data[7], qtable[7]);
+  int16_t block[64];
 
-  // IDCT columns
-  _IDCT_IDCT_PASS_XMM(colBias, 10);
+  const size_t column = tile % grid.tilesX;
+  const size_t firstSlice = (tile / grid.tilesX) * grid.slicesPerTile;
+  const size_t lastSlice = std::min(firstSlice + grid.slicesPerTile, grid.sliceCount);
+  const swapPlaneLayout &layout = swapGetTileColumnLayout(grid, column);
+  const size_t columnX = column * grid.tileWidth;
+  const size_t columnWidth = std::min(grid.tileWidth, resX - columnX);
+  const size_t chromaWidth = swapGetPlaneSize(columnWidth, layout.planes[1].shiftX);
+  const size_t chromaSize = chromaWidth * (SWAP_SLICE_HEIGHT / 2);
 
-  // Transpose
-  interleave16(v0, v4);
-  interleave16(v2, v6);
-  interleave16(v1, v5);
-  interleave16(v3, v7);
+  // Other formats are converted to planar YUV 4:2:0 slice by slice, so the DCT reads them while they're still in cache.
+  swapArenaScope scope;
+  uint8_t *pScratch = nullptr;
 
-  interleave16(v0, v2);
-  interleave16(v1, v3);
-  interleave16(v4, v6);
-  interleave16(v5, v7);
+  if (!planar)
+  {
+    pScratch = swapArenaAlloc(columnWidth * SWAP_SLICE_HEIGHT * 2 + chromaSize * 2);
 
-  interleave16(v0, v1);
-  interleave16(v2, v3);
-  interleave16(v4, v5);
-  interleave16(v6, v7);
+    if (pScratch == nullptr)
+      return false;
+  }
 
-  // IDCT rows
-  _IDCT_IDCT_PASS_XMM(rowBias, 17);
+  for (size_t slice = firstSlice; slice < lastSlice; slice++)
+  {
+    uint8_t *pCoefficients = pUncompressedData + (slice * grid.blocksPerSlice + swapGetTileColumnOffset(grid, column)) * grid.blockSize;
 
-  // Pack to 8-bit integers, also saturates the result to 0..255
-  __m128i s0 = _mm_packus_epi16(v0, v1);
-  __m128i s1 = _mm_packus_epi16(v2, v3);
-  __m128i s2 = _mm_packus_epi16(v4, v5);
-  __m128i s3 = _mm_packus_epi16(v6, v7);
+    const size_t firstLine = slice * SWAP_SLICE_HEIGHT;
+    const uint8_t *pSlicePlanes[SWAP_MAX_PLANES];
+    size_t sliceStrides[SWAP_MAX_PLANES];
+    size_t sliceLines[SWAP_MAX_PLANES];
 
-  // Transpose
-  interleave8(s0, s2);
-  interleave8(s1, s3);
-  interleave8(s0, s1);
-  interleave8(s2, s3);
-  interleave8(s0, s2);
-  interleave8(s1, s3);
+    for (size_t p = 0; p < layout.planeCount; p++)
+    {
+      const size_t planeFirstLine = firstLine >> layout.planes[p].shiftY;
 
-  //__m128i x = { 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1 };
+      sliceLines[p] = std::min((size_t)SWAP_SLICE_HEIGHT >> layout.planes[p].shiftY, swapGetPlaneSize(resY, layout.planes[p].shiftY) - planeFirstLine);
 
-  // Store
-  __m128i* d = reinterpret_cast<__m128i *>(dest);
-  _mm_storeu_si128(d + 0, s0);
-  _mm_storeu_si128(d + 1, s2);
-  _mm_storeu_si128(d + 2, s1);
-  _mm_storeu_si128(d + 3, s3);
-}
+      if (planar)
+      {
+        pSlicePlanes[p] = frame.pPlanes[p] + planeFirstLine * frame.strides[p] + (columnX >> layout.planes[p].shiftX);
+        sliceStrides[p] = frame.strides[p];
+      }
+    }
+
+    if (!planar)
+    {
+      uint8_t *pU = pScratch;
+      uint8_t *pV = pU + chromaSize;
 
-#define xadd3(xa,xb,xc,xd,h) p=xa+xb, n=xa-xb, xa=p+xc+h, xb=n+xd+h, xc=p-xc+h, xd=n-xd+h // triple-butterfly-add (and possible rounding)
-#define xmul(xa,xb,k1,k2,sh) n=k1*(xa+xb), p=xa, xa=(n+(k2-k1)*xb)>>sh, xb=(n-(k2+k1)*p)>>sh // butterfly-mul equ.(2) 
+      pSlicePlanes[1] = pU;
+      pSlicePlanes[2] = pV;
+      sliceStrides[1] = sliceStrides[2] = chromaWidth;
 
-static void idct1(int *x, int *y, int ps, int half) // 1D-IDCT
-{
-  int p, n;
-  x[0] <<= 9, x[1] <<= 7, x[3] *= 181, x[4] <<= 9, x[5] *= 181, x[7] <<= 7;
-  xmul(x[6], x[2], 277, 669, 0);
-  xadd3(x[0], x[4], x[6], x[2], half);
-  xadd3(x[1], x[7], x[3], x[5], 0);
-  xmul(x[5], x[3], 251, 50, 6);
-  xmul(x[1], x[7], 213, 142, 6);
-  y[0 * 8] = (x[0] + x[1]) >> ps;
-  y[1 * 8] = (x[4] + x[5]) >> ps;
-  y[2 * 8] = (x[2] + x[3]) >> ps;
-  y[3 * 8] = (x[6] + x[7]) >> ps;
-  y[4 * 8] = (x[6] - x[7]) >> ps;
-  y[5 * 8] = (x[2] - x[3]) >> ps;
-  y[6 * 8] = (x[4] - x[5]) >> ps;
-  y[7 * 8] = (x[0] - x[1]) >> ps;
+      if (format == sPF_NV12)
+      {
+        pSlicePlanes[0] = frame.pPlanes[0] + firstLine * frame.strides[0] + columnX;
+        sliceStrides[0] = frame.strides[0];
+
+        swapDeinterleaveUV(frame.pPlanes[1] + (firstLine >> 1) * frame.strides[1] + columnX, frame.strides[1], chromaWidth, sliceLines[1], pU, pV, chromaWidth);
+      }
+      else
+      {
+        const uint8_t *pSliceIn = frame.pPlanes[0] + firstLine * frame.strides[0] + columnX * 4;
+        uint8_t *pY = pV + chromaSize;
+
+        swapConvertRGBToYUV420(pSliceIn, frame.strides[0], columnWidth, sliceLines[0], format, pY, pU, pV, columnWidth, chromaWidth);
+
+        pSlicePlanes[0] = pY;
+        sliceStrides[0] = columnWidth;
+
+        if (layout.planeCount > 3)
+        {
+          uint8_t *pA = pY + columnWidth * SWAP_SLICE_HEIGHT;
+
+          swapExtractAlpha(pSliceIn, frame.strides[0], columnWidth, sliceLines[3], pA, columnWidth);
+
+          pSlicePlanes[3] = pA;
+          sliceStrides[3] = columnWidth;
+        }
+      }
+    }
+
+    for (size_t p = 0; p < layout.planeCount; p++)
+    {
+      const auto &plane = layout.planes[p];
+      const size_t width = swapGetPlaneSize(columnWidth, plane.shiftX);
+
+      for (size_t row = 0; row < plane.blockRows; row++)
+      {
+        for (size_t x = 0; x < plane.blocksPerRow; x++)
+        {
+          swapFormatPlaneBlock(block, pSlicePlanes[p], sliceStrides[p], x << 3, row << 3, width, sliceLines[p]);
+
+          if (tables.lossless)
+            swapPredictBlockLossless((int16_t *)pCoefficients, block, 8);
+          else
+            slapDCT((int16_t *)pCoefficients, block, plane.isChroma ? tables.ICqt : tables.ILqt);
+
+          pCoefficients += grid.blockSize;
+        }
+      }
+    }
+  }
+
+  return true;
 }
 
-void idct(int *b) // 2D 8x8 IDCT
+// Entropy codes the zigzag ordered coefficients `firstCoefficient` up to `endCoefficient` of a block. The DC value is only coded (predicted from `*pLastDC`) if the band starts at 0.
+// `TCoefficient` is `int16_t` or, for high bit depth streams, `int32_t`; differences wrap around within its range, like they do in the decoder.
+template <typename TCoefficient>
+static uint8_t * swapEncodeBlock(OUT uint8_t *pOut, IN const TCoefficient *pBlock, IN const TCoefficient *pReference, IN_OUT TCoefficient *pLastDC, const size_t firstCoefficient, const size_t endCoefficient)
 {
-  int i, b2[64];
-  for (i = 0; i < 8; i++) idct1(b + i * 8, b2 + i, 9, 1 << 8); // row
-  for (i = 0; i < 8; i++) idct1(b2 + i * 8, b + i, 12, 1 << 11); // col 
+  typedef typename std::make_unsigned<TCoefficient>::type TUnsigned;
+
+  TCoefficient values[64];
+
+  if (pReference == nullptr)
+  {
+    for (size_t i = 0; i < 64; i++)
+      values[i] = pBlock[_izigzag_table_standard[i]];
+  }
+  else
+  {
+    for (size_t i = 0; i < 64; i++)
+      values[i] = (TCoefficient)(TUnsigned)((TUnsigned)pBlock[_izigzag_table_standard[i]] - (TUnsigned)pReference[_izigzag_table_standard[i]]);
+  }
+
+  if (firstCoefficient == 0)
+  {
+    const TCoefficient dc = values[0];
+    values[0] = (TCoefficient)(TUnsigned)((TUnsigned)dc - (TUnsigned)*pLastDC);
+    *pLastDC = dc;
+  }
+
+  size_t run = 0;
+
+  for (size_t i = firstCoefficient; i < endCoefficient; i++)
+  {
+    const TCoefficient value = values[i];
+
+    if (value == 0)
+    {
+      run++;
+      continue;
+    }
+
+    if (value >= INT8_MIN && value <= INT8_MAX)
+    {
+      *pOut++ = (uint8_t)((run << 2) | SWAP_TOKEN_INT8);
+      *pOut++ = (uint8_t)(int8_t)value;
+    }
+    else if (value >= INT16_MIN && value <= INT16_MAX)
+    {
+      *pOut++ = (uint8_t)((run << 2) | SWAP_TOKEN_INT16);
+      *pOut++ = (uint8_t)(value & 0xFF);
+      *pOut++ = (uint8_t)((uint16_t)value >> 8);
+    }
+    else
+    {
+      *pOut++ = (uint8_t)((run << 2) | SWAP_TOKEN_INT32);
+      *pOut++ = (uint8_t)(value & 0xFF);
+      *pOut++ = (uint8_t)(((uint32_t)value >> 8) & 0xFF);
+      *pOut++ = (uint8_t)(((uint32_t)value >> 16) & 0xFF);
+      *pOut++ = (uint8_t)((uint32_t)value >> 24);
+    }
+
+    run = 0;
+  }
+
+  *pOut++ = SWAP_TOKEN_END_OF_BLOCK;
+
+  return pOut;
 }
 
-void putIdct(uint8_t *pImage, size_t stride, uint8_t *pEncoded, uint16_t *pQt)
+// Entropy codes a band of the blocks of one slice of a tile column. DC values are predicted from the previous block of the same plane.
+template <typename TCoefficient>
+static uint8_t * swapEncodeSliceBlocks(OUT uint8_t *pOut, IN const TCoefficient *pBlock, IN const TCoefficient *pReference, const swapPlaneLayout &layout, const size_t firstCoefficient, const size_t endCoefficient)
 {
-  int encoded[64] = { 0 };
-  for (size_t i = 0; i < 64; i++)
-    encoded[i] = pEncoded[i] * pQt[i];
-  
-  idct(encoded);
+  size_t plane = 0;
+  TCoefficient lastDC = 0;
 
-  for (size_t y = 0; y < 8; y++)
+  for (size_t block = 0; block < layout.blocksPerSlice; block++)
   {
-    for (size_t x = 0; x < 8; x++)
+    if (plane + 1 < layout.planeCount && block == layout.planes[plane + 1].firstBlock)
     {
-      pImage[y + x * stride] = (uint8_t)encoded[x + y * 8];
+      plane++;
+      lastDC = 0;
     }
+
+    pOut = swapEncodeBlock(pOut, pBlock, pReference, &lastDC, firstCoefficient, endCoefficient);
+
+    pBlock += 64;
+
+    if (pReference != nullptr)
+      pReference += 64;
   }
+
+  return pOut;
 }
 
-//////////////////////////////////////////////////////////////////////////
+// Where the bands of every tile are compressed to before they're packed: every band of every tile is compressed into a buffer large enough for the whole band, so packing never overtakes the data it moves.
+struct swapBandLayout
+{
+  size_t bandCount;
+  const size_t *pBands;
+  uint32_t *pTileSizes;
+  uint8_t *pBandData[SWAP_PROGRESSIVE_BAND_COUNT];
+  size_t bandTileCapacity[SWAP_PROGRESSIVE_BAND_COUNT];
+};
 
-swapResult swapEncodeFrameYUV420(IN uint8_t * pImage, OUT uint8_t * pUncompressedData, const size_t resX, const size_t resY, mango::ConcurrentQueue *pQueue)
+// Returns `false` if the bands don't fit into `compressedDataCapacity` bytes.
+static bool swapGetBandLayout(OUT uint8_t *pCompressedData, const size_t compressedDataCapacity, const swapTileGrid &grid, const bool progressive, OUT swapBandLayout *pLayout)
 {
-  swapResult result = sR_Success;
+  const size_t tileCount = grid.tilesX * grid.tilesY;
+  const size_t tileBlockCount = grid.slicesPerTile * grid.columns[0].blocksPerSlice;
 
-  const size_t blockX = resX >> 3;
-  const size_t blockY = resY >> 3;
+  pLayout->bandCount = progressive ? SWAP_PROGRESSIVE_BAND_COUNT : 1;
+  pLayout->pBands = progressive ? swapProgressiveBands : swapSequentialBands;
+  pLayout->pTileSizes = reinterpret_cast<uint32_t *>(pCompressedData);
+  pLayout->pBandData[0] = pCompressedData + pLayout->bandCount * tileCount * sizeof(uint32_t);
 
-  uint8_t Lqt[64];
-  uint8_t Cqt[64];
-  uint16_t ILqt[64];
-  uint16_t ICqt[64];
-  uint32_t quality = 75;
+  for (size_t band = 0; band < pLayout->bandCount; band++)
+  {
+    pLayout->bandTileCapacity[band] = tileBlockCount * ((pLayout->pBands[band + 1] - pLayout->pBands[band]) * (1 + grid.coefficientSize) + 1);
 
-  swapInitDctQuantizationTables(quality, Lqt, Cqt, ILqt, ICqt);
+    if (band + 1 < pLayout->bandCount)
+      pLayout->pBandData[band + 1] = pLayout->pBandData[band] + tileCount * pLayout->bandTileCapacity[band];
+  }
 
-  for (size_t y = 0; y < blockY; y++)
+  return (size_t)(pLayout->pBandData[pLayout->bandCount - 1] + tileCount * pLayout->bandTileCapacity[pLayout->bandCount - 1] - pCompressedData) <= compressedDataCapacity;
+}
+
+static void swapCompressTile(IN uint8_t *pData, IN uint8_t *pReferenceData, const swapBandLayout &layout, const swapTileGrid &grid, const size_t tile)
+{
+  const size_t tileCount = grid.tilesX * grid.tilesY;
+  const size_t column = tile % grid.tilesX;
+  const size_t firstSlice = (tile / grid.tilesX) * grid.slicesPerTile;
+  const size_t lastSlice = std::min(firstSlice + grid.slicesPerTile, grid.sliceCount);
+  const swapPlaneLayout &planeLayout = swapGetTileColumnLayout(grid, column);
+
+  for (size_t band = 0; band < layout.bandCount; band++)
   {
-    pQueue->enqueue([blockY, blockX, y, resX, pUncompressedData, pImage, &ILqt] {
+    uint8_t *pOut = layout.pBandData[band] + tile * layout.bandTileCapacity[band];
+    uint8_t *pOutStart = pOut;
 
-      int16_t block[64 * 3];
-      int16_t temp[64];
+    for (size_t slice = firstSlice; slice < lastSlice; slice++)
+    {
+      const size_t offset = (slice * grid.blocksPerSlice + swapGetTileColumnOffset(grid, column)) * grid.blockSize;
+      const uint8_t *pReference = pReferenceData == nullptr ? nullptr : pReferenceData + offset;
 
-      for (size_t x = 0; x < blockX; x++)
-      {
-        swapFormatMCUBlock(block, pImage + ((y * blockX + x) << 6), 8, 8, (int)resX - 8);
-        slapDCT((int16_t *)(pUncompressedData + (y * blockY + x) * DCT_PER_BLOCK_SIZE), temp, ILqt);
-      }
-    });
+      if (grid.coefficientSize == sizeof(int32_t))
+        pOut = swapEncodeSliceBlocks(pOut, reinterpret_cast<const int32_t *>(pData + offset), reinterpret_cast<const int32_t *>(pReference), planeLayout, layout.pBands[band], layout.pBands[band + 1]);
+      else
+        pOut = swapEncodeSliceBlocks(pOut, reinterpret_cast<const int16_t *>(pData + offset), reinterpret_cast<const int16_t *>(pReference), planeLayout, layout.pBands[band], layout.pBands[band + 1]);
+    }
+
+    layout.pTileSizes[band * tileCount + tile] = (uint32_t)(pOut - pOutStart);
   }
+}
 
-  pQueue->wait();
+// Packs the bands tightly behind the tile size tables and returns the size of the tables and the data.
+static size_t swapPackBands(const swapBandLayout &layout, const swapTileGrid &grid)
+{
+  const size_t tileCount = grid.tilesX * grid.tilesY;
+  size_t dataSize = 0;
 
-  return result;
+  for (size_t band = 0; band < layout.bandCount; band++)
+  {
+    for (size_t tile = 0; tile < tileCount; tile++)
+    {
+      swapMemmove(layout.pBandData[0] + dataSize, layout.pBandData[band] + tile * layout.bandTileCapacity[band], layout.pTileSizes[band * tileCount + tile]);
+      dataSize += layout.pTileSizes[band * tileCount + tile];
+    }
+  }
+
+  return layout.bandCount * tileCount * sizeof(uint32_t) + dataSize;
 }
 
-swapResult swapDecodeFrameYUV420(IN uint8_t * pUncompressedData, OUT uint8_t * pImage, const size_t resX, const size_t resY, mango::ConcurrentQueue * pQueue)
+// Transforms every tile and entropy codes it right away while its samples and coefficients are still in cache, rather than streaming the whole frame through memory once for each.
+swapResult swapEncodeCompressFrame(const swapFrameDescriptor &frame, OUT uint8_t *pUncompressedData, IN uint8_t *pReferenceData, OUT uint8_t *pCompressedData, const size_t compressedDataCapacity, OUT size_t *pCompressedDataLength, const size_t resX, const size_t resY, const swapTileGrid &grid, const uint32_t quality, const uint32_t bitDepth, const bool lossless, const bool progressive, swapTaskQueue *pQueue)
 {
   swapResult result = sR_Success;
+  std::atomic<bool> allocationFailed(false);
+  swapTransformTables tables;
+  swapBandLayout layout;
 
-  const size_t blockX = resX >> 3;
-  const size_t blockY = resY >> 3;
+  if (!swapGetBandLayout(pCompressedData, compressedDataCapacity, grid, progressive, &layout))
+  {
+    result = sR_InternalError;
+    goto epilogue;
+  }
 
-  uint8_t Lqt[64];
-  uint8_t Cqt[64];
-  uint16_t ILqt[64];
-  uint16_t ICqt[64];
-  uint32_t quality = 75;
+  swapInitTransformTables(quality, bitDepth, lossless, &tables);
 
-  swapInitDctQuantizationTables(quality, Lqt, Cqt, ILqt, ICqt);
-  
-  for (size_t y = 0; y < blockY; y++)
+  swapParallelFor(pQueue, grid.tilesX * grid.tilesY, [&](const size_t tile) {
+
+    if (!swapEncodeTile(frame, pUncompressedData, resX, resY, grid, tables, tile))
+    {
+      allocationFailed = true;
+      return;
+    }
+
+    swapCompressTile(pUncompressedData, pReferenceData, layout, grid, tile);
+  });
+
+  if (allocationFailed)
   {
-    pQueue->enqueue([&, blockY, blockX, y, resX, pUncompressedData, pImage] {
-      for (size_t x = 0; x < blockX; x++)
-        putIdct(pImage + ((y << 3) * (blockX << 3) + (x << 3)), resX, pUncompressedData + (y * blockY + x) * 64, ILqt);
-        //idct_sse2(pImage + ((y * blockX + x) << 6), (int)resX, (int16_t *)(pUncompressedData + (y * blockY + x) * DCT_PER_BLOCK_SIZE), (uint16_t *)Lqt);
-    });
+    result = sR_MemoryAllocationFailure;
+    goto epilogue;
   }
 
-  pQueue->wait();
+  *pCompressedDataLength = swapPackBands(layout, grid);
 
+epilogue:
   return result;
 }
 
-template <typename T>
-void printImg(T *pI)
+// Tiles are skipped once any tile has been found to differ.
+swapResult swapEncodeMatchesReference(const swapFrameDescriptor &frame, OUT uint8_t *pUncompressedData, IN const uint8_t *pReferenceData, OUT bool *pMatches, const size_t resX, const size_t resY, const swapTileGrid &grid, const uint32_t quality, const uint32_t bitDepth, const bool lossless, swapTaskQueue *pQueue)
 {
-  size_t k = 0;
-  for (size_t i = 0; i < 8; i++)
-  {
-    for (size_t j = 0; j < 8; j++)
-      printf("%3i ", (int)pI[k++]);
-    printf("\n");
-  }
-  printf("================================\n");
-}
+  swapResult result = sR_Success;
+  std::atomic<bool> allocationFailed(false);
+  std::atomic<bool> differs(false);
+  swapTransformTables tables;
 
-void testDCT(IN uint8_t *, const size_t, const size_t)
-{
-  uint8_t Lqt[64];
-  uint8_t Cqt[64];
-  uint16_t ILqt[64];
-  uint16_t ICqt[64];
-  uint32_t quality = 75;
+  swapInitTransformTables(quality, bitDepth, lossless, &tables);
 
-  swapInitDctQuantizationTables(quality, Lqt, Cqt, ILqt, ICqt);
+  swapParallelFor(pQueue, grid.tilesX * grid.tilesY, [&](const size_t tile) {
 
-  printImg(ICqt);
+    if (differs)
+      return;
 
-  uint16_t img[64] = 
-    { 255, 255, 255, 255, 255, 255, 255, 255,
-      1, 1, 1, 1, 255, 255, 255, 255,
-      2, 2, 2, 2, 255, 255, 255, 255,
-      3, 3, 3, 3, 255, 255, 255, 255,
-      4, 4, 4, 4, 255, 255, 1, 1,
-      5, 5, 5, 5, 255, 255, 1, 1,
-      6, 6, 6, 6, 255, 255, 1, 1,
-      7, 7, 7, 7, 255, 255, 255, 255 };
+    if (!swapEncodeTile(frame, pUncompressedData, resX, resY, grid, tables, tile))
+    {
+      allocationFailed = true;
+      differs = true;
+      return;
+    }
 
-  printImg(img);
+    const size_t column = tile % grid.tilesX;
+    const size_t firstSlice = (tile / grid.tilesX) * grid.slicesPerTile;
+    const size_t lastSlice = std::min(firstSlice + grid.slicesPerTile, grid.sliceCount);
+    const size_t size = swapGetTileColumnLayout(grid, column).blocksPerSlice * grid.blockSize;
 
-  int16_t enc[64];
+    for (size_t slice = firstSlice; slice < lastSlice; slice++)
+    {
+      const size_t offset = (slice * grid.blocksPerSlice + swapGetTileColumnOffset(grid, column)) * grid.blockSize;
 
-  slapDCT(enc, (int16_t *)img, (uint16_t *)ILqt);
+      if (memcmp(pUncompressedData + offset, pReferenceData + offset, size) != 0)
+      {
+        differs = true;
+        return;
+      }
+    }
+  });
 
-  printImg(enc);
+  if (allocationFailed)
+  {
+    result = sR_MemoryAllocationFailure;
+    goto epilogue;
+  }
 
-  //putIdct(img, 8, enc, ILqt);
-  int e[64];
-  for (size_t i = 0; i < 64; i++)
-    e[i] = (enc[i] * ILqt[i]) >> 7;
-  idct(e);
-  //uint8_t q[64];
-  //idct_sse2(q, 16, enc, (uint16_t *)ILqt);
+  *pMatches = !differs;
 
-  printImg(e);
+epilogue:
+  return result;
 }
@@ -0,0 +1,291 @@
+// Copyright 2018 Christoph Stiller
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files(the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions :
+// 
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#ifndef swapcodecInternal_h__
+#define swapcodecInternal_h__
+
+#include "swapcodec.h"
+
+#include <algorithm>
+
+#include <intrin.h>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+#ifdef SSSE3
+#include <tmmintrin.h>
+#endif
+
+#pragma warning(push, 0)
+#include "mango/core/thread.hpp"
+#pragma warning(pop)
+
+//////////////////////////////////////////////////////////////////////////
+
+#define SWAP_DEFAULT_QUALITY 75
+
+// Entropy coded blocks are a sequence of `(zeroRun << 2) | sizeClass` tokens followed by the int8 (sizeClass 0), int16 (sizeClass 1) or int32 (sizeClass 2) coefficient value.
+// Only streams with 32 bit coefficients use int32 values.
+#define SWAP_TOKEN_INT8 0
+#define SWAP_TOKEN_INT16 1
+#define SWAP_TOKEN_INT32 2
+#define SWAP_TOKEN_END_OF_BLOCK 0xFF
+
+// Progressive streams code the zigzag ordered coefficients in bands: DC first, then the low frequency AC bands, then the rest. Every band ends its blocks with an end of block token.
+#define SWAP_PROGRESSIVE_BAND_COUNT 4
+
+extern const size_t swapProgressiveBands[SWAP_PROGRESSIVE_BAND_COUNT + 1];
+extern const size_t swapSequentialBands[2];
+
+// A slice is a row of 16x16 pixel macro blocks: two rows of luma blocks followed by the block rows of the U, V and alpha planes covering the same lines.
+#define SWAP_SLICE_HEIGHT 16
+#define SWAP_MAX_PLANES 4
+
+// Frames are coded in whole macro blocks; blocks on or beyond the right and bottom edge replicate the last column and line of the frame.
+inline size_t swapGetBlockCountX(const size_t resX)
+{
+  return ((resX + 15) >> 4) << 1;
+}
+
+inline size_t swapGetSliceCount(const size_t resY)
+{
+  return (resY + SWAP_SLICE_HEIGHT - 1) / SWAP_SLICE_HEIGHT;
+}
+
+// High bit depth streams quantize with the steps of 8 bit streams in units of their own samples, which takes 32 bit coefficients. Lossless residuals always fit into 16 bits.
+inline size_t swapGetCoefficientSize(const uint32_t bitDepth, const bool lossless)
+{
+  return bitDepth > 8 && !lossless ? sizeof(int32_t) : sizeof(int16_t);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+struct swapRegion
+{
+  size_t x;
+  size_t y;
+  size_t width;
+  size_t height;
+};
+
+// Blocks of the planes of a slice in coding order. DC values are predicted within each plane.
+struct swapPlaneLayout
+{
+  size_t planeCount;
+  size_t blocksPerSlice;
+
+  struct
+  {
+    size_t shiftX; // subsampling relative to the luma plane.
+    size_t shiftY;
+    size_t blocksPerRow;
+    size_t blockRows;
+    size_t firstBlock;
+    bool isChroma; // quantized with the chrominance table.
+  } planes[SWAP_MAX_PLANES];
+};
+
+void swapGetPlaneLayout(const size_t resX, const swapcodec::swapChromaFormat chromaFormat, const bool alpha, OUT swapPlaneLayout *pLayout);
+
+inline size_t swapGetPlaneSize(const size_t size, const size_t shift)
+{
+  return (size + (1 << shift) - 1) >> shift;
+}
+
+// Tiles are coded independently and cover `tileWidth` x `tileHeight` pixels, both multiples of 16. The blocks of a slice are stored tile column by tile column,
+// so a tile consists of the same column of `slicesPerTile` consecutive slices. The default grid has a single full width column and one slice per tile.
+struct swapTileGrid
+{
+  size_t tileWidth;
+  size_t tileHeight;
+  size_t tilesX;
+  size_t tilesY;
+  size_t sliceCount;
+  size_t slicesPerTile;
+  size_t blocksPerSlice; // of all tile columns.
+  size_t coefficientSize; // in bytes, see `swapGetCoefficientSize`.
+  size_t blockSize; // the coefficients of a block in bytes.
+  swapPlaneLayout columns[2]; // all but the last tile column and the last tile column.
+};
+
+void swapGetTileGrid(const size_t resX, const size_t resY, const size_t tileWidth, const size_t tileHeight, const swapcodec::swapChromaFormat chromaFormat, const bool alpha, const uint32_t bitDepth, const bool lossless, OUT swapTileGrid *pGrid);
+
+inline const swapPlaneLayout & swapGetTileColumnLayout(const swapTileGrid &grid, const size_t column)
+{
+  return grid.columns[column + 1 == grid.tilesX ? 1 : 0];
+}
+
+// Returns the offset in blocks of tile column `column` within each slice.
+inline size_t swapGetTileColumnOffset(const swapTileGrid &grid, const size_t column)
+{
+  return column * grid.columns[0].blocksPerSlice;
+}
+
+// Returns the largest encoding of a block: a token and the widest value for every coefficient and an end of block token for every band.
+inline size_t swapGetMaxEncodedBlockSize(const swapTileGrid &grid)
+{
+  return 64 * (1 + grid.coefficientSize) + SWAP_PROGRESSIVE_BAND_COUNT;
+}
+
+// Returns an upper bound for the size of a frame including its header: the tables of all bands of a progressive stream and the largest encoding of every block.
+inline size_t swapGetMaxFrameSize(const swapTileGrid &grid)
+{
+  return sizeof(swapcodec::swapFrameHeader) + grid.tilesX * grid.tilesY * (SWAP_PROGRESSIVE_BAND_COUNT * sizeof(uint32_t) + grid.slicesPerTile * grid.columns[0].blocksPerSlice * swapGetMaxEncodedBlockSize(grid));
+}
+
+// Returns `false` for formats that aren't planar.
+bool swapGetPlanarFormatInfo(const swapcodec::swapPixelFormat format, OUT swapcodec::swapChromaFormat *pChromaFormat, OUT bool *pAlpha, OUT size_t *pBytesPerSample);
+swapcodec::swapPixelFormat swapGetPlanarFormat(const swapcodec::swapChromaFormat chromaFormat, const bool alpha, const uint32_t bitDepth);
+
+//////////////////////////////////////////////////////////////////////////
+
+extern const int _izigzag_table_standard[];
+
+void swapInitDctQuantizationTables(uint32_t quality, uint8_t *pLqt, uint8_t *pCqt, uint16_t *pILqt, uint16_t *pICqt);
+
+// Dequantization tables in natural (non zigzag) order as expected by `idct_sse2`.
+void swapInitDequantizationTables(const uint32_t quality, OUT uint16_t *pLdqt, OUT uint16_t *pCdqt);
+
+void idct_sse2(uint8_t *dest, int stride, const int16_t *src, const uint16_t *qt);
+
+// Streams with more than 8 bits per sample use floating point quantization steps in natural order and a transform with 32 bit intermediates and coefficients.
+void swapInitHighBitDepthQuantizationTables(uint32_t quality, OUT float *pLqt, OUT float *pCqt);
+void swapDctHighBitDepth(OUT int32_t *pCoefficients, IN const int32_t *pBlock, IN const float *pInverseQt);
+void swapIdctHighBitDepth(OUT uint16_t *pDestination, const size_t stride, IN const int32_t *pCoefficients, IN const float *pQt, const uint32_t bitDepth);
+void swapNarrowSamples(IN const uint16_t *pSource, OUT uint8_t *pDestination, const size_t count, const uint32_t bitDepth);
+
+// Lossless streams store the prediction residuals of every block of `bitDepth` bit samples minus `1 << (bitDepth - 1)` in place of quantized coefficients.
+void swapPredictBlockLossless(OUT int16_t *pResiduals, IN const int16_t *pBlock, const uint32_t bitDepth);
+void swapReconstructBlockLossless(OUT uint8_t *pDestination, const size_t stride, IN const int16_t *pResiduals, const uint32_t bitDepth);
+void swapReconstructBlockLossless(OUT uint16_t *pDestination, const size_t stride, IN const int16_t *pResiduals, const uint32_t bitDepth);
+
+// The tasks of one encoder or decoder in a `swapThreadPool`, taken by the workers of the pool in turn with the queues of other encoders and decoders.
+struct swapTaskQueue;
+
+// `pThreadPool` of `nullptr` uses the default thread pool. Returns `nullptr` on failure.
+swapTaskQueue * swapCreateTaskQueue(IN swapcodec::swapThreadPool *pThreadPool, const swapcodec::swapPriority priority);
+
+// Waits for the queued tasks first. Called from a task of the queue, the queue is deleted once its tasks are done instead.
+void swapDestroyTaskQueue(IN swapTaskQueue *pQueue);
+
+void swapEnqueueTask(IN swapTaskQueue *pQueue, void (*pFunction)(void *pContext, const size_t item), void *pContext, const size_t item);
+
+// Waits until all tasks queued so far have been run.
+void swapWaitForTasks(IN swapTaskQueue *pQueue);
+
+// Whether the calling thread is running a task of `pQueue`, which must not wait for the tasks of its own queue.
+bool swapIsRunningTaskOf(IN const swapTaskQueue *pQueue);
+
+// The number of worker threads of the thread pool of the queue.
+size_t swapGetTaskQueueThreadCount(IN const swapTaskQueue *pQueue);
+
+// Tasks of pinned thread pools don't run on the thread waiting for them.
+bool swapIsTaskQueuePinned(IN const swapTaskQueue *pQueue);
+
+// Zeroes the buffer on the workers of the thread pool, so the operating system places its pages in the memory of the NUMA node they run on. Also faults the pages in before the first frame.
+void swapFirstTouch(IN swapTaskQueue *pQueue, OUT uint8_t *pData, const size_t size);
+
+// Calls `pFunction` for every item from `0` to `itemCount - 1` with one task per worker thread and, unless the workers are pinned, one on the calling thread. Every worker starts on a contiguous chunk of the items and steals
+// the upper half of the fullest remaining chunk once it's done with its own. Returns after all items have been processed. Runs all items on the calling thread if `pQueue` is `nullptr` or the calling thread is running one of its tasks.
+void swapParallelFor(swapTaskQueue *pQueue, const size_t itemCount, void (*pFunction)(void *pContext, const size_t item), void *pContext);
+
+template <typename TFunction>
+inline void swapParallelFor(swapTaskQueue *pQueue, const size_t itemCount, const TFunction &function)
+{
+  swapParallelFor(pQueue, itemCount, [](void *pContext, const size_t item) { (*reinterpret_cast<const TFunction *>(pContext))(item); }, const_cast<TFunction *>(&function));
+}
+
+// Every thread has an arena of scratch memory, so every `swapParallelFor` worker has its own. Memory taken from the arena is returned once the innermost scope alive on the thread ends.
+// The arena keeps its memory once the outermost scope ends and grows to the most memory taken at once, so it stops allocating after the first frame.
+struct swapArenaScope
+{
+  swapArenaScope();
+  ~swapArenaScope();
+
+  swapArenaScope(const swapArenaScope &) = delete;
+  swapArenaScope & operator = (const swapArenaScope &) = delete;
+
+private:
+  size_t used;
+};
+
+// Returns `size` bytes of the arena of the calling thread aligned to a cache line. Has to be called within a `swapArenaScope`. Returns `nullptr` if the allocation failed.
+uint8_t * swapArenaAlloc(const size_t size);
+
+template <typename T>
+inline T * swapArenaAllocArray(const size_t count)
+{
+  return reinterpret_cast<T *>(swapArenaAlloc(count * sizeof(T)));
+}
+
+// A first in, first out queue that keeps its storage for the items to come, unlike `std::deque`, which allocates and frees blocks as items pass through it.
+template <typename T>
+struct swapQueue
+{
+  bool empty() const
+  {
+    return first == items.size();
+  }
+
+  T & front()
+  {
+    return items[first];
+  }
+
+  void push_back(const T &item)
+  {
+    // Queued items are moved down over the taken ones before the storage would grow, unless they fill more than half of it.
+    if (first > 0 && items.size() == items.capacity() && first * 2 >= items.size())
+    {
+      items.erase(items.begin(), items.begin() + first);
+      first = 0;
+    }
+
+    items.push_back(item);
+  }
+
+  void pop_front()
+  {
+    if (++first == items.size())
+    {
+      items.clear();
+      first = 0;
+    }
+  }
+
+private:
+  std::vector<T> items;
+  size_t first = 0;
+};
+
+// Converts packed BGRA or RGBA pixels to limited range BT.601 planar YUV420, averaging the chroma of two by two pixels. The last column and line are replicated for odd sizes.
+void swapConvertRGBToYUV420(IN const uint8_t *pIn, const size_t inStride, const size_t width, const size_t height, const swapcodec::swapPixelFormat format, OUT uint8_t *pY, OUT uint8_t *pU, OUT uint8_t *pV, const size_t strideY, const size_t strideUV);
+
+// Copies the alpha channel of packed BGRA or RGBA pixels into a plane.
+void swapExtractAlpha(IN const uint8_t *pIn, const size_t inStride, const size_t width, const size_t height, OUT uint8_t *pA, const size_t strideA);
+
+// Splits the interleaved chroma of NV12 into separate U and V planes.
+void swapDeinterleaveUV(IN const uint8_t *pUV, const size_t inStride, const size_t width, const size_t height, OUT uint8_t *pU, OUT uint8_t *pV, const size_t strideUV);
+
+// Converts planar YUV with chroma subsampled by `1 << chromaShiftX` and `1 << chromaShiftY` to packed pixels, duplicating subsampled chroma samples. The alpha plane `pA` may be `nullptr` for opaque pixels.
+void swapConvertYUVToRGB(IN const uint8_t *pY, IN const uint8_t *pU, IN const uint8_t *pV, IN const uint8_t *pA, const size_t width, const size_t height, const size_t strideY, const size_t strideUV, const size_t strideA, const size_t chromaShiftX, const size_t chromaShiftY, OUT uint8_t *pOut, const size_t outStride, const swapcodec::swapPixelFormat format, const swapcodec::swapColorSpace colorSpace);
+
+// Hashes the visible lines of all planes of a frame with one task per band of lines. Padding between lines is ignored.
+swapcodec::swapResult swapHashFrame(const swapcodec::swapFrameDescriptor &frame, const size_t resX, const size_t resY, OUT uint64_t *pHash, swapTaskQueue *pQueue);
+
+// Transforms a planar, `sPF_NV12`, `sPF_BGRA` or `sPF_RGBA` frame into quantized coefficients (or `lossless` prediction residuals) laid out as described by `grid` in `pUncompressedData`. Packed and NV12 frames are converted per slice of each tile.
+// Every tile is entropy coded (against `pReferenceData` unless it's `nullptr`) as soon as it has been transformed; `pCompressedData` receives the tile size tables of all bands followed by the compressed bands of all tiles.
+swapcodec::swapResult swapEncodeCompressFrame(const swapcodec::swapFrameDescriptor &frame, OUT uint8_t *pUncompressedData, IN uint8_t *pReferenceData, OUT uint8_t *pCompressedData, const size_t compressedDataCapacity, OUT size_t *pCompressedDataLength, const size_t resX, const size_t resY, const swapTileGrid &grid, const uint32_t quality, const uint32_t bitDepth, const bool lossless, const bool progressive, swapTaskQueue *pQueue);
+
+// Transforms a frame like `swapEncodeCompressFrame` without entropy coding it and sets `*pMatches` if its coefficients are the ones in `pReferenceData`.
+swapcodec::swapResult swapEncodeMatchesReference(const swapcodec::swapFrameDescriptor &frame, OUT uint8_t *pUncompressedData, IN const uint8_t *pReferenceData, OUT bool *pMatches, const size_t resX, const size_t resY, const swapTileGrid &grid, const uint32_t quality, const uint32_t bitDepth, const bool lossless, swapTaskQueue *pQueue);
+
+swapcodec::swapResult swapDecodeFrame(IN const uint8_t *pCompressedData, const size_t compressedDataLength, const size_t availableDataLength, const bool progressive, const bool lossless, const size_t frameIndex, const bool isKeyframe, const size_t targetFrameIndex, IN_OUT uint8_t *pUncompressedData, IN_OUT size_t *pTileFrameIndex, OUT uint8_t *pImage, const swapRegion &region, const swapcodec::swapPixelFormat format, const swapcodec::swapColorSpace colorSpace, const swapTileGrid &grid, const uint32_t quality, const uint32_t bitDepth, swapTaskQueue *pQueue);
+
+#endif // swapcodecInternal_h__